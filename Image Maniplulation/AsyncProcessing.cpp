@@ -0,0 +1,43 @@
+#include "AsyncProcessing.h"
+#include "ImageZoom.h"
+
+//constructed on first use so programs that never go async don't start any threads
+//joined when the program exits, after the queued tasks have run
+ThreadPool& sharedExecutor()
+{
+	static ThreadPool executor;
+	return executor;
+}
+
+//the vector of pointers is copied into each task so the caller's vector can go out of scope
+//the images it points to can't
+
+std::future<Image> meanBlendAsync(const std::vector<Image*> &images, ProgressToken *progress)
+{
+	std::vector<Image*> inputs = images;
+	return sharedExecutor().submit([inputs, progress]() mutable { return meanBlend(inputs, progress); });
+}
+
+std::future<Image> medianBlendAsync(const std::vector<Image*> &images, ProgressToken *progress)
+{
+	std::vector<Image*> inputs = images;
+	return sharedExecutor().submit([inputs, progress]() mutable { return medianBlend(inputs, progress); });
+}
+
+std::future<Image> sigmaClipAsync(const std::vector<Image*> &images, int iterations, ProgressToken *progress)
+{
+	std::vector<Image*> inputs = images;
+	return sharedExecutor().submit([inputs, iterations, progress]() mutable { return sigmaClip(inputs, iterations, progress); });
+}
+
+std::future<Image> sigmaClipAsync(const std::vector<Image*> &images, float tolerence, ProgressToken *progress)
+{
+	std::vector<Image*> inputs = images;
+	return sharedExecutor().submit([inputs, tolerence, progress]() mutable { return sigmaClip(inputs, tolerence, progress); });
+}
+
+std::future<Image> zoomNearestNeighbourAsync(Image *img, int zoom, ProgressToken *progress)
+{
+	//the executor already runs tasks side by side so the zoom keeps to one thread
+	return sharedExecutor().submit([img, zoom, progress]() { return zoomNearestNeighbour(img, zoom, progress, 1); });
+}
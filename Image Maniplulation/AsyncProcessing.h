@@ -0,0 +1,23 @@
+#pragma once
+#include "Image.h"
+#include "ThreadPool.h"
+#include <future> //hold results that aren't ready yet
+
+//Asynchronous versions of the processing functions
+//Each call queues the kernel on a shared executor and returns straight away with a future holding the resulting Image,
+//so one thread can start many operations, overlap them and collect the results when it needs them
+//Nothing is written to disk - the caller decides what to do with each result, eg. writeImage(future.get(), filename)
+//The input images are not copied and must stay alive and unchanged until the future is ready
+//Exceptions thrown by a kernel, eg. std::bad_alloc, are rethrown by future.get()
+//Tasks run on the executor must not wait on other futures from it, since every worker could end up waiting
+
+//shared executor used by every async function - one worker per hardware thread, created on first use
+ThreadPool& sharedExecutor();
+
+//Async Processing Functions
+
+std::future<Image> meanBlendAsync(const std::vector<Image*> &, ProgressToken* = nullptr);
+std::future<Image> medianBlendAsync(const std::vector<Image*> &, ProgressToken* = nullptr);
+std::future<Image> sigmaClipAsync(const std::vector<Image*> &, int, ProgressToken* = nullptr);
+std::future<Image> sigmaClipAsync(const std::vector<Image*> &, float, ProgressToken* = nullptr);
+std::future<Image> zoomNearestNeighbourAsync(Image*, int, ProgressToken* = nullptr);
@@ -0,0 +1,522 @@
+#include "Batch.h"
+#include "Image.h"
+#include "ImageZoom.h"
+#include "ByteBlending.h"
+#include "Progressive.h"
+#include "Checkpoint.h"
+#include "Progress.h"
+#include <fstream> //read manifest
+#include <sstream> //split manifest lines
+#include <chrono> //time each job stage
+#include <iomanip> //format report columns
+#include <new> //catch bad_alloc
+
+//***Batch Job Structure***
+
+//default constructor - job has not been run
+BatchJob::BatchJob() :
+	iterations(0),
+	tolerence(0),
+	zoom(0),
+	width(0),
+	line(0),
+	memoryBudget(0),
+	preview(false),
+	checkpointInterval(0),
+	progress(nullptr),
+	status(kPending),
+	readTime(0),
+	processTime(0),
+	writeTime(0),
+	cached(false)
+{}
+
+//***Batch Functions***
+
+//Parse one manifest line into a job
+//comments are stripped, a blank line gives a job with no algorithm and a line that can't be parsed gives an invalid job
+BatchJob parseJob(std::string text, unsigned int lineNo)
+{
+	BatchJob job;
+	job.line = lineNo;
+
+	//strip comments
+	size_t comment = text.find('#');
+	if (comment != std::string::npos)
+		text.erase(comment);
+
+	std::istringstream line(text);
+
+	//blank line
+	if (!(line >> job.algorithm))
+		return job;
+
+	//read the algorithm parameter if it has one
+	bool valid = true;
+	if (job.algorithm == "sigma-iter" || job.algorithm == "sigma-iter-luma")
+		valid = (bool)(line >> job.iterations) && job.iterations > 0;
+	else if (job.algorithm == "sigma-tol" || job.algorithm == "sigma-tol-luma")
+		valid = (bool)(line >> job.tolerence) && job.tolerence > 0;
+	else if (job.algorithm == "zoom")
+		valid = (bool)(line >> job.zoom) && job.zoom > 0;
+	else if (job.algorithm == "shrink")
+		valid = (bool)(line >> job.width) && job.width > 0;
+	else if (job.algorithm != "mean" && job.algorithm != "median" && job.algorithm != "median-luma" && job.algorithm != "mean8" && job.algorithm != "median8")
+		valid = false;
+
+	//remaining words are the output followed by the inputs
+	if (valid && line >> job.output)
+	{
+		std::string input;
+		while (line >> input)
+			job.inputs.push_back(input);
+	}
+
+	//zoom and shrink take exactly one input, blends need at least one
+	if (!valid || job.inputs.empty() || ((job.algorithm == "zoom" || job.algorithm == "shrink") && job.inputs.size() != 1))
+	{
+		job.status = kInvalidJob;
+		job.error = "Can't parse manifest line";
+	}
+
+	return job;
+}
+
+//Read a manifest file into a list of jobs
+//lines that can't be parsed are kept as invalid jobs so that they show up in the report
+std::vector<BatchJob> readManifest(const char *filename)
+{
+	std::vector<BatchJob> jobs;
+	std::ifstream ifs(filename);
+
+	if (ifs.fail())
+	{
+		fprintf(stderr, "Can't open the batch manifest %s\n", filename);
+		return jobs;
+	}
+
+	std::string text;
+	unsigned int lineNo = 0;
+	while (std::getline(ifs, text))
+	{
+		BatchJob job = parseJob(text, ++lineNo);
+
+		//skip blank lines
+		if (!job.algorithm.empty())
+			jobs.push_back(job);
+	}
+
+	return jobs;
+}
+
+//The blending algorithm of a job with its parameter bound, so that it can be run on any set of frames
+BlendFunction blendFunction(const BatchJob &job)
+{
+	int iterations = job.iterations;
+	float tolerence = job.tolerence;
+	//a cancelled blend returns an empty image
+	ProgressToken *progress = job.progress;
+	if (job.algorithm == "mean")
+		return [progress](std::vector<Image*> &frames) { return meanBlend(frames, progress); };
+	if (job.algorithm == "median")
+		return [progress](std::vector<Image*> &frames) { return medianBlend(frames, progress); };
+	if (job.algorithm == "median-luma")
+		return [progress](std::vector<Image*> &frames) { return lumaMedianBlend(frames, progress); };
+	//counts from every band of the job add up in the same test
+	StaticPixels *test = job.staticPixels.get();
+	if (job.algorithm == "sigma-iter")
+		return [iterations, progress, test](std::vector<Image*> &frames) { return sigmaClip(frames, iterations, progress, test); };
+	if (job.algorithm == "sigma-iter-luma")
+		return [iterations, progress](std::vector<Image*> &frames) { return lumaSigmaClip(frames, iterations, progress); };
+	if (job.algorithm == "sigma-tol-luma")
+		return [tolerence, progress](std::vector<Image*> &frames) { return lumaSigmaClip(frames, tolerence, progress); };
+	return [tolerence, progress, test](std::vector<Image*> &frames) { return sigmaClip(frames, tolerence, progress, test); };
+}
+
+//Run a job one band at a time so that it stays within its memory budget
+//reading, processing and writing overlap so the whole time is counted as processing
+static JobStatus runJobWithinBudget(BatchJob &job)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	//the pool already runs jobs side by side so each job gets one thread
+	job.plan = TilePlan();
+	job.plan.budget = job.memoryBudget;
+	job.plan.concurrency = 1;
+
+	bool ok;
+	if (job.algorithm == "zoom")
+		ok = zoomWithinBudget(job.inputs.front(), job.zoom, job.output.c_str(), job.plan, job.progress);
+	else
+		//every band is blended the same way
+		ok = blendWithinBudget(job.inputs, blendFunction(job), job.output.c_str(), job.plan);
+
+	job.processTime = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+	if (ok)
+		job.status = kSucceeded;
+	else
+	{
+		job.status = kProcessFailed;
+		job.error = job.plan.bandRows == 0 ? "Memory budget too small or inputs can't be read" : "Band processing failed";
+	}
+
+	return job.status;
+}
+
+//Run an 8 bit blend that never converts samples to floats
+//reading, blending and writing happen in one call so the whole time is counted as processing
+static JobStatus runByteJob(BatchJob &job)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	bool ok;
+	try
+	{
+		if (job.algorithm == "mean8")
+			ok = byteMeanBlending(job.inputs, job.output.c_str(), job.progress);
+		else
+			ok = byteMedianBlending(job.inputs, job.output.c_str(), job.progress);
+	}
+	catch (const std::bad_alloc &)
+	{
+		ok = false;
+	}
+
+	job.processTime = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+	if (ok)
+		job.status = kSucceeded;
+	else
+	{
+		job.status = kProcessFailed;
+		job.error = "Inputs must be 8 bit binary ppm files of the same size";
+	}
+	return job.status;
+}
+
+//Downscale a frame while it is read, without holding it all in memory
+//reading, downscaling and writing happen in one call so the whole time is counted as processing
+static JobStatus runShrinkJob(BatchJob &job)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	bool ok;
+	try
+	{
+		ok = downscaleFile(job.inputs.front().c_str(), job.output.c_str(), (unsigned int)job.width, job.progress);
+	}
+	catch (const std::bad_alloc &)
+	{
+		ok = false;
+	}
+
+	job.processTime = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+	if (ok)
+		job.status = kSucceeded;
+	else
+	{
+		job.status = kProcessFailed;
+		job.error = "Can't downscale " + job.inputs.front() + " to that width";
+	}
+	return job.status;
+}
+
+//Bytes a job needs to hold every frame and its output in memory at once
+//returns 0 unless every input is a pnm file, since only those can be read a band at a time
+static unsigned long long inMemoryBytes(const BatchJob &job)
+{
+	//in doubles, as the largest headers describe more bytes than 64 bits can count
+	double frameBytes = 0;
+	for (size_t i = 0; i < job.inputs.size(); ++i)
+	{
+		unsigned int w, h, b;
+		if (!readPPMSize(job.inputs[i].c_str(), w, h, b))
+			return 0;
+		frameBytes = (double)w * h * sizeof(Image::Rgb);
+	}
+
+	double bytes = job.algorithm == "zoom" ? frameBytes + frameBytes * job.zoom * job.zoom : (job.inputs.size() + 1) * frameBytes;
+	return bytes < 1.8e19 ? (unsigned long long)bytes : ~0ull;
+}
+
+//Give a job that won't fit in memory a budget so that it runs a band at a time
+//half of the memory the process can use is left for the rest of the batch and everything else on the machine or in the container
+//returns false if the job can't be run in bands
+static bool runOutOfCore(BatchJob &job)
+{
+	unsigned long long physical = physicalMemory();
+	if (inMemoryBytes(job) == 0 || physical == 0)
+		return false;
+
+	job.memoryBudget = physical / 2;
+	return true;
+}
+
+static JobStatus runUncachedJob(BatchJob &, ResultCache *);
+
+//Run a single job on the calling thread
+//reads every input, runs the algorithm and writes the output, recording the time taken by each stage
+//with a cache, a job whose inputs and parameters have been seen before just copies the stored output
+JobStatus runJob(BatchJob &job, ResultCache *cache)
+{
+	//invalid jobs are reported as they are
+	if (job.status == kInvalidJob)
+		return job.status;
+
+	//jobs that haven't started when the batch is cancelled are skipped
+	if (job.progress != nullptr && job.progress->isCancelled())
+	{
+		job.status = kProcessFailed;
+		job.error = "Cancelled";
+		return job.status;
+	}
+
+	std::string key;
+	if (cache != nullptr)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		//every parameter is part of the key even if the algorithm ignores it
+		std::stringstream parameters;
+		//floats are written with enough digits to tell every value apart, as they are for shards
+		parameters << std::setprecision(9) << job.algorithm << " " << job.iterations << " " << job.tolerence << " " << job.zoom << " " << job.width;
+		//only added when used so that keys from before the test still match
+		if (job.staticPixels)
+			parameters << " static " << job.staticPixels->spread;
+		key = cache->jobKey(parameters.str(), job.output, job.inputs);
+
+		if (!key.empty() && cache->fetch(key, job.output))
+		{
+			job.cached = true;
+			job.status = kSucceeded;
+			job.readTime = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+			return job.status;
+		}
+	}
+
+	runUncachedJob(job, cache);
+
+	//whatever failure a cancelled algorithm caused, cancelling is the reason for it
+	if (job.progress != nullptr && job.progress->isCancelled() && job.status != kSucceeded)
+		job.error = "Cancelled";
+
+	//keep the output for next time
+	if (cache != nullptr && !key.empty() && job.status == kSucceeded)
+		cache->store(key, job.output);
+
+	return job.status;
+}
+
+//Run a job without looking for its output in the cache
+//the cache is only used for decoded frames
+static JobStatus runUncachedJob(BatchJob &job, ResultCache *cache)
+{
+	//8 bit blends read, blend and write raw bytes in one step
+	if (job.algorithm == "mean8" || job.algorithm == "median8")
+		return runByteJob(job);
+
+	//downscaling streams its input a band at a time
+	if (job.algorithm == "shrink")
+		return runShrinkJob(job);
+
+	//frames too large to hold in memory together are processed out of core, as if the job had a budget
+	if (job.memoryBudget == 0 && inMemoryBytes(job) > physicalMemory() / 2)
+		runOutOfCore(job);
+
+	//jobs with a budget never hold whole frames
+	if (job.memoryBudget > 0)
+		return runJobWithinBudget(job);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<Image*> images;
+
+	try
+	{
+		//read inputs
+		for (size_t i = 0; i < job.inputs.size(); ++i)
+		{
+			images.push_back(new Image());
+			*images.back() = cache != nullptr ? cache->readFrame(job.inputs[i]) : readImage(job.inputs[i].c_str());
+
+			//an empty image is returned on failure
+			if (images.back()->getSize() == 0)
+			{
+				job.status = kReadFailed;
+				job.error = "Can't read " + job.inputs[i];
+				break;
+			}
+			//blending needs every frame to be the same size
+			if (images.back()->getWidth() != images.front()->getWidth() || images.back()->getHeight() != images.front()->getHeight())
+			{
+				job.status = kInvalidJob;
+				job.error = job.inputs[i] + " has different dimensions to " + job.inputs.front();
+				break;
+			}
+		}
+
+		std::chrono::steady_clock::time_point read = std::chrono::steady_clock::now();
+		job.readTime = (int)std::chrono::duration_cast<std::chrono::milliseconds>(read - start).count();
+
+		//whole frame sigma clipping can carry on from an earlier run that was killed
+		std::unique_ptr<Checkpoint> checkpoint;
+		if (job.status == kPending && job.checkpointInterval > 0 && !job.preview && (job.algorithm == "sigma-iter" || job.algorithm == "sigma-tol"))
+		{
+			//the static test changes the output so it is part of the job
+			std::stringstream parameters;
+			parameters << std::setprecision(9) << job.algorithm << " ";
+			if (job.algorithm == "sigma-iter")
+				parameters << job.iterations;
+			else
+				parameters << job.tolerence;
+			if (job.staticPixels)
+				parameters << " static " << job.staticPixels->spread;
+			checkpoint.reset(new Checkpoint(job.output, parameters.str(), job.inputs, job.checkpointInterval));
+		}
+
+		if (job.status == kPending)
+		{
+			//run algorithm
+			Image output;
+			if (checkpoint)
+				output = job.algorithm == "sigma-iter" ? sigmaClip(images, job.iterations, job.progress, job.staticPixels.get(), checkpoint.get())
+					: sigmaClip(images, job.tolerence, job.progress, job.staticPixels.get(), checkpoint.get());
+			else if (job.preview && job.algorithm != "zoom")
+				//previews are written to the output as they are ready, the full blend is written below
+				output = progressiveBlend(images, blendFunction(job), [&job](const Image &preview, unsigned int)
+				{
+					return writeImage(preview, job.output.c_str());
+				}, job.progress);
+			else if (job.algorithm == "zoom")
+				//the pool already runs jobs side by side so the zoom keeps to one thread
+				output = zoomNearestNeighbour(images.front(), job.zoom, job.progress, 1);
+			else
+				output = blendFunction(job)(images);
+
+			std::chrono::steady_clock::time_point processed = std::chrono::steady_clock::now();
+			job.processTime = (int)std::chrono::duration_cast<std::chrono::milliseconds>(processed - read).count();
+
+			//write output
+			if (output.getSize() == 0)
+			{
+				job.status = kProcessFailed;
+				job.error = "Algorithm produced no output";
+			}
+			else if (!writeImage(output, job.output.c_str()))
+			{
+				job.status = kWriteFailed;
+				job.error = "Can't write " + job.output;
+			}
+			else
+			{
+				job.status = kSucceeded;
+				if (checkpoint)
+					checkpoint->remove();
+			}
+
+			job.writeTime = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - processed).count();
+		}
+	}
+	//catch running out of memory so that the rest of the batch can continue
+	catch (const std::bad_alloc &)
+	{
+		job.status = kOutOfMemory;
+		job.error = "Out of memory";
+	}
+
+	//deallocate memory used by Images
+	for (size_t i = 0; i < images.size(); ++i)
+		delete images[i];
+
+	//try again a band at a time once the whole frames have been freed
+	if (job.status == kOutOfMemory && runOutOfCore(job))
+	{
+		job.status = kPending;
+		job.error.clear();
+		return runJobWithinBudget(job);
+	}
+
+	return job.status;
+}
+
+//Run every job on the thread pool
+//the pool size is the limit on how many jobs run at once
+//returns the number of jobs that failed
+unsigned int runBatch(std::vector<BatchJob> &jobs, ThreadPool &pool, ResultCache *cache)
+{
+	std::vector<std::future<JobStatus>> results;
+
+	//queue all jobs - each task only touches its own job
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		BatchJob *job = &jobs[i];
+		results.push_back(pool.submit([job, cache]() { return runJob(*job, cache); }));
+	}
+
+	//wait for every job and count failures
+	unsigned int failed = 0;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		if (results[i].get() != kSucceeded)
+			++failed;
+	}
+
+	return failed;
+}
+
+//Write one line per job with its exit status and timings
+void writeBatchReport(const std::vector<BatchJob> &jobs, std::ostream &os)
+{
+	unsigned int failed = 0;
+
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		const BatchJob &job = jobs[i];
+		os << "line " << std::setw(5) << job.line << "  " << std::setw(15) << std::left << job.algorithm << std::right
+			<< "  " << std::setw(13) << toString(job.status)
+			<< "  read " << std::setw(6) << job.readTime << "ms  process " << std::setw(6) << job.processTime
+			<< "ms  write " << std::setw(6) << job.writeTime << "ms  ";
+		//predicted and measured memory of jobs that were run in bands
+		if (job.plan.bandRows > 0)
+			os << "peak " << std::fixed << std::setprecision(1) << job.plan.actualPeak / (1024.0 * 1024.0) << "/" << job.plan.predictedPeak / (1024.0 * 1024.0) << "MB  ";
+		if (job.cached)
+			os << "cached  ";
+		//share of pixels that skipped clipping
+		if (job.staticPixels && job.staticPixels->staticCount + job.staticPixels->clippedCount > 0)
+			os << "static " << std::fixed << std::setprecision(1) << 100.0 * job.staticPixels->staticCount / (job.staticPixels->staticCount + job.staticPixels->clippedCount) << "%  ";
+		os << job.output;
+		if (!job.error.empty())
+			os << "  (" << job.error << ")";
+		os << "\n";
+
+		if (job.status != kSucceeded)
+			++failed;
+	}
+
+	os << jobs.size() - failed << " of " << jobs.size() << " job(s) succeeded" << std::endl;
+}
+
+//Readable name of a job status for the report
+const char* toString(JobStatus status)
+{
+	switch (status)
+	{
+	case kPending:
+		return "pending";
+	case kSucceeded:
+		return "succeeded";
+	case kInvalidJob:
+		return "invalid job";
+	case kReadFailed:
+		return "read failed";
+	case kProcessFailed:
+		return "process failed";
+	case kOutOfMemory:
+		return "out of memory";
+	case kWriteFailed:
+		return "write failed";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "ThreadPool.h"
+#include "TilePlanner.h"
+#include "ResultCache.h"
+#include <string> //hold filenames and algorithm names
+#include <vector> //hold jobs and their inputs
+#include <ostream> //write batch report
+#include <memory> //share static pixel counts between the bands of a job
+
+//Exit status of a single batch job
+enum JobStatus
+{
+	kPending, //not run yet
+	kSucceeded, //output written
+	kInvalidJob, //bad manifest line or parameters
+	kReadFailed, //an input could not be read
+	kProcessFailed, //algorithm failed
+	kOutOfMemory, //frames didn't fit in memory and the job couldn't be run a band at a time instead
+	kWriteFailed //output could not be written
+};
+
+//One line of a batch manifest
+//Manifest format - one job per line, '#' starts a comment:
+//	mean <output> <input> <input>...
+//	median <output> <input> <input>...
+//	median-luma <output> <input> <input>...
+//	mean8 <output> <input> <input>...
+//	median8 <output> <input> <input>...
+//	sigma-iter <iterations> <output> <input> <input>...
+//	sigma-tol <tolerence> <output> <input> <input>...
+//	sigma-iter-luma <iterations> <output> <input> <input>...
+//	sigma-tol-luma <tolerence> <output> <input> <input>...
+//	zoom <factor> <output> <input>
+//	shrink <width> <output> <input>
+//Files ending in .pfm are read and written as float maps, anything else as binary ppm
+//mean8 and median8 blend 8 bit ppm files on their raw bytes, see ByteBlending.h
+//the -luma blends pick or reject whole frames per pixel by luma instead of each channel on its own
+//shrink downscales to a new width by area averaging, keeping the aspect ratio, see AreaDownscaler in ImageZoom.h
+//with preview set, float blends that hold whole frames write coarse previews to their output first, see Progressive.h
+//with staticPixels set, sigma-iter and sigma-tol jobs give pixels whose samples barely differ the mean without clipping them, see StaticPixels in Image.h
+//with a checkpoint interval, sigma-iter and sigma-tol jobs that hold whole frames save finished rows to <output>.checkpoint and
+//carry on from them if the job is run again after being killed, see Checkpoint.h
+struct BatchJob
+{
+	BatchJob();
+
+	//job description
+	std::string algorithm; //mean, median, median-luma, mean8, median8, sigma-iter, sigma-tol, sigma-iter-luma, sigma-tol-luma, zoom or shrink
+	std::vector<std::string> inputs; //input frame filenames
+	std::string output; //output filename
+	int iterations; //sigma-iter and sigma-iter-luma parameter
+	float tolerence; //sigma-tol and sigma-tol-luma parameter
+	int zoom; //zoom parameter
+	int width; //shrink parameter
+	unsigned int line; //manifest line number for reporting
+	unsigned long long memoryBudget; //bytes the job may use, 0 = no limit
+	bool preview; //blend coarse to fine, writing a preview to the output after each pass
+	std::shared_ptr<StaticPixels> staticPixels; //static pixel test of sigma clipping jobs and its counts, nullptr = clip every pixel
+	unsigned int checkpointInterval; //seconds between checkpoints of sigma clipping jobs, 0 = no checkpoint
+	ProgressToken *progress; //stops the job at its next row or chunk once cancelled, shared by every job of a batch, nullptr = runs to the end
+
+	//job result
+	JobStatus status; //exit status of the job
+	std::string error; //reason for failure
+	int readTime; //time taken to read inputs in ms
+	int processTime; //time taken by the algorithm in ms
+	int writeTime; //time taken to write output in ms
+	TilePlan plan; //band plan used when the job has a memory budget
+	bool cached; //output was copied from the result cache
+};
+
+//Batch Functions
+
+BatchJob parseJob(std::string, unsigned int);
+std::vector<BatchJob> readManifest(const char*);
+JobStatus runJob(BatchJob &, ResultCache* = nullptr);
+BlendFunction blendFunction(const BatchJob &);
+unsigned int runBatch(std::vector<BatchJob> &, ThreadPool &, ResultCache* = nullptr);
+void writeBatchReport(const std::vector<BatchJob> &, std::ostream &);
+const char* toString(JobStatus);
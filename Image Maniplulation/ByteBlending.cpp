@@ -0,0 +1,169 @@
+#include "ByteBlending.h"
+#include "Image.h"
+#include "Progress.h"
+#include "PerfCounters.h"
+#include <algorithm> //select medians
+#include <iostream> //notify user of progress
+
+//samples summed at a time so that the sums stay in the L1 cache, and the samples between progress reports
+static const size_t kChunkSamples = 8192;
+
+//chunks of samples in an output, the work added to a progress token
+static unsigned long long chunkCount(size_t samples)
+{
+	return (samples + kChunkSamples - 1) / kChunkSamples;
+}
+
+//Read every input as raw bytes, checking they all have the same dimensions
+static bool readFrames(const std::vector<std::string> &inputs, unsigned int &w, unsigned int &h, std::vector<std::vector<unsigned char>> &frames)
+{
+	if (inputs.empty())
+		return false;
+
+	frames.resize(inputs.size());
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		unsigned int fw, fh;
+		if (!readPPMBytes(inputs[i].c_str(), fw, fh, frames[i]))
+		{
+			fprintf(stderr, "Can't read %s as an 8 bit binary ppm file\n", inputs[i].c_str());
+			return false;
+		}
+		if (i == 0)
+			w = fw, h = fh;
+		else if (fw != w || fh != h)
+		{
+			fprintf(stderr, "%s has different dimensions to %s\n", inputs[i].c_str(), inputs[0].c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+//Sum each chunk of samples across every frame and turn the sums into rounded means
+//Sum is unsigned short when 255 * frames fits in 16 bits, otherwise unsigned int
+//returns false if cancelled
+template <typename Sum>
+static bool meanOfFrames(const std::vector<std::vector<unsigned char>> &frames, std::vector<unsigned char> &output, ProgressToken *progress)
+{
+	size_t samples = output.size();
+	unsigned int n = (unsigned int)frames.size();
+	Sum sums[kChunkSamples];
+	PERF_STAGE("mean blend 8 bit", (n + 1) * samples);
+
+	//every possible sum mapped to its rounded mean, when the table is small enough
+	std::vector<unsigned char> means;
+	if (255 * n < 65536)
+	{
+		means.resize(255 * n + 1);
+		for (unsigned int s = 0; s < means.size(); ++s)
+			means[s] = (unsigned char)((s + n / 2) / n);
+	}
+
+	if (progress != nullptr)
+		progress->addWork(chunkCount(samples));
+
+	for (size_t start = 0; start < samples; start += kChunkSamples)
+	{
+		size_t count = std::min(kChunkSamples, samples - start);
+
+		//frame by frame so that the inner loop is a straight add of two arrays
+		std::fill(sums, sums + count, (Sum)0);
+		for (unsigned int f = 0; f < n; ++f)
+		{
+			const unsigned char *frame = frames[f].data() + start;
+			for (size_t i = 0; i < count; ++i)
+				sums[i] = (Sum)(sums[i] + frame[i]);
+		}
+
+		//(sum + n / 2) / n rounds to nearest
+		if (!means.empty())
+		{
+			for (size_t i = 0; i < count; ++i)
+				output[start + i] = means[sums[i]];
+		}
+		else
+		{
+			for (size_t i = 0; i < count; ++i)
+				output[start + i] = (unsigned char)((sums[i] + n / 2) / n);
+		}
+
+		//report each finished chunk and stop if cancelled
+		if (progress != nullptr && !progress->advance())
+			return false;
+	}
+	return true;
+}
+
+//Select the median of each sample across every frame, rounding the mean of the middle two values for an even number of frames
+//returns false if cancelled
+static bool medianOfFrames(const std::vector<std::vector<unsigned char>> &frames, std::vector<unsigned char> &output, ProgressToken *progress)
+{
+	size_t n = frames.size();
+	size_t middle = n / 2;
+	std::vector<unsigned char> values(n);
+	PERF_STAGE("median blend 8 bit", (n + 1) * output.size());
+
+	if (progress != nullptr)
+		progress->addWork(chunkCount(output.size()));
+
+	for (size_t start = 0; start < output.size(); start += kChunkSamples)
+	{
+		size_t end = std::min(start + kChunkSamples, output.size());
+		for (size_t i = start; i < end; ++i)
+		{
+			//gather the sample from each frame
+			for (size_t f = 0; f < n; ++f)
+				values[f] = frames[f][i];
+
+			//partial sort - only the middle value has to be in place
+			std::nth_element(values.begin(), values.begin() + middle, values.end());
+			unsigned int upper = values[middle];
+
+			if (n % 2 == 1)
+				output[i] = (unsigned char)upper;
+			else
+			{
+				//lower middle is the largest value before the upper middle
+				unsigned int lower = *std::max_element(values.begin(), values.begin() + middle);
+				output[i] = (unsigned char)((lower + upper + 1) / 2);
+			}
+		}
+
+		//report each finished chunk and stop if cancelled
+		if (progress != nullptr && !progress->advance())
+			return false;
+	}
+	return true;
+}
+
+//mean blending on raw bytes written to a ppm file
+bool byteMeanBlending(const std::vector<std::string> &inputs, const char *filename, ProgressToken *progress)
+{
+	std::cout << "8 bit mean blending started..." << std::endl;
+
+	unsigned int w, h;
+	std::vector<std::vector<unsigned char>> frames;
+	if (!readFrames(inputs, w, h, frames))
+		return false;
+
+	std::vector<unsigned char> output(frames[0].size());
+	//255 * 257 is the most that fits in an unsigned short
+	bool blended = frames.size() <= 257 ? meanOfFrames<unsigned short>(frames, output, progress) : meanOfFrames<unsigned int>(frames, output, progress);
+
+	return blended && writePPMBytes(filename, w, h, output);
+}
+
+//median blending on raw bytes written to a ppm file
+bool byteMedianBlending(const std::vector<std::string> &inputs, const char *filename, ProgressToken *progress)
+{
+	std::cout << "8 bit median blending started..." << std::endl;
+
+	unsigned int w, h;
+	std::vector<std::vector<unsigned char>> frames;
+	if (!readFrames(inputs, w, h, frames))
+		return false;
+
+	std::vector<unsigned char> output(frames[0].size());
+	return medianOfFrames(frames, output, progress) && writePPMBytes(filename, w, h, output);
+}
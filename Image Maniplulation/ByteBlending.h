@@ -0,0 +1,19 @@
+#pragma once
+#include <string> //hold filenames
+#include <vector> //hold frames
+
+class ProgressToken; //defined in Progress.h
+
+//Mean and median blending of 8 bit ppm frames done entirely on the raw bytes
+//Frames are never converted to Image::Rgb, so each sample is read, blended and written without any float conversions
+//Rounding is exact and differs from the float path, which truncates when writing:
+//	mean			= (sum of samples + n / 2) / n, ie. the true mean rounded to nearest with halves rounded up
+//	median (n odd)	= middle sample
+//	median (n even)	= (lower middle + upper middle + 1) / 2, ie. halves rounded up
+//Every input must be an 8 bit binary (P6, maxval 255) file with the same dimensions
+//An optional progress token is advanced after each chunk of samples and stops the blend when cancelled, in which case nothing is written
+
+//Byte Blending Functions
+
+bool byteMeanBlending(const std::vector<std::string> &, const char*, ProgressToken* = nullptr);
+bool byteMedianBlending(const std::vector<std::string> &, const char*, ProgressToken* = nullptr);
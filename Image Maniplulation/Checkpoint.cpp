@@ -0,0 +1,166 @@
+#include "Checkpoint.h"
+#include "ResultCache.h"
+#include <fstream> //read and append the checkpoint
+#include <sstream> //build the header
+#include <iostream> //alert user to errors
+#include <cstdio> //remove the checkpoint
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h> //replace the checkpoint when it is rewritten
+#endif
+
+//first line of every checkpoint, changed if the layout changes
+static const char *kCheckpointVersion = "checkpoint 1\n";
+
+//Band of finished rows as it is stored, followed by rows x width pixels
+struct CheckpointBand
+{
+	unsigned int first, rows;
+	unsigned long long hash; //of the pixels, seeded with first so a band can't be moved
+};
+
+//***Checkpoint***
+
+//constructor
+//hashes every input, so a checkpoint is only restored for the same frames as well as the same job
+Checkpoint::Checkpoint(const std::string &output, const std::string &job, const std::vector<std::string> &inputs, unsigned int seconds) :
+	filename(output + ".checkpoint"),
+	w(0),
+	h(0),
+	saved(0),
+	open(true),
+	interval(seconds),
+	lastSave(std::chrono::steady_clock::now())
+{
+	std::stringstream text;
+	text << kCheckpointVersion << "job " << job << "\n";
+	for (size_t i = 0; i < inputs.size() && open; ++i)
+	{
+		unsigned long long hash;
+		//without a hash a changed frame can't be told apart, so the blend runs without a checkpoint
+		open = hashFile(inputs[i].c_str(), hash);
+		text << "input " << toHex(hash) << "\n";
+	}
+	header = text.str();
+}
+
+//Checkpoint member functions
+
+//Copy the rows of a matching checkpoint into output, which must already be the size of the blend
+//a checkpoint for a different job, different inputs or a different size is started again, and a band that
+//doesn't match its hash, eg. one that was being written when the job was killed, is dropped along with the bands after it
+//the checkpoint is then rewritten with just the restored rows so it ends on a whole band
+//returns the first row the blend still has to do
+unsigned int Checkpoint::restore(Image &output)
+{
+	if (!open)
+		return 0;
+
+	w = output.getWidth();
+	h = output.getHeight();
+	std::stringstream size;
+	size << "size " << w << " " << h << "\nend\n";
+	header += size.str();
+
+	std::ifstream ifs(filename.c_str(), std::ios::binary);
+	std::string found(header.size(), '\0');
+	if (ifs.read(&found[0], found.size()) && found == header)
+	{
+		CheckpointBand band;
+		while (ifs.read(reinterpret_cast<char *>(&band), sizeof(band)))
+		{
+			if (band.first != saved || band.rows == 0 || band.rows > h - saved)
+				break;
+			Image::Rgb *pixels = output.getPixels() + (size_t)band.first * w;
+			size_t bytes = (size_t)band.rows * w * sizeof(Image::Rgb);
+			if (!ifs.read(reinterpret_cast<char *>(pixels), bytes) || hashBytes(pixels, bytes, band.first) != band.hash)
+				break;
+			saved += band.rows;
+		}
+	}
+	ifs.close();
+
+	//write the restored rows as one band and swap it in, so the old checkpoint is kept until the new one is whole
+	std::string partial = filename + ".partial";
+	std::ofstream ofs(partial.c_str(), std::ios::binary | std::ios::trunc);
+	ofs << header;
+	bool ok = (saved == 0 || appendBand(ofs, output, 0, saved)) && !ofs.flush().fail();
+	ofs.close();
+#ifdef _WIN32
+	ok = ok && MoveFileExA(partial.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	ok = ok && std::rename(partial.c_str(), filename.c_str()) == 0;
+#endif
+	if (!ok)
+	{
+		fprintf(stderr, "Can't write the checkpoint %s, continuing without it\n", filename.c_str());
+		std::remove(partial.c_str());
+		open = false;
+	}
+
+	if (saved > 0)
+		std::cout << "Restored " << saved << " of " << h << " rows from " << filename << std::endl;
+	lastSave = std::chrono::steady_clock::now();
+	return saved;
+}
+
+//Append the rows finished since the last save if the interval has passed
+//cheap enough to call after every row, as it only reads the clock until a save is due
+void Checkpoint::save(const Image &output, unsigned int rows, bool force)
+{
+	if (!open || rows <= saved || rows > h)
+		return;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (!force && now - lastSave < interval)
+		return;
+
+	std::ofstream ofs(filename.c_str(), std::ios::binary | std::ios::app);
+	if (!appendBand(ofs, output, saved, rows) || ofs.flush().fail())
+	{
+		//a half written band is dropped when the checkpoint is restored
+		fprintf(stderr, "Can't write the checkpoint %s, continuing without it\n", filename.c_str());
+		open = false;
+		return;
+	}
+	saved = rows;
+	lastSave = now;
+}
+
+//Delete the checkpoint, nothing is saved afterwards
+void Checkpoint::remove()
+{
+	open = false;
+	std::remove(filename.c_str());
+}
+
+//Write rows [first, last) of output as a band
+bool Checkpoint::appendBand(std::ostream &os, const Image &output, unsigned int first, unsigned int last)
+{
+	CheckpointBand band;
+	band.first = first;
+	band.rows = last - first;
+	const Image::Rgb *pixels = output.getPixels() + (size_t)first * w;
+	size_t bytes = (size_t)band.rows * w * sizeof(Image::Rgb);
+	band.hash = hashBytes(pixels, bytes, first);
+	os.write(reinterpret_cast<const char *>(&band), sizeof(band));
+	os.write(reinterpret_cast<const char *>(pixels), bytes);
+	return !os.fail();
+}
+
+//Getter functions
+
+bool Checkpoint::isOpen() const
+{
+	return open;
+}
+
+//***Checkpoint Functions***
+
+//Filenames of a set of images, in order
+std::vector<std::string> imageNames(const std::vector<Image*> &images)
+{
+	std::vector<std::string> names;
+	for (size_t i = 0; i < images.size(); ++i)
+		names.push_back(images[i]->getName());
+	return names;
+}
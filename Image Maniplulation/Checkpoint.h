@@ -0,0 +1,46 @@
+#pragma once
+#include "Image.h"
+#include <string> //filenames and the job description
+#include <vector> //input filenames
+#include <chrono> //time between saves
+
+//Checkpoint of a long running blend, so that a job that is killed carries on from where it stopped when it is run again
+//The checkpoint is kept next to the output as <output>.checkpoint and starts with a text header describing the job -
+//the algorithm and its parameters, the output size and a hash of every input file - followed by bands of finished rows
+//stored as floats, each band with a hash of its samples
+//The blend offers its rows as it finishes them and a band is appended once the interval has passed since the last,
+//so saving costs one write of the rows finished since then
+//Restoring checks the header against the job and each band against its hash, and the blend carries on after the last whole band
+class Checkpoint
+{
+public:
+	//Checkpoint constructors
+	Checkpoint(const std::string &, const std::string &, const std::vector<std::string> &, unsigned int = 30); //output filename, algorithm and parameters, input filenames, seconds between saves
+	Checkpoint(const Checkpoint &) = delete;
+
+	//Checkpoint operator overloads
+	Checkpoint& operator=(const Checkpoint &) = delete;
+
+	//Checkpoint member functions
+	unsigned int restore(Image &); //copies finished rows into the output, returns the first row left to blend
+	void save(const Image &, unsigned int, bool = false); //output, rows finished - written once the interval has passed, or straight away if forced
+	void remove(); //delete the checkpoint once the output has been written
+
+	//Getter functions
+	bool isOpen() const; //false if an input couldn't be hashed, in which case nothing is saved
+
+private:
+	bool appendBand(std::ostream &, const Image &, unsigned int, unsigned int); //rows [first, last)
+
+	std::string filename; //<output>.checkpoint
+	std::string header; //text the checkpoint starts with
+	unsigned int w, h; //output size, set by restore
+	unsigned int saved; //rows in the checkpoint
+	bool open;
+	std::chrono::seconds interval;
+	std::chrono::steady_clock::time_point lastSave;
+};
+
+//Checkpoint Functions
+
+std::vector<std::string> imageNames(const std::vector<Image*> &); //filenames the images were read from
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector> //hold samples and prefix sums
+#include <cstddef> //window ends
+
+//Samples of one colour channel of one pixel, sorted once
+//Clipping around the median always keeps a contiguous run of the sorted samples, so instead of re-sorting and erasing
+//on every pass the run is tracked by its ends, and its median and standard deviation come from prefix sums in constant time
+//Results match median(), sDeviation() and mean() on the remaining samples exactly - see ClipWindow::sDeviation()
+struct ClipWindow
+{
+	void reset(); //sort samples and build the prefix sums
+	size_t size() const;
+	float median() const;
+	float sDeviation() const;
+	float mean() const;
+	void clip(float, float); //drop samples outside [lower, upper]
+
+	std::vector<float> samples; //filled by the caller, sorted by reset()
+	std::vector<double> sums; //prefix sums of samples - shift
+	std::vector<double> squares; //prefix sums of (samples - shift)^2
+	double shift; //median of every sample - keeps the sums small so that the variance doesn't lose precision
+	size_t first, last; //remaining samples are samples[first, last)
+};
+
+//Clip Window Functions
+
+//the two exit criteria of sigma clipping, run on a window after reset()
+void clipIterations(ClipWindow &, int);
+void clipTolerence(ClipWindow &, float);
@@ -0,0 +1,567 @@
+#include "Daemon.h"
+#include <iostream> //notify user of daemon state
+
+#ifndef _WIN32
+#include "Batch.h"
+#include "Image.h"
+#include "ImageZoom.h"
+#include "Progress.h"
+#include <map> //index cache entries and running requests
+#include <algorithm> //keep shrunk images at least a pixel high
+#include <list> //order cache entries by use
+#include <memory> //share images between requests and the cache
+#include <future> //wait for identical running requests
+#include <mutex> //guard the cache and running requests
+#include <atomic> //request counters and stop flag
+#include <sstream> //build keys and replies
+#include <iomanip> //write parameters to keys in full
+#include <chrono> //time requests
+#include <cstring> //copy into shared memory
+#include <cstdio> //report socket errors
+#include <csignal> //ignore broken connections
+#include <cerrno> //retry interrupted accepts
+#include <sys/socket.h> //Unix domain sockets
+#include <sys/un.h> //socket addresses
+#include <sys/time.h> //connection timeouts
+#include <sys/stat.h> //file modification times
+#include <sys/mman.h> //shared memory outputs
+#include <fcntl.h> //shared memory flags
+#include <poll.h> //wait for a connection or a shutdown
+#include <unistd.h> //close sockets
+
+//longest request line accepted, manifest lines are far shorter
+static const size_t kMaxRequest = 64 * 1024;
+//seconds a client has to send its request or take its reply before the connection is dropped
+static const int kConnectionTimeout = 10;
+
+//***Memory Cache Class***
+
+//Least recently used cache of images in memory, all sharing one size limit
+//images are shared so an entry can be evicted while a request is still using it
+class MemoryCache
+{
+public:
+	explicit MemoryCache(unsigned long long size) :
+		maxSize(size),
+		totalSize(0),
+		hits(0),
+		misses(0),
+		evictions(0)
+	{}
+
+	//returns nullptr on a miss
+	std::shared_ptr<Image> find(const std::string &key)
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		std::map<std::string, Entry>::iterator it = entries.find(key);
+		if (it == entries.end())
+		{
+			++misses;
+			return nullptr;
+		}
+
+		//move to the front of the use order
+		order.splice(order.begin(), order, it->second.position);
+		++hits;
+		return it->second.image;
+	}
+
+	//add an image, then evict down to the size limit
+	//an image bigger than the whole cache isn't kept
+	void add(const std::string &key, const std::shared_ptr<Image> &image)
+	{
+		unsigned long long size = (unsigned long long)image->getSize() * sizeof(Image::Rgb);
+		if (size > maxSize)
+			return;
+
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		//another request may have added it first
+		if (entries.count(key) != 0)
+			return;
+
+		order.push_front(key);
+		Entry entry;
+		entry.image = image;
+		entry.size = size;
+		entry.position = order.begin();
+		entries[key] = entry;
+		totalSize += size;
+
+		while (totalSize > maxSize)
+		{
+			//least recently used is at the back
+			std::map<std::string, Entry>::iterator oldest = entries.find(order.back());
+			totalSize -= oldest->second.size;
+			entries.erase(oldest);
+			order.pop_back();
+			++evictions;
+		}
+	}
+
+	void writeStatistics(std::ostream &os)
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		os << entries.size() << " entries, " << totalSize / (1024 * 1024) << "MB of " << maxSize / (1024 * 1024) << "MB used, "
+			<< hits << " hit(s), " << misses << " miss(es), " << evictions << " eviction(s)";
+	}
+
+private:
+	//One image held by the cache
+	struct Entry
+	{
+		std::shared_ptr<Image> image; //decoded frame or result
+		unsigned long long size; //bytes used by the pixels
+		std::list<std::string>::iterator position; //place in the use order
+	};
+
+	unsigned long long maxSize; //bytes allowed before entries are evicted
+	unsigned long long totalSize; //bytes used by all entries
+	unsigned long long hits, misses, evictions; //statistics
+	std::map<std::string, Entry> entries; //entries by key
+	std::list<std::string> order; //keys, most recently used first
+	std::mutex cacheMutex; //guards everything above
+};
+
+//***Daemon State***
+
+//Everything shared between the connections being handled
+struct DaemonState
+{
+	explicit DaemonState(unsigned long long cacheSize) :
+		cache(cacheSize),
+		listener(-1),
+		wake{ -1, -1 },
+		stopping(false),
+		requests(0),
+		computed(0),
+		cached(0),
+		shared(0)
+	{}
+
+	MemoryCache cache; //decoded frames and results
+	std::map<std::string, std::shared_future<std::shared_ptr<Image>>> running; //results being computed, by key
+	std::mutex runningMutex; //guards running
+	int listener; //listening socket
+	int wake[2]; //pipe written to by a shutdown request, polled with the listener so the accept loop sees it on every system
+	std::atomic<bool> stopping; //set by a shutdown request
+	ProgressToken progress; //cancelled by a shutdown request so running jobs stop at their next row
+	std::atomic<unsigned long long> requests, computed, cached, shared; //statistics
+};
+
+//How a result was found
+enum ResultSource
+{
+	kComputed, //the algorithm ran
+	kCached, //result was in memory
+	kShared //an identical request was already running
+};
+
+//***Daemon Functions***
+
+//Key of a frame - the file changes if its size or modification time does
+//returns an empty key if the file doesn't exist
+static std::string frameKey(const std::string &filename)
+{
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return "";
+
+	std::stringstream key;
+	key << "frame " << info.st_mtime << " " << info.st_size << " " << filename;
+	return key.str();
+}
+
+//Decoded frame from the cache, or read and added to it
+//returns nullptr if the frame can't be read
+static std::shared_ptr<Image> frame(DaemonState &state, const std::string &filename, const std::string &key)
+{
+	std::shared_ptr<Image> image = state.cache.find(key);
+	if (image)
+		return image;
+
+	//decode outside of any lock so other requests carry on
+	image = std::make_shared<Image>(readImage(filename.c_str()));
+	if (image->getSize() == 0)
+		return nullptr;
+
+	state.cache.add(key, image);
+	return image;
+}
+
+//Read the frames of a job and run its algorithm
+//returns nullptr and sets error on failure
+static std::shared_ptr<Image> process(DaemonState &state, const BatchJob &job, const std::vector<std::string> &frameKeys, std::string &error)
+{
+	//frames are held here so they can't be freed by an eviction while the algorithm runs
+	std::vector<std::shared_ptr<Image>> frames;
+	std::vector<Image*> images;
+	for (size_t i = 0; i < job.inputs.size(); ++i)
+	{
+		frames.push_back(frame(state, job.inputs[i], frameKeys[i]));
+		if (!frames.back())
+		{
+			error = "Can't read " + job.inputs[i];
+			return nullptr;
+		}
+		if (frames.back()->getWidth() != frames.front()->getWidth() || frames.back()->getHeight() != frames.front()->getHeight())
+		{
+			error = job.inputs[i] + " has different dimensions to " + job.inputs.front();
+			return nullptr;
+		}
+		images.push_back(frames.back().get());
+	}
+
+	std::shared_ptr<Image> output = std::make_shared<Image>();
+	if (job.algorithm == "zoom")
+		*output = zoomNearestNeighbour(images.front(), job.zoom, job.progress);
+	else if (job.algorithm == "shrink" && (unsigned int)job.width <= images.front()->getWidth())
+		*output = downscaleArea(*images.front(), job.width, std::max(1u, (unsigned int)(((unsigned long long)images.front()->getHeight() * job.width + images.front()->getWidth() / 2) / images.front()->getWidth())), 0, job.progress);
+	else if (job.algorithm != "shrink")
+		*output = blendFunction(job)(images);
+
+	if (output->getSize() == 0)
+	{
+		error = state.progress.isCancelled() ? "Cancelled by shutdown" : "Algorithm produced no output";
+		return nullptr;
+	}
+	return output;
+}
+
+//Result of a job, from the cache, from an identical request that is already running, or computed here
+//returns nullptr and sets error on failure
+static std::shared_ptr<Image> result(DaemonState &state, const BatchJob &job, ResultSource &source, std::string &error)
+{
+	//the result depends on the algorithm, its parameters and the version of every input
+	std::vector<std::string> frameKeys;
+	std::stringstream key;
+	key << std::setprecision(9) << "result " << job.algorithm << " " << job.iterations << " " << job.tolerence << " " << job.zoom << " " << job.width;
+	for (size_t i = 0; i < job.inputs.size(); ++i)
+	{
+		frameKeys.push_back(frameKey(job.inputs[i]));
+		if (frameKeys.back().empty())
+		{
+			error = "Can't read " + job.inputs[i];
+			return nullptr;
+		}
+		key << "\n" << frameKeys.back();
+	}
+
+	std::shared_ptr<Image> output = state.cache.find(key.str());
+	if (output)
+	{
+		source = kCached;
+		return output;
+	}
+
+	//join an identical request if one is running, otherwise register this one
+	std::promise<std::shared_ptr<Image>> promise;
+	{
+		std::unique_lock<std::mutex> lock(state.runningMutex);
+		std::map<std::string, std::shared_future<std::shared_ptr<Image>>>::iterator it = state.running.find(key.str());
+		if (it != state.running.end())
+		{
+			std::shared_future<std::shared_ptr<Image>> running = it->second;
+			lock.unlock();
+
+			source = kShared;
+			output = running.get();
+			if (!output)
+				error = "Identical request failed";
+			return output;
+		}
+		state.running[key.str()] = promise.get_future().share();
+	}
+
+	source = kComputed;
+	try
+	{
+		output = process(state, job, frameKeys, error);
+	}
+	//out of memory fails this request rather than the daemon
+	catch (const std::bad_alloc &)
+	{
+		output = nullptr;
+		error = "Out of memory";
+	}
+
+	if (output)
+		state.cache.add(key.str(), output);
+
+	//wake any identical requests, then stop sharing
+	promise.set_value(output);
+	std::lock_guard<std::mutex> lock(state.runningMutex);
+	state.running.erase(key.str());
+	return output;
+}
+
+//Write an image into a POSIX shared memory object in pfm format
+static bool writeSharedMemory(const Image &img, const std::string &name)
+{
+	std::stringstream header;
+	//scale of -1 marks little endian samples, which is what every platform with shared memory objects uses in practice
+	unsigned int one = 1;
+	bool littleEndian = *reinterpret_cast<unsigned char *>(&one) == 1;
+	header << "PF\n" << img.getWidth() << " " << img.getHeight() << "\n" << (littleEndian ? "-1.0" : "1.0") << "\n";
+
+	size_t rowBytes = (size_t)img.getWidth() * sizeof(Image::Rgb);
+	size_t size = header.str().size() + rowBytes * img.getHeight();
+
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, (off_t)size) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *memory = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+		return false;
+
+	unsigned char *out = static_cast<unsigned char *>(memory);
+	memcpy(out, header.str().data(), header.str().size());
+	out += header.str().size();
+
+	//pfm rows go from the bottom of the image to the top
+	for (unsigned int y = img.getHeight(); y > 0; --y, out += rowBytes)
+		memcpy(out, img.getPixels() + (size_t)(y - 1) * img.getWidth(), rowBytes);
+
+	munmap(memory, size);
+	return true;
+}
+
+//Run one request line and build its reply
+static std::string handleRequest(DaemonState &state, const std::string &request)
+{
+	std::stringstream reply;
+	++state.requests;
+
+	if (request == "stats")
+	{
+		reply << "ok " << state.requests << " request(s), " << state.computed << " computed, " << state.cached << " cached, " << state.shared << " shared, cache ";
+		state.cache.writeStatistics(reply);
+		return reply.str();
+	}
+	if (request == "shutdown")
+	{
+		state.stopping = true;
+		state.progress.cancel();
+		//wakes the accept loop
+		char byte = 0;
+		if (write(state.wake[1], &byte, 1) != 1)
+			fprintf(stderr, "Can't wake the daemon to shut it down\n");
+		return "ok shutting down";
+	}
+
+	BatchJob job = parseJob(request, 0);
+	if (job.algorithm.empty() || job.status == kInvalidJob)
+		return "error Can't parse request";
+	job.progress = &state.progress;
+	//8 bit blends never decode frames so there is nothing to keep in memory for them
+	if (job.algorithm == "mean8" || job.algorithm == "median8")
+		return "error 8 bit blends aren't supported by the daemon";
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	ResultSource source = kComputed;
+	std::string error;
+	std::shared_ptr<Image> output = result(state, job, source, error);
+	if (!output)
+		return "error " + error;
+
+	bool written;
+	if (job.output.compare(0, 4, "shm:") == 0)
+		written = writeSharedMemory(*output, job.output.substr(4));
+	else
+		written = writeImage(*output, job.output.c_str());
+	if (!written)
+		return "error Can't write " + job.output;
+
+	if (source == kComputed)
+		++state.computed;
+	else if (source == kCached)
+		++state.cached;
+	else
+		++state.shared;
+
+	reply << "ok " << job.output << " " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+		<< (source == kComputed ? " computed" : source == kCached ? " cached" : " shared");
+	return reply.str();
+}
+
+//Read one line from a connection, run it and send the reply
+static void handleConnection(DaemonState &state, int connection)
+{
+	//a client that stops sending would otherwise hold a worker forever
+	timeval timeout;
+	timeout.tv_sec = kConnectionTimeout;
+	timeout.tv_usec = 0;
+	setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	//read in blocks up to the end of the line, anything after it is ignored
+	std::string request;
+	char block[4096];
+	size_t end;
+	while ((end = request.find('\n')) == std::string::npos && request.size() <= kMaxRequest)
+	{
+		ssize_t n = read(connection, block, sizeof(block));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			//timed out or failed - there is no one to reply to
+			close(connection);
+			return;
+		}
+		if (n == 0)
+			break;
+		request.append(block, (size_t)n);
+	}
+	bool tooLong = end == std::string::npos ? request.size() > kMaxRequest : end > kMaxRequest;
+	if (end != std::string::npos)
+		request.resize(end);
+
+	//trim a trailing carriage return and spaces
+	while (!request.empty() && (request.back() == '\r' || request.back() == ' '))
+		request.pop_back();
+
+	std::string reply = (tooLong ? std::string("error Request too long") : handleRequest(state, request)) + "\n";
+	size_t sent = 0;
+	while (sent < reply.size())
+	{
+		ssize_t n = write(connection, reply.data() + sent, reply.size() - sent);
+		if (n <= 0)
+			break;
+		sent += (size_t)n;
+	}
+	close(connection);
+}
+
+//socket address for a path, returns false if the path is too long
+static bool socketAddress(const char *path, sockaddr_un &address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path))
+		return false;
+	strcpy(address.sun_path, path);
+	return true;
+}
+
+//Listen on the socket and handle every connection on a pool of workers until a shutdown request
+//returns 0 after a shutdown, 1 if the socket can't be set up
+int runDaemon(const char *path, unsigned long long cacheSize, unsigned int threads)
+{
+	sockaddr_un address;
+	if (!socketAddress(path, address))
+	{
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return 1;
+	}
+
+	DaemonState state(cacheSize);
+	state.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	//a socket left by a daemon that didn't shut down cleanly is replaced
+	unlink(path);
+	if (state.listener < 0 || bind(state.listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(state.listener, 64) != 0 || pipe(state.wake) != 0)
+	{
+		fprintf(stderr, "Can't listen on %s\n", path);
+		if (state.listener >= 0)
+			close(state.listener);
+		return 1;
+	}
+
+	//a client that disconnects before its reply mustn't stop the daemon
+	std::signal(SIGPIPE, SIG_IGN);
+
+	{
+		//pool is destroyed before the socket is removed so running requests can reply
+		ThreadPool pool(threads);
+		std::cout << "Daemon listening on " << path << " with " << pool.getThreadCount() << " thread(s) and a " << cacheSize / (1024 * 1024) << "MB cache" << std::endl;
+
+		while (!state.stopping)
+		{
+			//shutting down a listening socket only wakes accept on some systems, so the wake pipe is polled as well
+			pollfd waiting[2] = { { state.listener, POLLIN, 0 }, { state.wake[0], POLLIN, 0 } };
+			if (poll(waiting, 2, -1) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			if (state.stopping || waiting[1].revents != 0)
+				break;
+			if (waiting[0].revents == 0)
+				continue;
+
+			int connection = accept(state.listener, nullptr, nullptr);
+			if (connection < 0)
+			{
+				//the client may have given up between the poll and the accept
+				if ((errno == EINTR || errno == ECONNABORTED) && !state.stopping)
+					continue;
+				break;
+			}
+			pool.submit([&state, connection]() { handleConnection(state, connection); });
+		}
+	}
+
+	close(state.listener);
+	close(state.wake[0]);
+	close(state.wake[1]);
+	unlink(path);
+	std::cout << "Daemon stopped after " << state.requests << " request(s)" << std::endl;
+	return 0;
+}
+
+//Send one request to a daemon and write its reply
+//returns 0 if the daemon replied ok
+int sendRequest(const char *path, const std::string &request, std::ostream &os)
+{
+	sockaddr_un address;
+	int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection < 0 || !socketAddress(path, address) || connect(connection, (sockaddr *)&address, sizeof(address)) != 0)
+	{
+		fprintf(stderr, "Can't connect to a daemon on %s\n", path);
+		if (connection >= 0)
+			close(connection);
+		return 1;
+	}
+
+	std::string line = request + "\n";
+	if (write(connection, line.data(), line.size()) != (ssize_t)line.size())
+	{
+		close(connection);
+		return 1;
+	}
+
+	std::string reply;
+	char buffer[256];
+	ssize_t n;
+	while ((n = read(connection, buffer, sizeof(buffer))) > 0)
+		reply.append(buffer, (size_t)n);
+	close(connection);
+
+	os << reply;
+	return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+}
+
+#else
+
+//Unix domain sockets and shared memory objects aren't available
+int runDaemon(const char *path, unsigned long long cacheSize, unsigned int threads)
+{
+	std::cout << "Daemon mode isn't available on Windows" << std::endl;
+	return 1;
+}
+
+int sendRequest(const char *path, const std::string &request, std::ostream &os)
+{
+	std::cout << "Daemon mode isn't available on Windows" << std::endl;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+#include <string> //hold requests
+#include <ostream> //write replies
+
+//Long running stacking service listening on a Unix domain socket
+//Decoded frames and results are kept in memory, least recently used first out, so repeat requests skip reading and decoding
+//Each connection sends one request line and gets one reply line back:
+//	<manifest line>		any mean, median, sigma-iter, sigma-tol, zoom or shrink line from a batch manifest, see Batch.h
+//	stats				cache and request counts
+//	shutdown			stop the daemon, cancelling running requests at their next row
+//Replies are "ok <output> <ms> <computed|cached|shared>" or "error <reason>"
+//Requests over 64KB are refused, and a client that sends nothing or takes nothing for 10 seconds is disconnected
+//	computed = the algorithm ran, cached = the result was in memory, shared = an identical request was already running and its result was reused
+//An output named shm:/<name> is written to a POSIX shared memory object in pfm format instead of a file
+//Only available where Unix domain sockets are, ie. not on Windows
+
+//Daemon Functions
+
+int runDaemon(const char*, unsigned long long, unsigned int = 0); //socket path, cache size in bytes, worker threads
+int sendRequest(const char*, const std::string &, std::ostream &); //socket path, request line, where the reply goes
@@ -1,11 +1,9 @@
-#define _CRT_SECURE_NO_WARNINGS //allow use of std::localtime and std::put_time 
-								//may cause data races in multi-threaded application
 #include "Image.h"
-#include <fstream> //output log file
-#include <sstream> //concatenate strings
-#include <chrono> //getting current date
-#include <iomanip> //outputting time
+#include "Logging.h"
 #include <iostream> //alert user to error
+#include <utility> //move and swap pixel arrays
+#include <new> //fail allocations that are too big to address
+#include <limits> //largest addressable size
 
 //***Image RGB Structure***
 
@@ -81,33 +79,41 @@ Image::Rgb& Image::Rgb::operator= (const Image::Rgb &rgb)
 //Image Constructors
 //default //assigns default values
 Image::Image() :
+	pixels(nullptr),
 	w(0),
 	h(0),
 	b(0),
 	name(""),
 	readTime(0),
 	timeToRead(0),
-	zoom(1),
-	pixels(nullptr) 
+	zoom(1)
 {/*empty image*/}
 //3rd argument (c) has default value of kBlack
 //assigns width, height and colour according to parameter
 Image::Image(const unsigned int &_w, const unsigned int &_h, const Rgb &c) : 
+	pixels(nullptr),
 	w(_w),
 	h(_h),
 	b(0),
 	name(""),
 	readTime(0),
 	timeToRead(0),
-	zoom(1),
-	pixels(nullptr) 
+	zoom(1)
 {
 	//dynamic array created = size of image (w * h) 
-	pixels = new Rgb[w * h];
+	//a size that can't be addressed fails like any other allocation
+	size_t size;
+	if (!pixelCount(w, h, size))
+		throw std::bad_alloc();
+	pixels = new Rgb[size];
 
 	//pixel array filled with colour parameter
-	for (int i = 0; (unsigned int)i < w * h; ++i)
-		pixels[i] = c; 
+	//Rgb's default constructor has already made every pixel black, so large black images aren't written twice
+	if (c.r != 0 || c.g != 0 || c.b != 0)
+	{
+		for (size_t i = 0; i < size; ++i)
+			pixels[i] = c;
+	}
 }
 //copy constructor
 Image::Image(const Image &img)
@@ -122,11 +128,26 @@ Image::Image(const Image &img)
 	zoom = img.zoom;
 
 	//pixel array size copied
-	pixels = new Rgb[img.w * img.h];
+	pixels = new Rgb[img.getSize()];
 	//pixel array content copied
-	for (int i = 0; (unsigned int)i < img.w * img.h; ++i)
+	for (size_t i = 0; i < img.getSize(); ++i)
 		pixels[i] = img.pixels[i];
 }
+//move constructor
+//takes the pixel array instead of copying it, leaving img empty
+Image::Image(Image &&img) :
+	pixels(img.pixels),
+	w(img.w),
+	h(img.h),
+	b(img.b),
+	name(std::move(img.name)),
+	readTime(img.readTime),
+	timeToRead(img.timeToRead),
+	zoom(img.zoom)
+{
+	img.pixels = nullptr;
+	img.w = img.h = 0;
+}
 //Image class destructor
 Image::~Image() 
 {
@@ -143,9 +164,9 @@ Image::~Image()
 Image& Image::operator=(const Image& img)
 {
 	//pixel array size copied to new dynamic array
-	Rgb *newPixels = new Rgb[img.w * img.h];
+	Rgb *newPixels = new Rgb[img.getSize()];
 	//pixel array content copied
-	for (int i = 0; (unsigned int)i < img.w * img.h; ++i)
+	for (size_t i = 0; i < img.getSize(); ++i)
 		newPixels[i] = img.pixels[i];
 	//releases memory of old array
 	delete[] pixels;
@@ -161,14 +182,32 @@ Image& Image::operator=(const Image& img)
 
 	return *this;
 }
+//move assignment operator
+//swaps pixel arrays so img releases the old one
+Image& Image::operator=(Image &&img)
+{
+	if (this != &img)
+	{
+		//img keeps the old array with its matching dimensions
+		std::swap(pixels, img.pixels);
+		std::swap(w, img.w);
+		std::swap(h, img.h);
+		b = img.b;
+		name = std::move(img.name);
+		readTime = img.readTime;
+		timeToRead = img.timeToRead;
+		zoom = img.zoom;
+	}
+	return *this;
+}
 //Allow read only access to private pixel array index
 //returns pixel array value at the index chosen with subscript operator
-const Image::Rgb& Image::operator[] (const unsigned int &i) const
+const Image::Rgb& Image::operator[] (const size_t &i) const
 {
 	return pixels[i]; 
 }
 //Allow read and write access to private pixel array index
-Image::Rgb& Image::operator[] (const unsigned int &i)
+Image::Rgb& Image::operator[] (const size_t &i)
 {
 	return pixels[i];
 }
@@ -182,40 +221,10 @@ const Image::Rgb Image::kGreen = Image::Rgb(0, 1, 0); //#00FF00
 const Image::Rgb Image::kBlue = Image::Rgb(0, 0, 1); //#0000FF
 
 //Image Member Functions
-//Outputs log to file containing info on Image
+//Queues a record of the Image for the log file, which is written by a background thread
 void Image::log()
 {
-	//declares a time_t that holds the time now according to the system clock
-	time_t time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	//declare stringstream for generating filenames
-	std::stringstream filename;
-	//concatenate strings and current time 
-	//format: YYYY-MM-DD
-	filename << "Logs/image-" << std::put_time(std::localtime(&time), "%F") << ".txt";
-	//declare output file stream for log
-	std::ofstream log;
-	try
-	{
-		//opens filename converted to array of chars and uses append mode
-		log.open(filename.str().c_str(), std::ios::app);
-		//check to see if file was opened correctly and throw error if not
-		if (log.fail())
-			throw("Error during log generation for image blend operation.");
-		//get the read time of the file and store within time_t variable so that address can be used
-		time_t rTime = getReadTime();
-		//writes filename, date read, dimensions, bitdepth and readtime to log
-		//time format eg. Mon 4 Dec 2017 HH:MM:SS Timezone 
-		log << "Filename: " << getName() << "\nDate read: " << std::put_time(std::localtime(&rTime), "%a %d %b %Y %T %Z") << "\nDimensions: " << getWidth() << " x " << getHeight() << "\nBit depth: " << getBitDepth() << "\nRead time: " << getTimeToRead() << "ms\n" << std::endl;
-		//close filestream
-		log.close();
-	}
-	catch (const char &e)
-	{
-		//display error message
-		std::cout << e << std::endl;
-		//close filetream
-		log.close();
-	}
+	logImage(*this, kImageLog);
 }
 
 //Getter functions
@@ -234,9 +243,10 @@ unsigned int Image::getHeight() const
 	return h;
 }
 //returns height * width of image instead of performing to get calls
-unsigned int Image::getSize() const
+//widened before multiplying so that images of more than 4 billion pixels don't wrap
+size_t Image::getSize() const
 {
-	return w * h;
+	return (size_t)w * h;
 }
 unsigned int Image::getBitDepth() const
 {
@@ -313,3 +323,17 @@ void Image::setZoom(int z)
 {
 	zoom = z;
 }
+
+//***Image Functions***
+
+//Pixel count of a w x h image
+//returns false if the count, or the bytes needed to hold that many pixels, would overflow size_t
+bool pixelCount(unsigned long long w, unsigned long long h, size_t &pixels)
+{
+	const unsigned long long maxPixels = std::numeric_limits<size_t>::max() / sizeof(Image::Rgb);
+	if (w != 0 && h > maxPixels / w)
+		return false;
+
+	pixels = (size_t)(w * h);
+	return true;
+}
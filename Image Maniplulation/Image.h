@@ -1,5 +1,13 @@
 #pragma once
 #include <vector> //use vector container
+#include <string> //hold image filename
+#include <ctime> //hold image read time
+#include <cstddef> //64 bit pixel counts and indexes
+#include <iosfwd> //read frames from streams
+#include <atomic> //count static pixels from bands blended side by side
+
+class ProgressToken; //defined in Progress.h
+class Checkpoint; //defined in Checkpoint.h
 
 class Image
 {
@@ -30,12 +38,14 @@ public:
 	Image(); //default
 	Image(const unsigned int &, const unsigned int &, const Rgb & = kBlack); //kBlack is a default parameter
 	Image(const Image &); //copy
+	Image(Image &&); //move - takes the pixel array
 	virtual ~Image();
 
 	//Image operator overloads
 	Image& operator=(const Image &); //deep copy
-	const Rgb& operator[] (const unsigned int &) const;
-	Rgb& operator[] (const unsigned int &);
+	Image& operator=(Image &&); //takes the pixel array
+	const Rgb& operator[] (const size_t &) const;
+	Rgb& operator[] (const size_t &);
 
 	//Image member functions
 	virtual void log();
@@ -44,7 +54,7 @@ public:
 	Rgb* getPixels() const;
 	unsigned int getWidth() const;
 	unsigned int getHeight() const;
-	unsigned int getSize() const;
+	size_t getSize() const; //pixel count, which can be more than fits in an unsigned int
 	unsigned int getBitDepth() const;
 	std::string getName() const;
 	time_t getReadTime() const;
@@ -80,17 +90,69 @@ private:
 
 //Image Functions
 
+//pixel count of a w x h image, false if its pixel array wouldn't fit in memory addresses
+bool pixelCount(unsigned long long, unsigned long long, size_t &);
+
 Image readPPM(const char*);
-void writePPM(const Image &, const char*);
+bool writePPM(const Image &, const char*);
+
+//band access so that frames don't have to be held in memory whole
+bool readPPMSize(const char*, unsigned int &, unsigned int &, unsigned int &);
+Image readPPMRows(const char*, unsigned int, unsigned int);
+Image readPPMFrame(std::istream &); //next of several frames written one after another
+std::string ppmHeader(unsigned int, unsigned int);
+void toBytes(const Image &, std::vector<unsigned char> &);
+void toBytes(const Image::Rgb*, size_t, unsigned char*);
+
+//raw 8 bit samples for blending without floats
+bool readPPMBytes(const char*, unsigned int &, unsigned int &, std::vector<unsigned char> &);
+bool writePPMBytes(const char*, unsigned int, unsigned int, const std::vector<unsigned char> &);
+
+//float maps keep intermediate results without converting to 8 bits
+Image readPFM(const char*);
+bool writePFM(const Image &, const char*);
+
+//choose ppm or pfm from the file extension
+Image readImage(const char*);
+bool writeImage(const Image &, const char*);
 
 double median(std::vector<float> &);
 double sDeviation(std::vector<float> &);
 double mean(std::vector<float> &);
-void toFloats(Image* &, std::vector<float> &, std::vector<float> &, std::vector<float> &, int &);
+void toFloats(Image* &, std::vector<float> &, std::vector<float> &, std::vector<float> &, size_t &);
 
-void meanBlending(std::vector<Image*> &);
+//blends return the result in memory, the -ing versions write it to a file
+//an optional progress token is advanced after each row and stops the blend when cancelled, in which case an empty image is returned
+Image meanBlend(std::vector<Image*> &, ProgressToken* = nullptr);
+bool meanBlending(std::vector<Image*> &, const char* = "Mean Blending.ppm", ProgressToken* = nullptr);
+
+Image medianBlend(std::vector<Image*> &, ProgressToken* = nullptr);
+bool medianBlending(std::vector<Image*> &, const char* = "Median Blending.ppm", ProgressToken* = nullptr);
+
+//Static pixel test for sigma clipping
+//Most pixels of a stack are background whose samples only differ by a few counts, and clipping them changes little
+//A pre-pass finds the range of every channel of a row across the frames, and pixels whose ranges are all within spread
+//are given the mean of their samples straight away - only the rest are clipped. A spread of 0 only skips pixels whose
+//samples are identical, which clipping leaves unchanged, so the output is exactly the same as without the test
+struct StaticPixels
+{
+	StaticPixels(float = 0);
+
+	float spread; //largest range in 8 bit counts, eg. 2 = samples within 2/255 of each other
+	std::atomic<unsigned long long> staticCount; //pixels given the mean
+	std::atomic<unsigned long long> clippedCount; //pixels clipped in full
+};
 
-void medianBlending(std::vector<Image*> &);
+//with a checkpoint, rows restored from it are skipped and finished rows are saved to it as the blend goes, see Checkpoint.h
+//the static counts then only cover the rows blended by this run
+Image sigmaClip(std::vector<Image*> &, int, ProgressToken* = nullptr, StaticPixels* = nullptr, Checkpoint* = nullptr);
+Image sigmaClip(std::vector<Image*> &, float, ProgressToken* = nullptr, StaticPixels* = nullptr, Checkpoint* = nullptr);
+//checkpointed to <filename>.checkpoint, which is removed once the output is written
+bool sigmaClipping(std::vector<Image*> &, int, const char* = "Sigma Clipping Iterations.ppm", ProgressToken* = nullptr);
+bool sigmaClipping(std::vector<Image*> &, float, const char* = "Sigma Clipping Tolerence.ppm", ProgressToken* = nullptr);
 
-void sigmaClipping(std::vector<Image*> &, int);
-void sigmaClipping(std::vector<Image*> &, float);
\ No newline at end of file
+//luma guided versions select or reject whole frames per pixel by their luma instead of each channel on its own
+//so every pixel needs one selection instead of three and the median never mixes channels from different frames
+Image lumaMedianBlend(std::vector<Image*> &, ProgressToken* = nullptr);
+Image lumaSigmaClip(std::vector<Image*> &, int, ProgressToken* = nullptr);
+Image lumaSigmaClip(std::vector<Image*> &, float, ProgressToken* = nullptr);
\ No newline at end of file
@@ -0,0 +1,339 @@
+#pragma once
+#include "Image.h"
+#include <fstream> //write expressions to files
+#include <algorithm> //clamp and band sizes
+#include <cstdio> //report invalid expressions
+
+//Lazy image expressions
+//Operations on lazy(img) build an expression type at compile time instead of an Image, eg.
+//	writePPM(clamp(zoom(meanOf(images) * 1.2f, 2), 0.f, 1.f), "out.ppm");
+//Nothing is computed until the expression reaches a sink, evaluate() into an Image or writePPM() to a file
+//Sinks ask for each output pixel in turn, so every step is fused into one pass that reads the sources
+//and writes the output once with no intermediate Images; writePPM only holds a band of rows at a time
+//Expressions hold pointers to their source Images, which must outlive them, and are evaluated by one thread at a time
+
+//Base of every expression, E is the expression deriving from it
+//Every expression has width(), height(), valid() - false if its operands have different dimensions - and at(x, y)
+template <class E>
+struct ImageExpression
+{
+	const E& self() const
+	{
+		return static_cast<const E &>(*this);
+	}
+};
+
+//***Sources***
+
+//An existing Image
+class LazyImage : public ImageExpression<LazyImage>
+{
+public:
+	explicit LazyImage(const Image &img) : image(&img) {}
+
+	unsigned int width() const { return image->getWidth(); }
+	unsigned int height() const { return image->getHeight(); }
+	bool valid() const { return true; }
+	Image::Rgb at(unsigned int x, unsigned int y) const
+	{
+		return image->getPixels()[(size_t)y * image->getWidth() + x];
+	}
+
+private:
+	const Image *image;
+};
+
+//Mean of a stack of Images, summed in doubles exactly as meanBlend does
+class MeanExpression : public ImageExpression<MeanExpression>
+{
+public:
+	explicit MeanExpression(const std::vector<Image*> &imgs) : images(&imgs) {}
+
+	unsigned int width() const { return images->front()->getWidth(); }
+	unsigned int height() const { return images->front()->getHeight(); }
+	bool valid() const
+	{
+		if (images->empty())
+			return false;
+		for (size_t i = 0; i < images->size(); ++i)
+		{
+			if ((*images)[i]->getWidth() != width() || (*images)[i]->getHeight() != height())
+				return false;
+		}
+		return true;
+	}
+	Image::Rgb at(unsigned int x, unsigned int y) const
+	{
+		size_t index = (size_t)y * width() + x;
+		double r = 0, g = 0, b = 0;
+		for (size_t i = 0; i < images->size(); ++i)
+		{
+			const Image::Rgb &p = (*images)[i]->getPixels()[index];
+			r += (double)p.r;
+			g += (double)p.g;
+			b += (double)p.b;
+		}
+		double n = (double)images->size();
+		return Image::Rgb((float)(r / n), (float)(g / n), (float)(b / n));
+	}
+
+private:
+	const std::vector<Image*> *images;
+};
+
+inline LazyImage lazy(const Image &img)
+{
+	return LazyImage(img);
+}
+
+inline MeanExpression meanOf(const std::vector<Image*> &images)
+{
+	return MeanExpression(images);
+}
+
+//***Operations***
+
+//Function applied to every pixel of an expression
+template <class E, class F>
+class MapExpression : public ImageExpression<MapExpression<E, F>>
+{
+public:
+	MapExpression(const E &e, const F &f) : operand(e), function(f) {}
+
+	unsigned int width() const { return operand.width(); }
+	unsigned int height() const { return operand.height(); }
+	bool valid() const { return operand.valid(); }
+	Image::Rgb at(unsigned int x, unsigned int y) const
+	{
+		return function(operand.at(x, y));
+	}
+
+private:
+	E operand;
+	F function;
+};
+
+//Function combining the pixels of two expressions of the same size
+template <class L, class R, class F>
+class BinaryExpression : public ImageExpression<BinaryExpression<L, R, F>>
+{
+public:
+	BinaryExpression(const L &l, const R &r, const F &f) : left(l), right(r), function(f) {}
+
+	unsigned int width() const { return left.width(); }
+	unsigned int height() const { return left.height(); }
+	bool valid() const
+	{
+		return left.valid() && right.valid() && left.width() == right.width() && left.height() == right.height();
+	}
+	Image::Rgb at(unsigned int x, unsigned int y) const
+	{
+		return function(left.at(x, y), right.at(x, y));
+	}
+
+private:
+	L left;
+	R right;
+	F function;
+};
+
+//Nearest neighbour zoom by a whole factor, every pixel becomes a zoom x zoom block as in zoomNearestNeighbour
+//the source row last asked for is kept, so the operand is evaluated once per source pixel rather than zoom x zoom times
+//sinks go through the output in row order, which makes that once per source pixel in total
+template <class E>
+class ZoomExpression : public ImageExpression<ZoomExpression<E>>
+{
+public:
+	ZoomExpression(const E &e, unsigned int z) : operand(e), zoom(z), cachedRow(~0u) {}
+
+	unsigned int width() const { return operand.width() * zoom; }
+	unsigned int height() const { return operand.height() * zoom; }
+	bool valid() const
+	{
+		return operand.valid() && zoom > 0 && (unsigned long long)operand.width() * zoom <= 0xFFFFFFFFull && (unsigned long long)operand.height() * zoom <= 0xFFFFFFFFull;
+	}
+	Image::Rgb at(unsigned int x, unsigned int y) const
+	{
+		unsigned int sourceRow = y / zoom;
+		if (sourceRow != cachedRow)
+		{
+			row.resize(operand.width());
+			for (unsigned int sx = 0; sx < operand.width(); ++sx)
+				row[sx] = operand.at(sx, sourceRow);
+			cachedRow = sourceRow;
+		}
+		return row[x / zoom];
+	}
+
+private:
+	E operand;
+	unsigned int zoom;
+	mutable std::vector<Image::Rgb> row; //evaluated source row
+	mutable unsigned int cachedRow; //its index, ~0 before the first
+};
+
+//Per pixel functions used by the operators
+struct AddPixels
+{
+	Image::Rgb operator()(const Image::Rgb &a, const Image::Rgb &b) const { return Image::Rgb(a.r + b.r, a.g + b.g, a.b + b.b); }
+};
+struct SubtractPixels
+{
+	Image::Rgb operator()(const Image::Rgb &a, const Image::Rgb &b) const { return Image::Rgb(a.r - b.r, a.g - b.g, a.b - b.b); }
+};
+struct MultiplyPixels
+{
+	Image::Rgb operator()(const Image::Rgb &a, const Image::Rgb &b) const { return Image::Rgb(a.r * b.r, a.g * b.g, a.b * b.b); }
+};
+struct ScalePixel
+{
+	float factor;
+	Image::Rgb operator()(const Image::Rgb &p) const { return Image::Rgb(p.r * factor, p.g * factor, p.b * factor); }
+};
+struct DividePixel
+{
+	float divisor;
+	Image::Rgb operator()(const Image::Rgb &p) const { return Image::Rgb(p.r / divisor, p.g / divisor, p.b / divisor); }
+};
+struct ClampPixel
+{
+	float lower, upper;
+	Image::Rgb operator()(const Image::Rgb &p) const
+	{
+		return Image::Rgb(std::min(upper, std::max(lower, p.r)), std::min(upper, std::max(lower, p.g)), std::min(upper, std::max(lower, p.b)));
+	}
+};
+
+template <class L, class R>
+BinaryExpression<L, R, AddPixels> operator+(const ImageExpression<L> &l, const ImageExpression<R> &r)
+{
+	return BinaryExpression<L, R, AddPixels>(l.self(), r.self(), AddPixels());
+}
+
+template <class L, class R>
+BinaryExpression<L, R, SubtractPixels> operator-(const ImageExpression<L> &l, const ImageExpression<R> &r)
+{
+	return BinaryExpression<L, R, SubtractPixels>(l.self(), r.self(), SubtractPixels());
+}
+
+//channel by channel
+template <class L, class R>
+BinaryExpression<L, R, MultiplyPixels> operator*(const ImageExpression<L> &l, const ImageExpression<R> &r)
+{
+	return BinaryExpression<L, R, MultiplyPixels>(l.self(), r.self(), MultiplyPixels());
+}
+
+template <class E>
+MapExpression<E, ScalePixel> operator*(const ImageExpression<E> &e, float factor)
+{
+	ScalePixel scale = { factor };
+	return MapExpression<E, ScalePixel>(e.self(), scale);
+}
+
+template <class E>
+MapExpression<E, ScalePixel> operator*(float factor, const ImageExpression<E> &e)
+{
+	return e * factor;
+}
+
+template <class E>
+MapExpression<E, DividePixel> operator/(const ImageExpression<E> &e, float divisor)
+{
+	DividePixel divide = { divisor };
+	return MapExpression<E, DividePixel>(e.self(), divide);
+}
+
+template <class E>
+MapExpression<E, ClampPixel> clamp(const ImageExpression<E> &e, float lower, float upper)
+{
+	ClampPixel limits = { lower, upper };
+	return MapExpression<E, ClampPixel>(e.self(), limits);
+}
+
+template <class E>
+ZoomExpression<E> zoom(const ImageExpression<E> &e, unsigned int factor)
+{
+	return ZoomExpression<E>(e.self(), factor);
+}
+
+//any function or lambda taking and returning an Image::Rgb
+template <class E, class F>
+MapExpression<E, F> map(const ImageExpression<E> &e, F function)
+{
+	return MapExpression<E, F>(e.self(), function);
+}
+
+//***Sinks***
+
+//rows evaluated and written together by writePPM, about a megabyte of pixels
+static const size_t kExpressionBandBytes = 1 << 20;
+
+//Evaluate rows [first, first + rows) of an expression into band, which must be at least that big
+template <class E>
+void evaluateRows(const E &e, unsigned int first, unsigned int rows, Image &band)
+{
+	unsigned int w = e.width();
+	Image::Rgb *out = band.getPixels();
+	for (unsigned int y = first; y < first + rows; ++y)
+	{
+		for (unsigned int x = 0; x < w; ++x)
+			*out++ = e.at(x, y);
+	}
+}
+
+//Evaluate an expression into a new Image in one pass
+//returns an empty image if the operands have different dimensions
+template <class E>
+Image evaluate(const ImageExpression<E> &expression)
+{
+	const E &e = expression.self();
+	if (!e.valid())
+	{
+		fprintf(stderr, "Can't evaluate an expression of images with different dimensions\n");
+		return Image();
+	}
+
+	Image output(e.width(), e.height());
+	output.setBitDepth(255);
+	evaluateRows(e, 0, e.height(), output);
+	return output;
+}
+
+//Evaluate an expression straight into a binary ppm file, a band of rows at a time
+//returns true if the whole image was written
+template <class E>
+bool writePPM(const ImageExpression<E> &expression, const char *filename)
+{
+	const E &e = expression.self();
+	if (!e.valid() || e.width() == 0 || e.height() == 0)
+	{
+		fprintf(stderr, "Can't evaluate an expression of images with different dimensions\n");
+		return false;
+	}
+
+	std::ofstream ofs(filename, std::ios::binary);
+	if (ofs.fail())
+	{
+		fprintf(stderr, "Can't open output file\n");
+		return false;
+	}
+	ofs << ppmHeader(e.width(), e.height());
+
+	//the band and its bytes stay in cache between evaluating and writing
+	unsigned int bandRows = (unsigned int)std::max<size_t>(1, kExpressionBandBytes / ((size_t)e.width() * sizeof(Image::Rgb)));
+	bandRows = std::min(bandRows, e.height());
+	Image band(e.width(), bandRows);
+	std::vector<unsigned char> bytes;
+
+	for (unsigned int first = 0; first < e.height() && !ofs.fail(); first += bandRows)
+	{
+		unsigned int rows = std::min(bandRows, e.height() - first);
+		band.setHeight(rows);
+		evaluateRows(e, first, rows, band);
+		toBytes(band, bytes);
+		ofs.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+	}
+
+	ofs.close();
+	return !ofs.fail();
+}
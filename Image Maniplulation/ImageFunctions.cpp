@@ -1,80 +1,564 @@
 #include "Image.h"
+#include "TiledImage.h"
+#include "Progress.h"
+#include "PerfCounters.h"
+#include "ClipWindow.h"
+#include "Checkpoint.h"
 #include <iostream> //outputting to screen
 #include <fstream> //reading and writing images
 #include <algorithm> //sorting vectors and removing values from vector
 #include <sstream> //outputting strings to filestream
 #include <chrono> //getting current time
-
-//Read ppm files into the code
-//They need to be in 'binary' format (P6) with no comments in the header
-//The first line is the 'P'number - P6 indicates it is a binary file, then the image dimensions and finally the colour range
+#include <cstring> //comparing header strings
+#include <cmath> //square roots and powers
+#include <cfloat> //precision of floats and doubles
+#include <cctype> //compare file extensions and skip header whitespace
+#include <cstdio> //EOF while parsing headers
+#include <map> //row offsets of plain text files
+#include <mutex> //share row offsets between bands read at the same time
+#include <sys/stat.h> //size and modification time of plain text files
+#include <iomanip> //write the tolerence to checkpoints in full
+
+//***PNM Reading***
+
+//Read pnm files into the code
+//Binary colour (P6), binary grey (P5), plain text colour (P3) and plain text grey (P2) files are accepted
+//The first line is the 'P'number, then the image dimensions and finally the colour range (maxval)
+//Comments start with '#' and run to the end of the line, and can appear anywhere in the header
+//Samples are 1 byte when the maxval is below 256 and 2 big endian bytes otherwise
 //eg:	P6
+//# comment
 //3264 2448
 //255
-Image readPPM(const char *filename)
+
+//bytes of samples read or written at a time, large images are converted in chunks of rows this size
+static const size_t kReadChunkBytes = 4 << 20;
+
+//Header of a pnm file
+struct PNMHeader
+{
+	char type; //'2', '3', '5' or '6'
+	unsigned int w; //width
+	unsigned int h; //height
+	unsigned int maxval; //largest sample value
+	unsigned int channels; //1 for grey, 3 for colour
+	unsigned int sampleBytes; //bytes per binary sample
+	bool ascii; //plain text samples
+};
+
+//Read one number from the header, skipping whitespace and comments before it
+//the character after the number is consumed, as the single whitespace after the maxval has to be
+static bool headerNumber(std::streambuf *buf, unsigned int &value)
+{
+	int c = buf->sbumpc();
+	while (c != EOF && (c == '#' || isspace(c)))
+	{
+		//comments run until the end of the line
+		if (c == '#')
+		{
+			while (c != EOF && c != '\n' && c != '\r')
+				c = buf->sbumpc();
+		}
+		else
+			c = buf->sbumpc();
+	}
+
+	if (c < '0' || c > '9')
+		return false;
+
+	//accumulate digits, refusing anything that doesn't fit in 32 bits
+	unsigned long long v = 0;
+	while (c >= '0' && c <= '9')
+	{
+		v = v * 10 + (c - '0');
+		if (v > 0xFFFFFFFFull)
+			return false;
+		c = buf->sbumpc();
+	}
+
+	//comment straight after the number
+	if (c == '#')
+	{
+		while (c != EOF && c != '\n' && c != '\r')
+			c = buf->sbumpc();
+	}
+	else if (c != EOF && !isspace(c))
+		return false;
+
+	value = (unsigned int)v;
+	return true;
+}
+
+//Parse the header in a single pass over the stream and leave it at the first sample
+static bool readPNMHeader(std::istream &is, PNMHeader &header)
+{
+	std::streambuf *buf = is.rdbuf();
+	if (buf->sbumpc() != 'P')
+		return false;
+
+	header.type = (char)buf->sbumpc();
+	if (header.type != '2' && header.type != '3' && header.type != '5' && header.type != '6')
+		return false;
+	//the magic number has to be followed by whitespace, so eg. P61 isn't read as P6 with a width of 1
+	int next = buf->sgetc();
+	if (next == EOF || !isspace(next))
+		return false;
+
+	if (!headerNumber(buf, header.w) || !headerNumber(buf, header.h) || !headerNumber(buf, header.maxval))
+		return false;
+	if (header.w == 0 || header.h == 0 || header.maxval == 0 || header.maxval > 65535)
+		return false;
+
+	header.channels = (header.type == '3' || header.type == '6') ? 3 : 1;
+	header.sampleBytes = header.maxval > 255 ? 2 : 1;
+	header.ascii = header.type == '2' || header.type == '3';
+	return true;
+}
+
+//Convert binary samples to pixels
+//lut maps every sample value to the 0 - 1 interval, so there is no division per sample
+static void decodeBinary(const unsigned char *bytes, const PNMHeader &header, const std::vector<float> &lut, size_t pixels, Image::Rgb *out)
+{
+	unsigned int maxval = header.maxval;
+
+	if (header.sampleBytes == 1)
+	{
+		//values above the maxval are clamped to it
+		if (header.channels == 3)
+		{
+			for (size_t i = 0; i < pixels; ++i, bytes += 3)
+				out[i] = Image::Rgb(lut[std::min<unsigned int>(bytes[0], maxval)], lut[std::min<unsigned int>(bytes[1], maxval)], lut[std::min<unsigned int>(bytes[2], maxval)]);
+		}
+		else
+		{
+			for (size_t i = 0; i < pixels; ++i, ++bytes)
+				out[i] = Image::Rgb(lut[std::min<unsigned int>(bytes[0], maxval)]);
+		}
+	}
+	else
+	{
+		//16 bit samples are big endian
+		if (header.channels == 3)
+		{
+			for (size_t i = 0; i < pixels; ++i, bytes += 6)
+				out[i] = Image::Rgb(lut[std::min<unsigned int>(bytes[0] << 8 | bytes[1], maxval)], lut[std::min<unsigned int>(bytes[2] << 8 | bytes[3], maxval)], lut[std::min<unsigned int>(bytes[4] << 8 | bytes[5], maxval)]);
+		}
+		else
+		{
+			for (size_t i = 0; i < pixels; ++i, bytes += 2)
+				out[i] = Image::Rgb(lut[std::min<unsigned int>(bytes[0] << 8 | bytes[1], maxval)]);
+		}
+	}
+}
+
+//***Plain Text Samples***
+
+//SSE2 is always there on x64 and is switched on by most x86 compilers
+#if defined(_M_X64) || defined(__SSE2__)
+#define TEXT_SSE
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h> //find the first set bit of a mask
+#endif
+#endif
+
+//bytes of a plain text file read at a time
+static const size_t kTextBlockBytes = 1 << 20;
+//zero bytes kept after the text so 16 bytes can always be loaded - zero counts as whitespace and isn't a digit
+static const size_t kTextPadding = 16;
+//plain text files whose row offsets are remembered before the oldest are forgotten
+static const size_t kMaxTextIndexes = 32;
+
+#ifdef TEXT_SSE
+//index of the lowest set bit, mask must not be 0
+static unsigned int lowestBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned int)index;
+#else
+	return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+#endif
+
+//Forward only reader of the samples of a plain text file, a block of the file at a time
+//whitespace and digits are classified 16 bytes at a time with SSE2 where available, so the start and end of each sample are
+//found with a few compares and a bit scan rather than a branch per character
+class TextReader
+{
+public:
+	//TextReader constructors
+	//is must be positioned at offset
+	TextReader(std::istream &stream, unsigned long long offset) :
+		is(stream),
+		buffer(kTextBlockBytes + kTextPadding),
+		pos(0),
+		end(0),
+		base(offset)
+	{}
+	TextReader(const TextReader &) = delete;
+
+	//TextReader operator overloads
+	TextReader& operator=(const TextReader &) = delete;
+
+	//TextReader member functions
+
+	//Read the next count samples, skipping whitespace and comments
+	//every digit is read so an over-long sample stays one sample, held at 65536 so it can't overflow - anything over maxval is clamped by the caller
+	//returns false if the file ends first or has anything that isn't a number
+	bool read(unsigned int *out, size_t count)
+	{
+		size_t n = 0;
+		while (n < count)
+		{
+#ifdef TEXT_SSE
+			//most samples are a few digits between spaces, so each load of 16 bytes finds several of them
+			//it stops at anything else - comments, long samples, samples cut by the window - which the general path reads
+			while (n < count && pos + 16 <= end)
+			{
+				__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer.data() + pos));
+				__m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+				//c <= ' ' and c - '0' <= 9 as unsigned bytes
+				unsigned int text = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(c, _mm_set1_epi8(' ')), c)) & 0xFFFF;
+				unsigned int other = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit)) & 0xFFFF;
+
+				unsigned int start = 16;
+				while (n < count && text != 0)
+				{
+					start = lowestBit(text);
+					unsigned int after = other & (0xFFFF << start);
+					if (after == 0)
+						break;
+					unsigned int stop = lowestBit(after);
+					if (stop == start || stop - start > 4)
+						break;
+					//x86 is little endian, so shifting left drops the bytes after the sample and leaves its last digit in the top byte
+					unsigned int d;
+					memcpy(&d, buffer.data() + pos + start, 4);
+					d = (d - 0x30303030u) << (8 * (4 - (stop - start)));
+					out[n++] = (d & 0xFF) * 1000 + ((d >> 8) & 0xFF) * 100 + ((d >> 16) & 0xFF) * 10 + (d >> 24);
+					text &= 0xFFFF << stop;
+					start = stop;
+				}
+				if (text == 0)
+					start = 16;
+				pos += start;
+				//the window starts at a sample it couldn't read
+				if (start == 0)
+					break;
+			}
+			if (n == count)
+				break;
+#endif
+			if (!nextSample(out[n]))
+				return false;
+			++n;
+		}
+		return true;
+	}
+
+	//Getter functions
+
+	//offset in the file of the next byte to be parsed
+	unsigned long long position() const
+	{
+		return base + pos;
+	}
+
+private:
+	//Read one sample, a block at a time across runs of whitespace, comments, long samples and the ends of blocks
+	bool nextSample(unsigned int &value)
+	{
+		for (;;)
+		{
+			pos += spaces();
+			if (pos == end)
+			{
+				if (!refill())
+					return false;
+			}
+			else if (buffer[pos] == '#')
+			{
+				//comments run to the end of the line, which may be in a later block
+				const void *newline = memchr(buffer.data() + pos, '\n', end - pos);
+				pos = newline != nullptr ? (size_t)(static_cast<const char *>(newline) - buffer.data()) : end;
+			}
+			else
+				break;
+		}
+
+		if ((unsigned char)(buffer[pos] - '0') > 9)
+			return false;
+
+		unsigned int v = 0;
+		for (;;)
+		{
+			size_t count = digits();
+			for (const char *p = buffer.data() + pos, *last = p + count; p < last; ++p)
+				v = std::min(v * 10 + (*p - '0'), 65536u);
+			pos += count;
+			//a sample cut by the end of the block carries on in the next one
+			if (pos < end || !refill())
+				break;
+		}
+
+		value = v;
+		return true;
+	}
+
+	//Move the unparsed bytes to the front of the buffer and read the next block after them
+	//returns false if there was nothing more to read
+	bool refill()
+	{
+		size_t kept = end - pos;
+		memmove(buffer.data(), buffer.data() + pos, kept);
+		base += pos;
+		pos = 0;
+		is.read(buffer.data() + kept, (std::streamsize)(kTextBlockBytes - kept));
+		size_t read = (size_t)is.gcount();
+		end = kept + read;
+		memset(buffer.data() + end, 0, kTextPadding);
+		return read > 0;
+	}
+
+	//Bytes of whitespace at pos, stopping at end
+	size_t spaces() const
+	{
+		size_t i = pos;
+#ifdef TEXT_SSE
+		const __m128i space = _mm_set1_epi8(' ');
+		while (i < end)
+		{
+			//c <= ' ' as unsigned bytes
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer.data() + i));
+			unsigned int other = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(c, space), c)) & 0xFFFF;
+			if (other != 0)
+				return std::min(i + lowestBit(other), end) - pos;
+			i += 16;
+		}
+		return end - pos;
+#else
+		while (i < end && (unsigned char)buffer[i] <= ' ')
+			++i;
+		return i - pos;
+#endif
+	}
+
+	//Bytes of digits at pos, stopping at end
+	size_t digits() const
+	{
+		size_t i = pos;
+#ifdef TEXT_SSE
+		const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9);
+		while (i < end)
+		{
+			//c - '0' <= 9 as unsigned bytes
+			__m128i c = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer.data() + i)), zero);
+			unsigned int other = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(c, nine), c)) & 0xFFFF;
+			if (other != 0)
+				return std::min(i + lowestBit(other), end) - pos;
+			i += 16;
+		}
+		return end - pos;
+#else
+		while (i < end && (unsigned char)(buffer[i] - '0') <= 9)
+			++i;
+		return i - pos;
+#endif
+	}
+
+	std::istream &is; //file being read
+	std::vector<char> buffer; //current block followed by kTextPadding zero bytes
+	size_t pos; //next byte to parse
+	size_t end; //bytes of the file in buffer
+	unsigned long long base; //offset in the file of buffer[0]
+};
+
+//Offsets of the rows of a plain text file, so a band carries on from the rows an earlier band reached
+//rather than parsing the file from its first sample
+struct TextRowIndex
+{
+	unsigned long long size; //file size and modification time, the offsets are dropped if either changes
+	time_t modified;
+	std::vector<unsigned long long> rows; //offset of each row and of the end of the image, 0 = not reached yet
+};
+
+static std::map<std::string, TextRowIndex> textRowIndexes; //by filename
+static std::mutex textRowMutex; //guards textRowIndexes
+
+//size and modification time of a file, false if it can't be found
+static bool fileVersion(const char *filename, unsigned long long &size, time_t &modified)
+{
+	struct stat info;
+	if (stat(filename, &info) != 0)
+		return false;
+	size = (unsigned long long)info.st_size;
+	modified = info.st_mtime;
+	return true;
+}
+
+//Find the nearest row at or before firstRow whose offset is known
+//row and offset are left alone, at the first sample, if none is
+static void nearestTextRow(const char *filename, unsigned int firstRow, unsigned int &row, unsigned long long &offset)
+{
+	unsigned long long size;
+	time_t modified;
+	if (!fileVersion(filename, size, modified))
+		return;
+
+	std::lock_guard<std::mutex> lock(textRowMutex);
+	std::map<std::string, TextRowIndex>::const_iterator it = textRowIndexes.find(filename);
+	if (it == textRowIndexes.end() || it->second.size != size || it->second.modified != modified || firstRow >= it->second.rows.size())
+		return;
+	for (unsigned int y = firstRow; y > row; --y)
+	{
+		if (it->second.rows[y] != 0)
+		{
+			row = y;
+			offset = it->second.rows[y];
+			return;
+		}
+	}
+}
+
+//Remember the offsets of rows [first, first + offsets.size()) of a plain text file of height h
+static void recordTextRows(const char *filename, unsigned int h, unsigned int first, const std::vector<unsigned long long> &offsets)
+{
+	unsigned long long size;
+	time_t modified;
+	if (!fileVersion(filename, size, modified))
+		return;
+
+	std::lock_guard<std::mutex> lock(textRowMutex);
+	std::map<std::string, TextRowIndex>::iterator it = textRowIndexes.find(filename);
+	if (it == textRowIndexes.end() || it->second.size != size || it->second.modified != modified || it->second.rows.size() != (size_t)h + 1)
+	{
+		//start again rather than track which file was used last, the offsets are cheap to find again
+		if (it == textRowIndexes.end() && textRowIndexes.size() >= kMaxTextIndexes)
+			textRowIndexes.clear();
+		TextRowIndex &index = textRowIndexes[filename];
+		index.size = size;
+		index.modified = modified;
+		index.rows.assign((size_t)h + 1, 0);
+		it = textRowIndexes.find(filename);
+	}
+	for (size_t i = 0; i < offsets.size() && first + i < it->second.rows.size(); ++i)
+		it->second.rows[first + i] = offsets[i];
+}
+
+//Convert rows [firstRow, firstRow + rowCount) of plain text samples to pixels
+//the reader is at the start of row, which is parsed past up to firstRow
+//the offset of every row reached is remembered for the next band of the same file
+static bool decodeText(TextReader &reader, const char *filename, const PNMHeader &header, const std::vector<float> &lut, unsigned int row, unsigned int firstRow, unsigned int rowCount, Image::Rgb *out)
 {
-	//declare input file stream
-	std::ifstream ifs;
+	std::vector<unsigned long long> offsets;
+	//samples are read a row at a time so the reader can take several from each load
+	std::vector<unsigned int> samples((size_t)header.w * header.channels);
+
+	for (unsigned int y = row; y < firstRow + rowCount; ++y)
+	{
+		offsets.push_back(reader.position());
+		if (!reader.read(samples.data(), samples.size()))
+			return false;
+		if (y < firstRow)
+			continue;
+
+		for (unsigned int &v : samples)
+			v = std::min(v, header.maxval);
+		const unsigned int *v = samples.data();
+		for (unsigned int x = 0; x < header.w; ++x, v += header.channels)
+		{
+			if (header.channels == 3)
+				*out++ = Image::Rgb(lut[v[0]], lut[v[1]], lut[v[2]]);
+			else
+				*out++ = Image::Rgb(lut[v[0]]);
+		}
+	}
+	//where the next band starts
+	offsets.push_back(reader.position());
+
+	recordTextRows(filename, header.h, row, offsets);
+	return true;
+}
 
-	//open file location specified by parameter using binary mode
-	ifs.open(filename, std::ios::binary);
+//Read rows [firstRow, firstRow + rowCount) of a pnm file
+//rowCount of 0 reads every row from firstRow to the end of the image
+//returns an empty image if the file can't be read
+static Image readPNM(const char *filename, unsigned int firstRow, unsigned int rowCount)
+{
+	//declare input file stream and open file location specified by parameter using binary mode
+	std::ifstream ifs(filename, std::ios::binary);
 
 	//declare new Image in automatic storage
 	Image src;
 	try {
 		//check to see if file can be opened 
 		if (ifs.fail())
-		{
 			throw("Can't open the input file - is it named correctly/is it in the right directory?");
-		}
 
-		//Variable decleration
-		std::string header;
-		int w; //width
-		int h; //height
-		int b; //bit depth
-
-		//read image type (P6 for binary ppm files) and store in header
-		ifs >> header;
-		//compare image type to "p6" to check if binary file
-		if (strcmp(header.c_str(), "P6") != 0)
-			//if NOT binary file:
-			throw("Can't read the input file - is it in binary format (Has P6 in the header)?");
-
-		//read width, height and bit depth from header and assign to appropriate variable
-		ifs >> w >> h >> b;
-		src.setWidth(w);
-		src.setHeight(h);
-		src.setBitDepth(b);
+		PNMHeader header;
+		if (!readPNMHeader(ifs, header))
+			throw("Can't read the input file - is it a pnm file (Has P2, P3, P5 or P6 in the header)?");
+
+		if (rowCount == 0 && firstRow < header.h)
+			rowCount = header.h - firstRow;
+		if (rowCount == 0 || firstRow >= header.h || rowCount > header.h - firstRow)
+			throw("Can't read rows outside of the input image");
+
+		//the band has to be addressable, which a huge header on a 32 bit build may not be
+		size_t pixels;
+		if (!pixelCount(header.w, rowCount, pixels))
+			throw("Input image is too large to read into memory - process it in bands instead");
+		PERF_STAGE("read pnm", pixels * sizeof(Image::Rgb));
+
+		//lookup table of every sample value divided by the maxval to give an interval between 0 and 1
+		std::vector<float> lut(header.maxval + 1);
+		for (unsigned int v = 0; v <= header.maxval; ++v)
+			lut[v] = v / (float)header.maxval;
+
+		//create dynamic array of Rgb structure with the total size of the band
+		src.setPixels(new Image::Rgb[pixels]);
+		src.setWidth(header.w);
+		src.setHeight(rowCount);
+		//pixels are held between 0 and 1 and always written back out as 8 bit samples
+		src.setBitDepth(255);
 		//assign filename to image object
 		src.setName(filename);
 		//gets current time and converts to type time_t for storage in current read time variable
 		src.setReadTime(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
 
-		//throw exception if bad_alloc
-		//create dynamic array of Rgb structure with the total size of the image
-		src.setPixels(new Image::Rgb[w * h]);
-
-		//skip empty lines
-		ifs.ignore(256, '\n');
-		//declare uchar array to hold colour values
-		unsigned char pix[3];
-
-		//loop through each pixel in image
-		//reads 3 sets of characters which hold colour values and adds them to same index of the array containg the Rgb structure
-		for (int i = 0; i < w * h; ++i)
+		if (header.ascii)
 		{
-			//reinterpret_cast used to convert between pointers of unsigned char and char
-			//********* Can use "ifs.read((char*)pix, 3);" to be more strongly typed ***********//
-			ifs.read(reinterpret_cast<char *>(pix), 3);
-			//values divided by 255 to interval between 0 and 1
-			src[i].r = pix[0] / 255.f;
-			src[i].g = pix[1] / 255.f;
-			src[i].b = pix[2] / 255.f;
+			//parse a block at a time from the nearest row an earlier band reached, so the file is never held as text
+			//and a band loop parses the file once rather than once per band
+			unsigned int row = 0;
+			unsigned long long offset = (unsigned long long)ifs.tellg();
+			nearestTextRow(filename, firstRow, row, offset);
+			ifs.seekg((std::streamoff)offset);
+			TextReader reader(ifs, offset);
+			if (!decodeText(reader, filename, header, lut, row, firstRow, rowCount, src.getPixels()))
+				throw("Input file ended before the end of the image");
 		}
+		else
+		{
+			//skip to the first row and read the band a few megabytes of rows at a time
+			//so a large image never needs a second full size copy of itself as bytes
+			size_t rowBytes = (size_t)header.w * header.channels * header.sampleBytes;
+			ifs.seekg((std::streamoff)firstRow * (std::streamoff)rowBytes, std::ios::cur);
+			size_t chunkRows = std::max<size_t>(1, kReadChunkBytes / rowBytes);
+			std::vector<unsigned char> bytes(rowBytes * std::min<size_t>(chunkRows, rowCount));
+			for (size_t row = 0; row < rowCount; row += chunkRows)
+			{
+				size_t rows = std::min<size_t>(chunkRows, rowCount - row);
+				ifs.read(reinterpret_cast<char *>(bytes.data()), (std::streamsize)(rowBytes * rows));
+				if (ifs.fail())
+					throw("Input file ended before the end of the image");
 
-		//closes file
-		ifs.close();
+				decodeBinary(bytes.data(), header, lut, (size_t)header.w * rows, src.getPixels() + row * header.w);
+			}
+		}
 	}
 	//catch error by reference
 	catch (const char *err)
@@ -82,26 +566,168 @@ Image readPPM(const char *filename)
 		//print formtted message
 		//stderr = output stream for error messages, "%s\n" = output string of characters & new line, err = data.
 		fprintf(stderr, "%s\n", err);
-		//closes file
-		ifs.close();
+		//return an empty image rather than a partially read one
+		src = Image();
 	}
 
 	//returns object
 	return src;
 }
 
+//Read a whole pnm file
+Image readPPM(const char *filename)
+{
+	return readPNM(filename, 0, 0);
+}
+
+//Read the width, height and bit depth of a pnm file without reading any pixels
+//returns false if the file can't be opened or is not a pnm file
+bool readPPMSize(const char *filename, unsigned int &w, unsigned int &h, unsigned int &b)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	PNMHeader header;
+	if (!readPNMHeader(ifs, header))
+		return false;
+
+	w = header.w;
+	h = header.h;
+	b = header.maxval;
+	return true;
+}
+
+//Read the raw samples of an 8 bit binary ppm file without converting them to floats
+//returns false if the file can't be read or doesn't hold 8 bit colour samples
+bool readPPMBytes(const char *filename, unsigned int &w, unsigned int &h, std::vector<unsigned char> &bytes)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	PNMHeader header;
+	if (ifs.fail() || !readPNMHeader(ifs, header) || header.type != '6' || header.maxval != 255)
+		return false;
+
+	size_t pixels;
+	if (!pixelCount(header.w, header.h, pixels))
+		return false;
+
+	w = header.w;
+	h = header.h;
+	bytes.resize(pixels * 3);
+	ifs.read(reinterpret_cast<char *>(bytes.data()), bytes.size());
+	return !ifs.fail();
+}
+
+//Write raw 8 bit samples to a binary ppm file in one go
+bool writePPMBytes(const char *filename, unsigned int w, unsigned int h, const std::vector<unsigned char> &bytes)
+{
+	std::ofstream ofs(filename, std::ios::binary);
+	ofs << ppmHeader(w, h);
+	ofs.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+	ofs.close();
+	return !ofs.fail();
+}
+
+//Read a band of rows from a pnm file
+//only rows firstRow to firstRow + rowCount - 1 are read so that large frames can be processed a band at a time
+//binary files seek straight to the band, plain text files are parsed from the end of the last band read, or from the top the first time
+//returns an empty image if the file can't be read or the band is outside of the image
+Image readPPMRows(const char *filename, unsigned int firstRow, unsigned int rowCount)
+{
+	//0 would mean the rest of the image
+	if (rowCount == 0)
+	{
+		fprintf(stderr, "Can't read rows outside of the input image\n");
+		return Image();
+	}
+	return readPNM(filename, firstRow, rowCount);
+}
+
+//Read the next binary (P5 or P6) frame from a stream of frames written one after another, eg. a camera pipe
+//returns an empty image at the end of the stream, or with a message if the frame can't be read
+Image readPPMFrame(std::istream &is)
+{
+	//whitespace between frames is allowed, the end of the stream there is not an error
+	std::streambuf *buf = is.rdbuf();
+	while (buf->sgetc() != EOF && isspace(buf->sgetc()))
+		buf->sbumpc();
+	if (buf->sgetc() == EOF)
+		return Image();
+
+	Image frame;
+	try
+	{
+		PNMHeader header;
+		if (!readPNMHeader(is, header) || header.ascii)
+			throw("Can't read the next frame - is the stream made of binary pnm frames (P5 or P6)?");
+
+		size_t pixels;
+		if (!pixelCount(header.w, header.h, pixels))
+			throw("Frame is too large to read into memory");
+
+		std::vector<float> lut(header.maxval + 1);
+		for (unsigned int v = 0; v <= header.maxval; ++v)
+			lut[v] = v / (float)header.maxval;
+
+		std::vector<unsigned char> bytes(pixels * header.channels * header.sampleBytes);
+		is.read(reinterpret_cast<char *>(bytes.data()), (std::streamsize)bytes.size());
+		if (is.fail())
+			throw("Stream ended part way through a frame");
+
+		frame = Image(header.w, header.h);
+		frame.setBitDepth(255);
+		frame.setReadTime(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+		decodeBinary(bytes.data(), header, lut, pixels, frame.getPixels());
+	}
+	catch (const char *err)
+	{
+		fprintf(stderr, "%s\n", err);
+		frame = Image();
+	}
+	return frame;
+}
+
+//Build the header of a binary ppm file
+//pixels are always written as 8 bit samples so the maxval is always 255
+//eg: "P6\n3264 2448\n255\n"
+std::string ppmHeader(unsigned int w, unsigned int h)
+{
+	std::stringstream header;
+	header << "P6\n" << w << " " << h << "\n255\n";
+	return header.str();
+}
+
+//Convert count pixels to 3 bytes each in the order they are written to a ppm file
+void toBytes(const Image::Rgb *pixels, size_t count, unsigned char *bytes)
+{
+	//loop through each pixel, clamp and convert to byte format (0 - 1 value to 0 - 255 colour value)
+	for (size_t i = 0; i < count; ++i)
+	{
+		//static_cast used for conversion from float to unsigned char
+		//min returns the smallest of 2 parameters
+		bytes[i * 3] = static_cast<unsigned char>(std::min(1.f, pixels[i].r) * 255);
+		bytes[i * 3 + 1] = static_cast<unsigned char>(std::min(1.f, pixels[i].g) * 255);
+		bytes[i * 3 + 2] = static_cast<unsigned char>(std::min(1.f, pixels[i].b) * 255);
+	}
+}
+
+//Convert every pixel of an image to 3 bytes in the order they are written to a ppm file
+void toBytes(const Image &img, std::vector<unsigned char> &bytes)
+{
+	bytes.resize(img.getSize() * 3);
+	toBytes(img.getPixels(), img.getSize(), bytes.data());
+}
 
 //Write data out to a ppm file
 //Constructs the header as above
-void writePPM(const Image &img, const char *filename)
+//returns true if the whole image was written so callers can report failures
+bool writePPM(const Image &img, const char *filename)
 {
 	//check to see if writing to image with no size
 	if (img.getWidth() == 0 || img.getHeight() == 0)
 	{
 		//print formatted message
 		fprintf(stderr, "Can't save an empty image\n");
-		return;
+		return false;
 	}
+	PERF_STAGE("write ppm", img.getSize() * sizeof(Image::Rgb));
 
 	//declare output file stream
 	std::ofstream ofs;
@@ -115,29 +741,25 @@ void writePPM(const Image &img, const char *filename)
 			throw("Can't open output file");
 
 		//output header info in correct format
-		ofs << "P6\n" << img.getWidth() << " " << img.getHeight() << "\n" << img.getBitDepth() << "\n";
-		//std::cout << "P6\n" << img.w << " " << img.h << "\n255\n";
+		ofs << ppmHeader(img.getWidth(), img.getHeight());
 
-		//Variable decleration
-		unsigned char r; //red
-		unsigned char g; //green
-		unsigned char b; //blue
-
-		//loop through each pixel in the image, clamp and convert to byte format (0 - 1 value to 0 - 255 colour value)
-		//write colour value for each pixel 
-		for (int i = 0; (unsigned int)i < img.getSize(); ++i)
+		//convert colour values to bytes and write them a chunk of rows at a time
+		size_t chunkPixels = std::max<size_t>(1, kReadChunkBytes / (3 * (size_t)img.getWidth())) * img.getWidth();
+		std::vector<unsigned char> bytes(std::min(chunkPixels, img.getSize()) * 3);
+		for (size_t first = 0; first < img.getSize() && !ofs.fail(); first += chunkPixels)
 		{
-			//static_cast used for conversion from float to unsigned char
-			//min returns the smallest of 2 parameters
-			r = static_cast<unsigned char>(std::min(1.f, img[i].r) * 255);
-			g = static_cast<unsigned char>(std::min(1.f, img[i].g) * 255);
-			b = static_cast<unsigned char>(std::min(1.f, img[i].b) * 255);
-			ofs << r << g << b;
+			size_t count = std::min(chunkPixels, img.getSize() - first);
+			toBytes(img.getPixels() + first, count, bytes.data());
+			ofs.write(reinterpret_cast<const char *>(bytes.data()), (std::streamsize)(count * 3));
 		}
 
 		//closes file
 		ofs.close();
 
+		//check that every pixel made it to disk
+		if (ofs.fail())
+			throw("Error while writing output file");
+
 		//Confirm image write
 		std::cout << "Image written!\n" << std::endl;
 	}
@@ -148,7 +770,164 @@ void writePPM(const Image &img, const char *filename)
 		fprintf(stderr, "%s\n", err);
 		//closes file
 		ofs.close();
+		return false;
 	}
+
+	return true;
+}
+
+//Portable float map (.pfm) files hold the pixels as 32 bit floats with the same layout as Image::Rgb
+//so they can be read straight into the pixel array and written straight out of it without any conversion
+//The header is "PF" for colour, the dimensions, then the scale - a negative scale means little endian samples
+//eg:	PF
+//3264 2448
+//-1.0
+//Rows are stored from the bottom of the image to the top
+static_assert(sizeof(Image::Rgb) == 3 * sizeof(float), "Image::Rgb must be 3 packed floats to match the pfm layout");
+
+//true if this machine stores the least significant byte first
+static bool isLittleEndian()
+{
+	const unsigned int one = 1;
+	return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
+
+//reverse the byte order of every float in the array
+static void swapBytes(float *values, size_t count)
+{
+	unsigned char *bytes = reinterpret_cast<unsigned char *>(values);
+	for (size_t i = 0; i < count * sizeof(float); i += sizeof(float))
+	{
+		std::swap(bytes[i], bytes[i + 3]);
+		std::swap(bytes[i + 1], bytes[i + 2]);
+	}
+}
+
+//Read a colour pfm file into an Image
+//the payload is read directly into the pixel array in one go and then put into top to bottom row order
+Image readPFM(const char *filename)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	Image src;
+
+	try
+	{
+		if (ifs.fail())
+			throw("Can't open the input file - is it named correctly/is it in the right directory?");
+
+		std::string header;
+		unsigned int w, h;
+		float scale;
+		ifs >> header >> w >> h >> scale;
+		if (ifs.fail() || header != "PF")
+			throw("Can't read the input file - is it a colour float map (Has PF in the header)?");
+		//a single whitespace character separates the header from the pixels
+		ifs.get();
+
+		size_t pixels;
+		if (w == 0 || h == 0)
+			throw("Can't read the input file - it has no pixels");
+		if (!pixelCount(w, h, pixels))
+			throw("Input image is too large to read into memory - process it in bands instead");
+
+		PERF_STAGE("read pfm", pixels * sizeof(Image::Rgb));
+		src.setPixels(new Image::Rgb[pixels]);
+		src.setWidth(w);
+		src.setHeight(h);
+		//float maps have no bit depth, 255 lets them be written out as 8 bit ppm files
+		src.setBitDepth(255);
+		src.setName(filename);
+		src.setReadTime(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+
+		//read the whole payload into the pixel array
+		ifs.read(reinterpret_cast<char *>(src.getPixels()), (std::streamsize)(pixels * sizeof(Image::Rgb)));
+		if (ifs.fail())
+			throw("Input file ended before the end of the image");
+
+		//negative scale = little endian
+		if ((scale < 0) != isLittleEndian())
+			swapBytes(&src.getPixels()->r, pixels * 3);
+
+		//flip from bottom to top row order in place
+		for (unsigned int y = 0; y < h / 2; ++y)
+			std::swap_ranges(src.getPixels() + (size_t)y * w, src.getPixels() + (size_t)(y + 1) * w, src.getPixels() + (size_t)(h - 1 - y) * w);
+	}
+	catch (const char *err)
+	{
+		fprintf(stderr, "%s\n", err);
+		//return an empty image rather than a partially read one
+		src = Image();
+	}
+
+	return src;
+}
+
+//Write an Image to a colour pfm file in the byte order of this machine
+//each row is written straight from the pixel array, starting at the bottom
+//returns true if the whole image was written
+bool writePFM(const Image &img, const char *filename)
+{
+	if (img.getWidth() == 0 || img.getHeight() == 0)
+	{
+		fprintf(stderr, "Can't save an empty image\n");
+		return false;
+	}
+	PERF_STAGE("write pfm", img.getSize() * sizeof(Image::Rgb));
+
+	std::ofstream ofs(filename, std::ios::binary);
+	if (ofs.fail())
+	{
+		fprintf(stderr, "Can't open output file\n");
+		return false;
+	}
+
+	//scale of -1 marks little endian samples
+	ofs << "PF\n" << img.getWidth() << " " << img.getHeight() << "\n" << (isLittleEndian() ? "-1.0" : "1.0") << "\n";
+
+	const std::streamsize rowBytes = (std::streamsize)img.getWidth() * sizeof(Image::Rgb);
+	for (unsigned int y = img.getHeight(); y > 0; --y)
+		ofs.write(reinterpret_cast<const char *>(img.getPixels() + (size_t)(y - 1) * img.getWidth()), rowBytes);
+
+	ofs.close();
+	return !ofs.fail();
+}
+
+//true if filename ends with the given extension, ignoring case
+static bool hasExtension(const char *filename, const char *extension)
+{
+	size_t length = strlen(filename), extLength = strlen(extension);
+	if (length < extLength)
+		return false;
+
+	for (size_t i = 0; i < extLength; ++i)
+	{
+		if (tolower(filename[length - extLength + i]) != tolower(extension[i]))
+			return false;
+	}
+	return true;
+}
+
+//Read an image in the format given by its extension
+//.pfm files are read as float maps, .tim files as tiled images, anything else as a binary ppm
+Image readImage(const char *filename)
+{
+	if (hasExtension(filename, ".pfm"))
+		return readPFM(filename);
+	if (hasExtension(filename, ".tim"))
+		return readTiled(filename);
+	return readPPM(filename);
+}
+
+//Write an image in the format given by its extension
+//writing intermediate results as .pfm keeps every float without rounding to 8 bits
+bool writeImage(const Image &img, const char *filename)
+{
+	if (hasExtension(filename, ".pfm"))
+		return writePFM(img, filename);
+	//tiled images written this way keep float samples
+	if (hasExtension(filename, ".tim"))
+		return writeTiled(img, filename);
+	return writePPM(img, filename);
 }
 
 //doubles used to help minimise rounding errors
@@ -222,7 +1001,7 @@ double mean(std::vector<float> &colour)
 	return sum / (double)noFloats;
 }
 //converts a given pixel from an image into a the corresponding colour values
-void toFloats(Image* &img, std::vector<float> &red, std::vector<float> &green, std::vector<float> &blue, int &pixel)
+void toFloats(Image* &img, std::vector<float> &red, std::vector<float> &green, std::vector<float> &blue, size_t &pixel)
 {
 	//adds red value at pixel array to red vector
 	red.push_back((*img)[pixel].r);
@@ -231,13 +1010,22 @@ void toFloats(Image* &img, std::vector<float> &red, std::vector<float> &green, s
 	//adds blue value at pixel array to blue vector
 	blue.push_back((*img)[pixel].b);
 }
+//write the result of a blend unless it was cancelled
+static bool writeBlend(const Image &output, const char *filename, ProgressToken *progress)
+{
+	//nothing to write - the caller reports the cancellation
+	if (progress != nullptr && progress->isCancelled())
+		return false;
+	return writePPM(output, filename);
+}
 //mean blending algorithm
-void meanBlending(std::vector<Image*> &images)
+//returns the blended image in memory so that the caller decides where it is written
+Image meanBlend(std::vector<Image*> &images, ProgressToken *progress)
 {
-	//notify user that blending has begun
-	std::cout << "Mean blending started..." << std::endl;
 	//get total size of first image and assign to variable
-	int pixelCount = images.at(0)->getSize();
+	size_t pixelCount = images.at(0)->getSize();
+	//every frame is read and the output written
+	PERF_STAGE("mean blend", (images.size() + 1) * pixelCount * sizeof(Image::Rgb));
 	//assign images vector size to variable
 	int imageNo = (int)images.size();
 
@@ -245,12 +1033,16 @@ void meanBlending(std::vector<Image*> &images)
 	Image output(images.at(0)->getWidth(), images.at(0)->getHeight());
 	//Set bit depth of output image to that of the first image
 	output.setBitDepth(images.at(0)->getBitDepth());
+	//one step of progress per row
+	size_t width = images.at(0)->getWidth();
+	if (progress != nullptr)
+		progress->addWork(images.at(0)->getHeight());
 
 	//create vectors to be used to store colour channels of each pixel
 	std::vector<float> red, green, blue;
 
 	//loop through each pixel
-	for (int i = 0; i < pixelCount; ++i)
+	for (size_t i = 0; i < pixelCount; ++i)
 	{
 		//empty vectors and set size to 0
 		red.clear();
@@ -270,17 +1062,30 @@ void meanBlending(std::vector<Image*> &images)
 		output[i].g = (float)mean(green);
 		//mean of blue values
 		output[i].b = (float)mean(blue);
+
+		//report each finished row and stop at the end of the row if cancelled
+		if (progress != nullptr && (i + 1) % width == 0 && !progress->advance())
+			return Image();
 	}
-	//write output Image to PPM file named "Mean Blending"
-	writePPM(output, "Mean Blending.ppm");
+	//return blended image
+	return output;
 }
-//median blendgin algorithm
-void medianBlending(std::vector<Image*> &images)
+//mean blending algorithm written to a PPM file named "Mean Blending" unless told otherwise
+bool meanBlending(std::vector<Image*> &images, const char *filename, ProgressToken *progress)
 {
 	//notify user that blending has begun
-	std::cout << "Median blending started..." << std::endl;
+	std::cout << "Mean blending started..." << std::endl;
+	//write output Image to PPM file
+	return writeBlend(meanBlend(images, progress), filename, progress);
+}
+//median blendgin algorithm
+//returns the blended image in memory so that the caller decides where it is written
+Image medianBlend(std::vector<Image*> &images, ProgressToken *progress)
+{
 	//get totoal size of first image and assign to variable
-	int pixelCount = images.at(0)->getSize();
+	size_t pixelCount = images.at(0)->getSize();
+	//every frame is read and the output written
+	PERF_STAGE("median blend", (images.size() + 1) * pixelCount * sizeof(Image::Rgb));
 	//assign images vector size to variable
 	int imageNo = (int)images.size();
 
@@ -288,12 +1093,16 @@ void medianBlending(std::vector<Image*> &images)
 	Image output(images.at(0)->getWidth(), images.at(0)->getHeight());
 	//Set bit depth of output image to that of the first image
 	output.setBitDepth(images.at(0)->getBitDepth());
+	//one step of progress per row
+	size_t width = images.at(0)->getWidth();
+	if (progress != nullptr)
+		progress->addWork(images.at(0)->getHeight());
 
 	//create vectors to be used to store colour channels of each pixel
 	std::vector<float> red, green, blue;
 
 	//loop trough each pixel
-	for (int i = 0; i < pixelCount; ++i)
+	for (size_t i = 0; i < pixelCount; ++i)
 	{
 		//empty vectors
 		red.clear();
@@ -313,265 +1122,670 @@ void medianBlending(std::vector<Image*> &images)
 		output[i].g = (float)median(green);
 		//median of blue values
 		output[i].b = (float)median(blue);
+
+		//report each finished row and stop at the end of the row if cancelled
+		if (progress != nullptr && (i + 1) % width == 0 && !progress->advance())
+			return Image();
+	}
+	//return blended image
+	return output;
+}
+//median blending algorithm written to a PPM file named "Median Blending" unless told otherwise
+bool medianBlending(std::vector<Image*> &images, const char *filename, ProgressToken *progress)
+{
+	//notify user that blending has begun
+	std::cout << "Median blending started..." << std::endl;
+	//write output Image to PPM file
+	return writeBlend(medianBlend(images, progress), filename, progress);
+}
+//***Sigma Clipping***
+
+void ClipWindow::reset()
+{
+	std::sort(samples.begin(), samples.end());
+	first = 0;
+	last = samples.size();
+	shift = samples.empty() ? 0 : samples[samples.size() / 2];
+
+	sums.resize(samples.size() + 1);
+	squares.resize(samples.size() + 1);
+	sums[0] = squares[0] = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		double d = samples[i] - shift;
+		sums[i + 1] = sums[i] + d;
+		squares[i + 1] = squares[i] + d * d;
+	}
+}
+
+size_t ClipWindow::size() const
+{
+	return last - first;
+}
+
+//same float arithmetic as median()
+float ClipWindow::median() const
+{
+	size_t n = size();
+	if (n % 2 == 0)
+		return (samples[first + n / 2] + samples[first + n / 2 - 1]) / 2;
+	return samples[first + n / 2];
+}
+
+//Standard deviation of the remaining samples rounded to a float, as the clipping code has always stored it
+//The prefix sums give the variance in constant time but round differently to sDeviation(), which sums squared differences from the mean
+//Both are far more precise than a float, so they round to the same float unless the value is within their combined error
+//of halfway between two floats - only then, or when the variance is too small to trust, is sDeviation() run on the samples
+float ClipWindow::sDeviation() const
+{
+	size_t n = size();
+	double s = sums[last] - sums[first];
+	double variance = ((squares[last] - squares[first]) - s * s / n) / n;
+
+	//worst case rounding error of the prefix sums and of sDeviation() itself
+	double error = 4 * (samples.size() + 4) * DBL_EPSILON * (squares.back() + s * s / n) / n;
+
+	if (variance > error)
+	{
+		double deviation = sqrt(variance);
+		double deviationError = 2 * (error / (2 * deviation) + deviation * (n + 4) * DBL_EPSILON);
+
+		//halfway points to the floats either side
+		float rounded = (float)deviation;
+		double above = ((double)rounded + std::nextafter(rounded, FLT_MAX)) / 2;
+		double below = ((double)rounded + std::nextafter(rounded, 0.f)) / 2;
+		if (std::abs(deviation - above) > deviationError && std::abs(deviation - below) > deviationError)
+			return rounded;
 	}
-	//write output Image to PPM file named "Median Blending"
-	writePPM(output, "Median Blending.ppm");
+
+	//too close to call - sDeviation() sorts nothing, the samples are already in the order it has always seen them
+	std::vector<float> remaining(samples.begin() + first, samples.begin() + last);
+	return (float)::sDeviation(remaining);
+}
+
+//same summation as mean(), done directly so that the result doesn't depend on the values being exact in a double
+float ClipWindow::mean() const
+{
+	double sum = 0;
+	for (size_t i = first; i < last; ++i)
+		sum += (double)samples[i];
+	return (float)(sum / (double)size());
+}
+
+//samples are sorted so everything removed is at one end or the other
+void ClipWindow::clip(float lower, float upper)
+{
+	while (first < last && samples[first] < lower)
+		++first;
+	while (last > first && samples[last - 1] > upper)
+		--last;
 }
+
+//Clip a window around its median by its standard deviation until iterations have been done or nothing more is removed
+void clipIterations(ClipWindow &window, int iterations)
+{
+	//median and standard deviation of the remaining values
+	float medianValue, sDeviationValue;
+
+	//loop through each iteration
+	for (int x = 0; x < iterations; ++x)
+	{
+		//find the median and standard deviation of the remaining values
+		medianValue = window.median();
+		sDeviationValue = window.sDeviation();
+
+		//remove all values smaller than the lower bound or larger than the upper bound
+		size_t size = window.size();
+		window.clip(medianValue - sDeviationValue, medianValue + sDeviationValue);
+
+		//nothing removed - every later iteration would find the same bounds and remove nothing either
+		if (window.size() == size)
+			break;
+	}
+}
+
+//Clip a window around its median until its standard deviation has fallen by tolerence of what is left, or nothing more is removed
+void clipTolerence(ClipWindow &window, float tolerence)
+{
+	//median and standard deviation values of the window
+	float medianValue, originalSDeviation, newSDeviation;
+	//tolerence level of the window
+	float tolerenceLevel;
+	//size variable to hold number of remaining values to ensure infinte loops are escaped
+	size_t size;
+
+	//find the median and orignal standard deviaton of the window
+	medianValue = window.median();
+	originalSDeviation = window.sDeviation();
+
+	//remove values that are larger than upper bound or smaller than lower bound
+	window.clip(medianValue - originalSDeviation, medianValue + originalSDeviation);
+
+	//find new standard deviaton value and calculate tolerence level
+	newSDeviation = window.sDeviation();
+	tolerenceLevel = (originalSDeviation - newSDeviation) / newSDeviation;
+
+	//loop until tolerenceLevel is greater than or equal to the user specified one
+	while (tolerenceLevel < tolerence)
+	{
+		//calculate new median
+		medianValue = window.median();
+
+		//store number of remaining values
+		size = window.size();
+
+		//remove values outside of the new bounds
+		window.clip(medianValue - newSDeviation, medianValue + newSDeviation);
+
+		//calculate new standard deviation value
+		newSDeviation = window.sDeviation();
+
+		//check to see if the new deviation value is greater than 0 and that the new size is different to the old size
+		if (newSDeviation > 0 && size != window.size())
+		{
+			//calulate new tolerence value
+			tolerenceLevel = (originalSDeviation - newSDeviation) / newSDeviation;
+		}
+		else
+		{
+			//break while loop since it is unnecessary to perform operations on vectors which have already had all of their outlier values removed:
+				//indicated by new sdeviation being 0 and by no chnage in size from the erase operation
+			break;
+		}
+	}
+}
+
+//***Static Pixel Test***
+
+//SSE2 is always there on x64 and is switched on by most x86 compilers
+#if defined(_M_X64) || defined(__SSE2__)
+#define SPREAD_SSE
+#include <emmintrin.h>
+#endif
+
+StaticPixels::StaticPixels(float counts) :
+	spread(counts),
+	staticCount(0),
+	clippedCount(0)
+{}
+
+//Largest range of any channel across the frames for count pixels from first
+//lows and highs are scratch space for the per sample minimum and maximum
+static void pixelSpread(const std::vector<Image*> &images, size_t first, size_t count, std::vector<float> &spreads, std::vector<float> &lows, std::vector<float> &highs)
+{
+	//channels are separate floats, so the pixels are 3 x count samples in a row
+	size_t samples = count * 3;
+	lows.resize(samples);
+	highs.resize(samples);
+	spreads.resize(count);
+
+	const float *firstFrame = reinterpret_cast<const float *>(images[0]->getPixels() + first);
+	std::copy(firstFrame, firstFrame + samples, lows.begin());
+	std::copy(firstFrame, firstFrame + samples, highs.begin());
+
+	for (size_t j = 1; j < images.size(); ++j)
+	{
+		const float *frame = reinterpret_cast<const float *>(images[j]->getPixels() + first);
+		size_t s = 0;
+#ifdef SPREAD_SSE
+		//4 samples at a time
+		for (; s + 4 <= samples; s += 4)
+		{
+			__m128 v = _mm_loadu_ps(frame + s);
+			_mm_storeu_ps(&lows[s], _mm_min_ps(_mm_loadu_ps(&lows[s]), v));
+			_mm_storeu_ps(&highs[s], _mm_max_ps(_mm_loadu_ps(&highs[s]), v));
+		}
+#endif
+		for (; s < samples; ++s)
+		{
+			lows[s] = std::min(lows[s], frame[s]);
+			highs[s] = std::max(highs[s], frame[s]);
+		}
+	}
+
+	for (size_t p = 0; p < count; ++p)
+		spreads[p] = std::max(highs[p * 3] - lows[p * 3], std::max(highs[p * 3 + 1] - lows[p * 3 + 1], highs[p * 3 + 2] - lows[p * 3 + 2]));
+}
+
+//Mean of every sample of a pixel, summed as mean() does
+static Image::Rgb meanPixel(const std::vector<Image*> &images, size_t i)
+{
+	double r = 0, g = 0, b = 0;
+	for (size_t j = 0; j < images.size(); ++j)
+	{
+		const Image::Rgb &p = images[j]->getPixels()[i];
+		r += (double)p.r;
+		g += (double)p.g;
+		b += (double)p.b;
+	}
+	double n = (double)images.size();
+	return Image::Rgb((float)(r / n), (float)(g / n), (float)(b / n));
+}
+
+//Runs the static pixel test on each row of a blend as it reaches it
+class StaticPixelFilter
+{
+public:
+	StaticPixelFilter(const std::vector<Image*> &frames, StaticPixels *t) :
+		images(frames),
+		test(t),
+		threshold(t != nullptr ? t->spread / 255.f : 0),
+		width(frames.at(0)->getWidth()),
+		staticCount(0),
+		clippedCount(0)
+	{}
+
+	//adds the counts of this blend to the test's totals
+	~StaticPixelFilter()
+	{
+		if (test != nullptr)
+		{
+			test->staticCount += staticCount;
+			test->clippedCount += clippedCount;
+		}
+	}
+
+	//true if pixel i is static, in which case its mean is in pixel
+	bool isStatic(size_t i, Image::Rgb &pixel)
+	{
+		if (test == nullptr)
+			return false;
+		//pre-pass over each row as the blend starts it
+		if (i % width == 0)
+			pixelSpread(images, i, width, spreads, lows, highs);
+		if (spreads[i % width] > threshold)
+		{
+			++clippedCount;
+			return false;
+		}
+		++staticCount;
+		pixel = meanPixel(images, i);
+		return true;
+	}
+
+private:
+	const std::vector<Image*> &images;
+	StaticPixels *test; //nullptr when every pixel is clipped
+	float threshold; //spread in pixel values
+	size_t width;
+	std::vector<float> spreads, lows, highs; //current row
+	unsigned long long staticCount, clippedCount; //pixels of this blend
+};
+
+//Restore the rows a checkpoint holds into output and count them as done
+//returns the first row to clip
+static unsigned int startRow(Image &output, ProgressToken *progress, Checkpoint *checkpoint)
+{
+	unsigned int rows = checkpoint != nullptr ? checkpoint->restore(output) : 0;
+	if (progress != nullptr && rows > 0)
+		progress->advance(rows);
+	return rows;
+}
+
+//Report a finished row and offer the rows so far to the checkpoint
+//returns false if cancelled, after saving every finished row so that nothing is lost
+static bool finishRow(const Image &output, unsigned int rows, ProgressToken *progress, Checkpoint *checkpoint)
+{
+	if (progress != nullptr && !progress->advance())
+	{
+		if (checkpoint != nullptr)
+			checkpoint->save(output, rows, true);
+		return false;
+	}
+	if (checkpoint != nullptr)
+		checkpoint->save(output, rows);
+	return true;
+}
+
 //sigma clipping algorithm based on iterations
-void sigmaClipping(std::vector<Image*> &images, int iterations)
+//returns an empty image if the number of iterations is invalid
+Image sigmaClip(std::vector<Image*> &images, int iterations, ProgressToken *progress, StaticPixels *test, Checkpoint *checkpoint)
 {
 	//only performs algorithm if number of iterations is above 0
 	if (iterations > 0)
 	{
-		//alert user that clipping has begun with the current parameters
-		std::cout << "\nSigma Clipping until " << iterations << " iteration(s) have been performed..." << std::endl;
-
 		//get total size of first image and assign to variable
-		int pixelCount = images.at(0)->getSize();
+		size_t pixelCount = images.at(0)->getSize();
+		//every frame is read and the output written
+		PERF_STAGE("sigma clip iterations", (images.size() + 1) * pixelCount * sizeof(Image::Rgb));
 		//create new temp image to output with size of first image in vector
 		Image output(images.at(0)->getWidth(), images.at(0)->getHeight());
 		//Set bit depth of output image to that of the first image
 		output.setBitDepth(images.at(0)->getBitDepth());
+		//one step of progress per row
+		size_t width = images.at(0)->getWidth();
+		if (progress != nullptr)
+			progress->addWork(images.at(0)->getHeight());
 
-		//Rgb struct to hold the standard devition values for the r, g and b vectors
-		Image::Rgb sDeviationPixel, medianPixel;
-		//Rgb struct to hold the uppper and lower bound values for the r, g and b vectors
-		Image::Rgb upperBound, lowerBound;
-
-		//create vectors to be used to store colour channels of each pixel
-		std::vector<float> red, green, blue;
+		//sorted samples of the r, g and b channels
+		ClipWindow channels[3];
 		//assign images vector size to variable
 		int noImages = (int)images.size();
 
+		//pixels whose samples barely differ skip clipping
+		StaticPixelFilter filter(images, test);
+
+		//carry on after the rows of an earlier run
+		size_t restored = startRow(output, progress, checkpoint) * width;
+
 		//loop through each pixel
-		for (int i = 0; i < pixelCount; ++i)
+		for (size_t i = restored; i < pixelCount; ++i)
 		{
+			if (filter.isStatic(i, output[i]))
+			{
+				if ((i + 1) % width == 0 && !finishRow(output, (unsigned int)((i + 1) / width), progress, checkpoint))
+					return Image();
+				continue;
+			}
+
 			//empty vectors
-			red.clear();
-			green.clear();
-			blue.clear();
+			channels[0].samples.clear();
+			channels[1].samples.clear();
+			channels[2].samples.clear();
 
 			//loop through each image
 			for (int j = 0; j < noImages; ++j)
 			{
 				//convert current pixel values to float vectors
-				toFloats(images.at(j), red, green, blue, i);
+				toFloats(images.at(j), channels[0].samples, channels[1].samples, channels[2].samples, i);
 			}
 
-			//loop through each iteration
-			for (int x = 0; x < iterations; ++x)
+			//channels are clipped independently
+			for (int c = 0; c < 3; ++c)
 			{
-				//find and store the median values of the r, g and b values
-				medianPixel.r = (float)median(red);
-				medianPixel.g = (float)median(green);
-				medianPixel.b = (float)median(blue);
-
-				//find and store the standard deviation values of the r, g and b values
-				sDeviationPixel.r = (float)sDeviation(red);
-				sDeviationPixel.g = (float)sDeviation(green);
-				sDeviationPixel.b = (float)sDeviation(blue);
-
-				//calculate and store the upper bound and lower bound by addition/subtraction of Rgbs
-				upperBound = medianPixel + sDeviationPixel;
-				lowerBound = medianPixel - sDeviationPixel;
-
-				//remove_if moves all of the elements that do not satisfy the lambda expression to the back of the vector and returns the point at which those values begin
-				//erase removes from the start of the unwanted values to the end of the vector
-
-				//remove all values from red array that are smaller than the 'r' float value in lower bound and larger than the 'r' float value in upper bound
-				red.erase(std::remove_if(red.begin(), red.end(), [&](float n) { return n < lowerBound.r || n > upperBound.r; }), red.end());
-				//remove all values from green array that are smaller than the 'g' float value in lower bound and larger than the 'g' float value in upper bound
-				green.erase(std::remove_if(green.begin(), green.end(), [&](float n) { return n < lowerBound.g || n > upperBound.g; }), green.end());
-				//remove all values from blue array that are smaller than the 'b' float value in lower bound and larger than the 'b' float value in upper bound
-				blue.erase(std::remove_if(blue.begin(), blue.end(), [&](float n) { return n < lowerBound.b || n > upperBound.b; }), blue.end());
+				//sort once
+				channels[c].reset();
+				clipIterations(channels[c], iterations);
 			}
 			//completed iterations
 
 			//assign mean of remaining values in red vector to the 'r' float value at the current index of the pixel array
-			output[i].r = (float)mean(red);
+			output[i].r = channels[0].mean();
 			//mean of green values
-			output[i].g = (float)mean(green);
+			output[i].g = channels[1].mean();
 			//mean of blue values
-			output[i].b = (float)mean(blue);
+			output[i].b = channels[2].mean();
 
+			if ((i + 1) % width == 0 && !finishRow(output, (unsigned int)((i + 1) / width), progress, checkpoint))
+				return Image();
 		}
 		//gone through each pixel
 
-		//write output Image to PPM file named "Sigma Clipping Iterations.ppm"
-		writePPM(output, "Sigma Clipping Iterations.ppm");
+		//return clipped image
+		return output;
 	}
+
+	//iterations less than 1 - nothing to return
+	return Image();
+}
+//sigma clipping algorithm based on iterations written to a PPM file named "Sigma Clipping Iterations" unless told otherwise
+bool sigmaClipping(std::vector<Image*> &images, int iterations, const char *filename, ProgressToken *progress)
+{
 	//iterations less than 1
-	else 
+	if (iterations <= 0)
 	{
 		//alert user that they input an invalid number of iterations
 		std::cout << "\nNo operations were performed since you entered an iteration value less than or equal to 0.\n" << std::endl;
+		return false;
 	}
+
+	//alert user that clipping has begun with the current parameters
+	std::cout << "\nSigma Clipping until " << iterations << " iteration(s) have been performed..." << std::endl;
+	//a killed or cancelled run carries on from its checkpoint when run again
+	std::stringstream job;
+	job << "sigma-iter " << iterations;
+	Checkpoint checkpoint(filename, job.str(), imageNames(images));
+	//write output Image to PPM file
+	if (!writeBlend(sigmaClip(images, iterations, progress, nullptr, &checkpoint), filename, progress))
+		return false;
+	checkpoint.remove();
+	return true;
 }
-//sigma clipping algorithm based on iterations
-void sigmaClipping(std::vector<Image*> &images, float tolerence)
+//sigma clipping algorithm based on tolerence
+//returns an empty image if the tolerence is invalid
+Image sigmaClip(std::vector<Image*> &images, float tolerence, ProgressToken *progress, StaticPixels *test, Checkpoint *checkpoint)
 {
 	//only performs algorthm if tolerence is a positive number
 	if (tolerence > 0)
 	{
-		//alert user that clipping has begun with the current parameters
-		std::cout << "\nSigma Clipping until a tolerence level of " << tolerence << " is met..." << std::endl;
-
 		//get total size of first image and assign to variable
-		int pixelCount = images.at(0)->getSize();
+		size_t pixelCount = images.at(0)->getSize();
+		//every frame is read and the output written
+		PERF_STAGE("sigma clip tolerence", (images.size() + 1) * pixelCount * sizeof(Image::Rgb));
 		//create new temp image to output with size of first image in vector
 		Image output(images.at(0)->getWidth(), images.at(0)->getHeight());
 		//Set bit depth of output image to that of the first image
 		output.setBitDepth(images.at(0)->getBitDepth());
+		//one step of progress per row
+		size_t width = images.at(0)->getWidth();
+		if (progress != nullptr)
+			progress->addWork(images.at(0)->getHeight());
 
-		//Rgb struct to hold the standard devition and median values for the r, g and b vectors
-		Image::Rgb originalSDeviationPixel, medianPixel, newSDeviationPixel;
-		//Rgb struct to hold the upper and lower bound values for the r, g and b vectors
-		Image::Rgb upperBound, lowerBound;
-
-		//create vectors to be used to store colour channels of each pixel
-		std::vector<float> red, green, blue;
+		//sorted samples of the r, g and b channels
+		ClipWindow channels[3];
 		//assign images vector size to variable
 		int noImages = (int)images.size();
 
-		//Rgb struct to hold tolerence level for each colour channel
-		Image::Rgb tolerneceLevel;
-		//size variable to hold size of colour vectors to ensure infinte loops are escaped
-		size_t size;
+		//pixels whose samples barely differ skip clipping
+		StaticPixelFilter filter(images, test);
 
+		//carry on after the rows of an earlier run
+		size_t restored = startRow(output, progress, checkpoint) * width;
 
 		//loop through each pixel
-		for (int i = 0; i < pixelCount; ++i)
+		for (size_t i = restored; i < pixelCount; ++i)
 		{
+			if (filter.isStatic(i, output[i]))
+			{
+				if ((i + 1) % width == 0 && !finishRow(output, (unsigned int)((i + 1) / width), progress, checkpoint))
+					return Image();
+				continue;
+			}
+
 			//empty contents on vectors
-			red.clear();
-			green.clear();
-			blue.clear();
+			channels[0].samples.clear();
+			channels[1].samples.clear();
+			channels[2].samples.clear();
 
 			//loop through each image
 			for (int j = 0; j < noImages; ++j)
 			{
 				//convert current pixel values to float vectors
-				toFloats(images.at(j), red, green, blue, i);
+				toFloats(images.at(j), channels[0].samples, channels[1].samples, channels[2].samples, i);
 			}
 
-			//find and store the median values of the r, g and b values
-			medianPixel.r = (float)median(red);
-			medianPixel.g = (float)median(green);
-			medianPixel.b = (float)median(blue);
-
-			//find and store the orignal standard deviaton values of the r, g and b channels
-			originalSDeviationPixel.r = (float)sDeviation(red);
-			originalSDeviationPixel.g = (float)sDeviation(green);
-			originalSDeviationPixel.b = (float)sDeviation(blue);
+			//channels are clipped independently
+			for (int c = 0; c < 3; ++c)
+			{
+				//sort once
+				channels[c].reset();
+				clipTolerence(channels[c], tolerence);
+			}
+			//completed checking tolerence value
 
-			//calculate the upper and lower bound value figures for each of the colour channels 
-			upperBound = medianPixel + originalSDeviationPixel;
-			lowerBound = medianPixel - originalSDeviationPixel;
+			//assign mean of remaining values in red vector to the 'r' float value at the current index of the pixel array
+			output[i].r = channels[0].mean();
+			//mean of green values
+			output[i].g = channels[1].mean();
+			//mean of blue values
+			output[i].b = channels[2].mean();
 
-			//erase elements from vector that are larger than upper bounds or smaller than lower bounds
-			red.erase(std::remove_if(red.begin(), red.end(), [&](float n) { return n < lowerBound.r || n > upperBound.r; }), red.end());
+			if ((i + 1) % width == 0 && !finishRow(output, (unsigned int)((i + 1) / width), progress, checkpoint))
+				return Image();
+		}
 
-			green.erase(std::remove_if(green.begin(), green.end(), [&](float n) { return n < lowerBound.g || n > upperBound.g; }), green.end());
+		//gone through each pixel
 
-			blue.erase(std::remove_if(blue.begin(), blue.end(), [&](float n) { return n < lowerBound.b || n > upperBound.b; }), blue.end());
+		//return clipped image
+		return output;
+	}
 
-			//find and store new standard deviaton values of the r, g and b colour channlels
-			newSDeviationPixel.r = (float)sDeviation(red);
-			newSDeviationPixel.g = (float)sDeviation(green);
-			newSDeviationPixel.b = (float)sDeviation(blue);
+	//tolerence level less than or equal to 0 - nothing to return
+	return Image();
+}
+//sigma clipping algorithm based on tolerence written to a PPM file named "Sigma Clipping Tolerence" unless told otherwise
+bool sigmaClipping(std::vector<Image*> &images, float tolerence, const char *filename, ProgressToken *progress)
+{
+	//tolerence level less than or equal to 0
+	if (tolerence <= 0)
+	{
+		//alert user of invalid tolerence level
+		std::cout << "\nNo operations were performed since you entered a tolerence value less than or equal to 0.\n" << std::endl;
+		return false;
+	}
 
-			//calculate tolerence level and store for each colour channel
-			tolerneceLevel = (originalSDeviationPixel - newSDeviationPixel) / newSDeviationPixel;
+	//alert user that clipping has begun with the current parameters
+	std::cout << "\nSigma Clipping until a tolerence level of " << tolerence << " is met..." << std::endl;
+	//a killed or cancelled run carries on from its checkpoint when run again
+	std::stringstream job;
+	job << "sigma-tol " << std::setprecision(9) << tolerence;
+	Checkpoint checkpoint(filename, job.str(), imageNames(images));
+	//write output Image to PPM file
+	if (!writeBlend(sigmaClip(images, tolerence, progress, nullptr, &checkpoint), filename, progress))
+		return false;
+	checkpoint.remove();
+	return true;
+}
+//***Luma Guided Blending***
 
+//Rec. 601 luma weights
+static const float kLumaRed = 0.299f, kLumaGreen = 0.587f, kLumaBlue = 0.114f;
 
-			//loop until tolerenceLevel is greater than or equal to the user specified one
-			while (tolerneceLevel.r < tolerence)
-			{
-				//calculate new median and store in median pixel
-				medianPixel.r = (float)median(red);
-
-				//calculate new upper and lower bounds 
-				upperBound.r = medianPixel.r + newSDeviationPixel.r;
-				lowerBound.r = medianPixel.r - newSDeviationPixel.r;
+static float luma(const Image::Rgb &p)
+{
+	return kLumaRed * p.r + kLumaGreen * p.g + kLumaBlue * p.b;
+}
 
-				//store size of red vector
-				size = red.size();
+//Mean of the whole pixels of frames [first, last) of order, summed in doubles like mean()
+static Image::Rgb meanOfFrames(const std::vector<const Image::Rgb*> &pixels, const std::vector<unsigned int> &order, size_t first, size_t last)
+{
+	double r = 0, g = 0, b = 0;
+	for (size_t k = first; k < last; ++k)
+	{
+		r += (double)pixels[order[k]]->r;
+		g += (double)pixels[order[k]]->g;
+		b += (double)pixels[order[k]]->b;
+	}
+	double n = (double)(last - first);
+	return Image::Rgb((float)(r / n), (float)(g / n), (float)(b / n));
+}
 
-				//erase elements from vector that are larger than upper bounds or smaller than lower bounds
-				red.erase(std::remove_if(red.begin(), red.end(), [&](float n) { return n < lowerBound.r || n > upperBound.r; }), red.end());
+//Runs select on every pixel with that pixel of each frame and its luma
+//select picks or combines whole frame pixels, so each pixel needs one selection rather than one per channel
+template <typename Select>
+static Image lumaBlend(std::vector<Image*> &images, ProgressToken *progress, Select select)
+{
+	//get total size of first image and assign to variable
+	size_t pixelCount = images.at(0)->getSize();
+	//create new temp image to output with size of first image in vector
+	Image output(images.at(0)->getWidth(), images.at(0)->getHeight());
+	//Set bit depth of output image to that of the first image
+	output.setBitDepth(images.at(0)->getBitDepth());
+	//one step of progress per row
+	size_t width = images.at(0)->getWidth();
+	if (progress != nullptr)
+		progress->addWork(images.at(0)->getHeight());
 
-				//calculate new standard deviation value
-				newSDeviationPixel.r = (float)sDeviation(red);
+	//the current pixel of each frame and its luma
+	std::vector<const Image::Rgb*> pixels(images.size());
+	std::vector<float> lumas(images.size());
 
-				//check to see if the new deviation value is greater than 0 and that the new size is different to the old size
-				if (newSDeviationPixel.r > 0 && size != red.size())
-				{
-					//calulate new tolerence value
-					tolerneceLevel.r = (originalSDeviationPixel.r - newSDeviationPixel.r) / newSDeviationPixel.r;
-				}
-				else
-				{
-					//break while loop since it is unnecessary to perform operations on vectors which have already had all of their outlier values removed:
-						//indicated by new sdeviation being 0 and by no chnage in size from the erase operation
-					break;
-				}
-			}
+	//loop through each pixel
+	for (size_t i = 0; i < pixelCount; ++i)
+	{
+		for (size_t j = 0; j < images.size(); ++j)
+		{
+			pixels[j] = images[j]->getPixels() + i;
+			lumas[j] = luma(*pixels[j]);
+		}
+		output[i] = select(pixels, lumas);
 
-			//operation repeated for each colour channel
-			while (tolerneceLevel.g < tolerence)
-			{
-				medianPixel.g = (float)median(green);
+		//report each finished row and stop at the end of the row if cancelled
+		if (progress != nullptr && (i + 1) % width == 0 && !progress->advance())
+			return Image();
+	}
+	//return blended image
+	return output;
+}
 
-				upperBound.g = medianPixel.g + newSDeviationPixel.g;
-				lowerBound.g = medianPixel.g - newSDeviationPixel.g;
+//Median blending by luma
+//the frame with the median luma gives the whole pixel, so every output pixel is a colour one of the frames had
+//with an even number of frames the lower of the two middle frames is used rather than an average, which would be a new colour
+Image lumaMedianBlend(std::vector<Image*> &images, ProgressToken *progress)
+{
+	//every frame is read and the output written
+	PERF_STAGE("luma median blend", (images.size() + 1) * images.at(0)->getSize() * sizeof(Image::Rgb));
 
-				size = green.size();
+	//frames ordered around the middle by luma, only partly sorted
+	std::vector<unsigned int> order(images.size());
+	size_t middle = (order.size() - 1) / 2;
 
-				green.erase(std::remove_if(green.begin(), green.end(), [&](float n) { return n < lowerBound.g || n > upperBound.g; }), green.end());
+	return lumaBlend(images, progress, [&](const std::vector<const Image::Rgb*> &pixels, const std::vector<float> &lumas) -> Image::Rgb
+	{
+		for (unsigned int j = 0; j < order.size(); ++j)
+			order[j] = j;
+		std::nth_element(order.begin(), order.begin() + middle, order.end(), [&lumas](unsigned int a, unsigned int b) { return lumas[a] < lumas[b]; });
 
-				newSDeviationPixel.g = (float)sDeviation(green);
+		const Image::Rgb &median = *pixels[order[middle]];
+		return Image::Rgb(median.r, median.g, median.b);
+	});
+}
 
-				if (newSDeviationPixel.g > 0 && size != green.size())
-					tolerneceLevel.g = (originalSDeviationPixel.g - newSDeviationPixel.g) / newSDeviationPixel.g;
-				else
-					break;
-			}
+//Frames of a pixel sorted by luma, with their lumas in a clip window in the same order
+static void sortByLuma(const std::vector<float> &lumas, std::vector<unsigned int> &order, ClipWindow &window)
+{
+	for (unsigned int j = 0; j < order.size(); ++j)
+		order[j] = j;
+	std::sort(order.begin(), order.end(), [&lumas](unsigned int a, unsigned int b) { return lumas[a] < lumas[b]; });
+
+	window.samples.resize(order.size());
+	for (size_t k = 0; k < order.size(); ++k)
+		window.samples[k] = lumas[order[k]];
+	//already in order, so the window's own sort leaves the samples lined up with order
+	window.reset();
+}
 
-			while (tolerneceLevel.b < tolerence)
-			{
-				medianPixel.b = (float)median(blue);
+//Sigma clipping by luma based on iterations
+//frames are clipped on their luma and whole frames rejected, then the output is the mean of the pixels of the frames left
+//returns an empty image if the number of iterations is invalid
+Image lumaSigmaClip(std::vector<Image*> &images, int iterations, ProgressToken *progress)
+{
+	//iterations less than 1 - nothing to return
+	if (iterations <= 0)
+		return Image();
 
-				upperBound.b = medianPixel.b + newSDeviationPixel.b;
-				lowerBound.b = medianPixel.b - newSDeviationPixel.b;
+	//every frame is read and the output written
+	PERF_STAGE("luma sigma clip iterations", (images.size() + 1) * images.at(0)->getSize() * sizeof(Image::Rgb));
 
-				size = blue.size();
+	std::vector<unsigned int> order(images.size());
+	ClipWindow window;
 
-				blue.erase(std::remove_if(blue.begin(), blue.end(), [&](float n) { return n < lowerBound.b || n > upperBound.b; }), blue.end());
+	return lumaBlend(images, progress, [&](const std::vector<const Image::Rgb*> &pixels, const std::vector<float> &lumas)
+	{
+		sortByLuma(lumas, order, window);
+		clipIterations(window, iterations);
+		return meanOfFrames(pixels, order, window.first, window.last);
+	});
+}
 
-				newSDeviationPixel.b = (float)sDeviation(blue);
+//Sigma clipping by luma based on tolerence
+//returns an empty image if the tolerence is invalid
+Image lumaSigmaClip(std::vector<Image*> &images, float tolerence, ProgressToken *progress)
+{
+	//tolerence level less than or equal to 0 - nothing to return
+	if (tolerence <= 0)
+		return Image();
 
-				if (newSDeviationPixel.b > 0 && size != blue.size())
-					tolerneceLevel.b = (originalSDeviationPixel.b - newSDeviationPixel.b) / newSDeviationPixel.b;
-				else
-					break;
-			}
-			//completed checking tolerence value
+	//every frame is read and the output written
+	PERF_STAGE("luma sigma clip tolerence", (images.size() + 1) * images.at(0)->getSize() * sizeof(Image::Rgb));
 
-			//assign mean of remaining values in red vector to the 'r' float value at the current index of the pixel array
-			output[i].r = (float)mean(red);
-			//mean of green values
-			output[i].g = (float)mean(green);
-			//mean of blue values
-			output[i].b = (float)mean(blue);
-		}		
+	std::vector<unsigned int> order(images.size());
+	ClipWindow window;
 
-		//gone through each pixel
-		writePPM(output, "Sigma Clipping Tolerence.ppm");
-	}
-	//tolerence level less than or equal to 0
-	else
+	return lumaBlend(images, progress, [&](const std::vector<const Image::Rgb*> &pixels, const std::vector<float> &lumas)
 	{
-		//alert user of invalid tolerence level
-		std::cout << "\nNo operations were performed since you entered a tolerence value less than or equal to 0.\n" << std::endl;
-	}
-}
\ No newline at end of file
+		sortByLuma(lumas, order, window);
+		clipTolerence(window, tolerence);
+		return meanOfFrames(pixels, order, window.first, window.last);
+	});
+}
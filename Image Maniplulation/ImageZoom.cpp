@@ -1,11 +1,21 @@
-#define _CRT_SECURE_NO_WARNINGS //allow use of std::localtime and std::put_time 
-								//may cause data races in multi-threaded application
 #include "ImageZoom.h"
-#include <fstream> //outputting log file
-#include <chrono> //getting current time
+#include "Logging.h"
+#include "Progress.h"
+#include "PerfCounters.h"
+#include "TiledImage.h"
 #include <sstream> //concatenating strings
-#include <iomanip> //outputting time
 #include <iostream> //output status of zoom
+#include <algorithm> //overlap of source and output pixels
+#include <thread> //share output rows between threads
+#include <functional> //pass band rows to threads
+#include <cstdio> //report invalid sizes
+#include <atomic> //hand out bands to threads
+
+//SSE2 is always there on x64 and is switched on by most x86 compilers
+#if defined(_M_X64) || defined(__SSE2__)
+#define ZOOM_SSE
+#include <emmintrin.h>
+#endif
 
 //constructors
 ImageZoom::ImageZoom() :
@@ -36,40 +46,66 @@ ImageZoom ImageZoom::operator=(const ImageZoom &img)
 	return *this;
 }
 
+//Queues a record of the Image and its zoom level for the zoom log file
 void ImageZoom::log()
 {
-	//declares a time_t that holds the time now according to the system clock
-	time_t time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	//declare stringstream for generating filenames
-	std::stringstream filename;
-	//concatenate filename and current time 
-	//format: YYYY-MM-DD
-	filename << "Logs/zoom-" << std::put_time(std::localtime(&time), "%F") << ".txt";
-	//declare output file stream for log
-	std::ofstream log;
-	try
+	logImage(*this, kZoomLog);
+}
+
+//source pixels per tile row - 256 pixels expand to 1024 at 4x, a 12KB row that stays in L1 while it is copied out
+static const unsigned int kZoomTileColumns = 256;
+//source rows per band - the unit handed to threads and reported to the progress token
+static const unsigned int kZoomBandRows = 16;
+//outputs bigger than this are written with non-temporal stores so they don't push the source out of the cache
+static const unsigned long long kStreamingBytes = 8 * 1024 * 1024;
+
+//copy n floats to an output row
+//non-temporal stores need 16 byte aligned addresses, so the first few floats of a row are copied normally
+static void storeRow(float *out, const float *row, size_t n, bool streaming)
+{
+	size_t i = 0;
+#ifdef ZOOM_SSE
+	if (streaming)
 	{
-		//opens filename converted to array of chars and uses append mode
-		log.open(filename.str().c_str(), std::ios::app);
-		//check to see if file was opened correctly and throw error if not
-		if (log.fail())
-			throw("Error during log generation for image zoom operation.");
-		//get the read time of the file and store within time_t variable so that address can be used
-		time_t rTime = getReadTime();
-		//writes filename, date read, dimensions, bitdepth, readtime and zoom level to log
-		//time format eg. Mon 4 Dec 2017 HH:MM:SS Timezone 
-		log << "Filename: " << getName() << "\nDate read: " << std::put_time(std::localtime(&rTime), "%a %d %b %Y %T %Z") << "\nDimensions: " << getWidth() << " x "
-			<< getHeight() << "\nBit depth: " << getBitDepth() << "\nRead time: " << getTimeToRead() << "ms" << "\nZoom level: " << getZoom() << "x\n" << std::endl;
-		//close filestream
-		log.close();
+		for (; i < n && (reinterpret_cast<size_t>(out + i) & 15) != 0; ++i)
+			out[i] = row[i];
+		for (; i + 4 <= n; i += 4)
+			_mm_stream_ps(out + i, _mm_loadu_ps(row + i));
 	}
-	//catch error message
-	catch (const char &e)
+#endif
+	for (; i < n; ++i)
+		out[i] = row[i];
+}
+
+//Expand source rows [first, last) into the output
+//each tile row is expanded once into a small buffer that is then copied to the zoom output rows it covers
+static void zoomBand(const Image &img, Image &output, int zoom, unsigned int first, unsigned int last, std::vector<Image::Rgb> &expanded, bool streaming)
+{
+	unsigned int w = img.getWidth();
+	size_t newWidth = output.getWidth();
+
+	//tiles from left to right so the source tile stays in the cache while its rows are expanded
+	for (unsigned int left = 0; left < w; left += kZoomTileColumns)
 	{
-		//display error message
-		std::cout << e << std::endl;
-		//close filetream
-		log.close();
+		unsigned int columns = std::min(kZoomTileColumns, w - left);
+		for (unsigned int y = first; y < last; ++y)
+		{
+			//repeat each source pixel zoom times
+			const Image::Rgb *source = img.getPixels() + (size_t)y * w + left;
+			Image::Rgb *e = expanded.data();
+			for (unsigned int x = 0; x < columns; ++x)
+			{
+				for (int k = 0; k < zoom; ++k)
+					*e++ = source[x];
+			}
+
+			//repeat the expanded row zoom times
+			for (int k = 0; k < zoom; ++k)
+			{
+				Image::Rgb *out = output.getPixels() + ((size_t)y * zoom + k) * newWidth + (size_t)left * zoom;
+				storeRow(reinterpret_cast<float *>(out), reinterpret_cast<const float *>(expanded.data()), (size_t)columns * zoom * 3, streaming);
+			}
+		}
 	}
 }
 
@@ -77,53 +113,360 @@ void ImageZoom::log()
 Nearest neighbour zoom algorithm adapted for use from:
 http://tech-algorithm.com/articles/nearest-neighbor-image-scaling/
 ***************************************************/
-//since only zooming by x2 and x4, we wont run into the rounding errors described on the site
-void nearestNeigbourZoom(Image* img, int zoom)
+//for a whole zoom every source pixel becomes a zoom x zoom block, so the source coordinate is just the output coordinate / zoom
+//the output is split into bands of source rows handed out to threads, and each band is expanded a cache sized tile at a time
+//returns the zoomed image in memory so that the caller decides where it is written
+Image zoomNearestNeighbour(Image* img, int zoom, ProgressToken *progress, unsigned int threads)
 {
-	//alert user that zoom algorithm is being used
-	std::cout << "\nUsing nearest neigbour zoom algorithm to scale image " << zoom << "x..." << std::endl;
-
-	//calculate new width and height according to zoom level and store as ints
-	int newWidth = img->getWidth() * zoom;
-	int newHeight = img->getHeight() * zoom;
+	//calculate new width and height according to zoom level in 64 bits so they can be checked before use
+	unsigned long long newWidth = (unsigned long long)img->getWidth() * zoom;
+	unsigned long long newHeight = (unsigned long long)img->getHeight() * zoom;
+	size_t newSize;
+	//dimensions are held as unsigned ints and the pixel array has to be addressable
+	if (zoom <= 0 || newWidth > 0xFFFFFFFFull || newHeight > 0xFFFFFFFFull || !pixelCount(newWidth, newHeight, newSize))
+	{
+		fprintf(stderr, "Can't zoom a %ux%u image by %d\n", img->getWidth(), img->getHeight(), zoom);
+		return Image();
+	}
+	PERF_STAGE("nearest neighbour zoom", (img->getSize() + newSize) * sizeof(Image::Rgb));
 
 	//create temp output Image with the new image size
-	Image output(newWidth, newHeight);
+	Image output((unsigned int)newWidth, (unsigned int)newHeight);
 	//Set bit depth of output image to to the same value as the image being zoomed
 	output.setBitDepth(img->getBitDepth());
 
-	//calculate the multiplier to reach new width from old width
-	//2x = 0.5		4x = 0.25
-	float xRatio = img->getWidth() / (float)newWidth;
-	//calculate the multiplier to reach new height from old height
-	float yRatio = img->getHeight() / (float)newHeight;
-	//float variables to store coordinates of original image
-	float px, py;
+	unsigned int h = img->getHeight();
+	unsigned int bands = (h + kZoomBandRows - 1) / kZoomBandRows;
+	bool streaming = (unsigned long long)output.getSize() * sizeof(Image::Rgb) > kStreamingBytes;
 
-	//loop through the theoretical height of the image
-	for (int i = 0; i < newHeight; i++)
+	//one step of progress per output row
+	if (progress != nullptr)
+		progress->addWork(newHeight);
+
+	//small images aren't worth starting threads for
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	if (!streaming)
+		threads = 1;
+	threads = std::min(threads, std::max(1u, bands));
+
+	//each thread takes the next band until there are none left or the zoom is cancelled
+	std::atomic<unsigned int> nextBand(0);
+	std::atomic<bool> cancelled(false);
+	auto work = [&]()
 	{
-		//loop through theoretical width of the image
-		for (int j = 0; j < newWidth; j++)
+		std::vector<Image::Rgb> expanded((size_t)kZoomTileColumns * zoom);
+		unsigned int band;
+		while (!cancelled && (band = nextBand++) < bands)
 		{
-			//calculate coordinates for original pixel image width 
-			px = std::floor(j * xRatio);
-			//calculate coordinates for original pixel image height
-			py = std::floor(i * yRatio);
-
-			//assign colour values to pixels from input image to output pixel array
-			output[(int)(i * newWidth) + j] = (*img)[(int)((py * img->getWidth()) + px)];
+			unsigned int first = band * kZoomBandRows;
+			unsigned int last = std::min(h, first + kZoomBandRows);
+			zoomBand(*img, output, zoom, first, last, expanded, streaming);
 
-			/*the width value of the image is used to navigate down to the selected 'row' of an image where the
-			px value is added on to reach the desired pixel*/
+			//report the finished rows and stop if cancelled
+			if (progress != nullptr && !progress->advance((unsigned long long)(last - first) * zoom))
+				cancelled = true;
 		}
-	}
+#ifdef ZOOM_SSE
+		//make the non-temporal stores visible before the thread is joined
+		_mm_sfence();
+#endif
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads; ++i)
+		workers.push_back(std::thread(work));
+	work();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	if (cancelled)
+		return Image();
+
+	//return zoomed image
+	return output;
+}
+//nearest neighbour zoom written to a PPM file named "x<zoom> Zoom" unless a filename is given
+bool nearestNeigbourZoom(Image* img, int zoom, const char *output, ProgressToken *progress)
+{
+	//alert user that zoom algorithm is being used
+	std::cout << "\nUsing nearest neigbour zoom algorithm to scale image " << zoom << "x..." << std::endl;
 
 	//define a new string stream named filestream
 	std::stringstream filename;
-	//concatenate strings abd variables to form filename
-	filename << "x" << zoom << " Zoom.ppm";
+	//use the given filename or concatenate strings abd variables to form the default filename
+	if (output != nullptr)
+		filename << output;
+	else
+		filename << "x" << zoom << " Zoom.ppm";
+
+	Image zoomed = zoomNearestNeighbour(img, zoom, progress);
+	//nothing to write - the caller reports the cancellation
+	if (progress != nullptr && progress->isCancelled())
+		return false;
 
 	//write image to PPM file using filename converted to char array
-	writePPM(output, filename.str().c_str());
-}
\ No newline at end of file
+	return writePPM(zoomed, filename.str().c_str());
+}
+//***Area Downscaling***
+
+//source rows read from a file at a time when streaming
+static const unsigned int kDownscaleBandRows = 64;
+//output pixels below which threads cost more than they save
+static const unsigned int kMinThreadPixels = 16384;
+
+//Weights along one axis
+//positions are counted in 1/target of a source pixel so every overlap is a whole number and whole reductions get exact weights
+AreaDownscaler::Weights AreaDownscaler::areaWeights(unsigned int source, unsigned int target)
+{
+	Weights w;
+	for (unsigned int x = 0; x < target; ++x)
+	{
+		//output pixel x covers [start, end) of the source
+		unsigned long long start = (unsigned long long)x * source, end = start + source;
+		unsigned int first = (unsigned int)(start / target);
+		unsigned int last = (unsigned int)((end + target - 1) / target);
+
+		w.first.push_back(first);
+		w.count.push_back(last - first);
+		w.offset.push_back((unsigned int)w.weights.size());
+		for (unsigned int i = first; i < last; ++i)
+		{
+			unsigned long long overlap = std::min(end, (unsigned long long)(i + 1) * target) - std::max(start, (unsigned long long)i * target);
+			w.weights.push_back((float)overlap / source);
+		}
+	}
+	return w;
+}
+
+//constructor
+//output size must be no bigger than the source
+AreaDownscaler::AreaDownscaler(unsigned int w, unsigned int h, unsigned int newWidth, unsigned int newHeight, unsigned int t) :
+	sourceWidth(w),
+	sourceHeight(h),
+	threads(t != 0 ? t : std::max(1u, std::thread::hardware_concurrency())),
+	columns(areaWeights(w, newWidth)),
+	rows(areaWeights(h, newHeight)),
+	output(newWidth, newHeight),
+	nextSourceRow(0),
+	nextOutputRow(0),
+	keptFirst(0)
+{
+	//averages of 8 bit samples can still be written as 8 bit samples
+	output.setBitDepth(255);
+}
+
+//set sum to weight * row
+static void setRow(float *sum, const float *row, float weight, size_t n)
+{
+	size_t i = 0;
+#ifdef ZOOM_SSE
+	__m128 w = _mm_set1_ps(weight);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(sum + i, _mm_mul_ps(_mm_loadu_ps(row + i), w));
+#endif
+	for (; i < n; ++i)
+		sum[i] = row[i] * weight;
+}
+
+//accumulate weight * row into sum
+static void addRow(float *sum, const float *row, float weight, size_t n)
+{
+	size_t i = 0;
+#ifdef ZOOM_SSE
+	__m128 w = _mm_set1_ps(weight);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+#endif
+	for (; i < n; ++i)
+		sum[i] += row[i] * weight;
+}
+
+//Reduce output rows [first, last), stopping early if progress is cancelled
+//source row y is at sourceRows[y - base]
+void AreaDownscaler::reduceRows(const std::vector<const Image::Rgb*> &sourceRows, unsigned int base, unsigned int first, unsigned int last, ProgressToken *progress)
+{
+	//one spare float so the last pixel can be loaded as 4 floats
+	size_t floats = (size_t)sourceWidth * 3;
+	std::vector<float> sum(floats + 1);
+
+	for (unsigned int y = first; y < last; ++y)
+	{
+		//vertical pass - weighted sum of the source rows under this output row
+		const float *weight = rows.weights.data() + rows.offset[y];
+		setRow(sum.data(), reinterpret_cast<const float *>(sourceRows[rows.first[y] - base]), weight[0], floats);
+		for (unsigned int k = 1; k < rows.count[y]; ++k)
+			addRow(sum.data(), reinterpret_cast<const float *>(sourceRows[rows.first[y] + k - base]), weight[k], floats);
+
+		//horizontal pass - weighted sum of the pixels under each output pixel
+		Image::Rgb *out = output.getPixels() + (size_t)y * output.getWidth();
+		for (unsigned int x = 0; x < output.getWidth(); ++x)
+		{
+			const float *pixel = sum.data() + (size_t)columns.first[x] * 3;
+			const float *weight = columns.weights.data() + columns.offset[x];
+#ifdef ZOOM_SSE
+			//r, g, b and one unused float per pixel
+			__m128 total = _mm_setzero_ps();
+			for (unsigned int k = 0; k < columns.count[x]; ++k, pixel += 3)
+				total = _mm_add_ps(total, _mm_mul_ps(_mm_loadu_ps(pixel), _mm_set1_ps(weight[k])));
+			float rgb[4];
+			_mm_storeu_ps(rgb, total);
+			out[x] = Image::Rgb(rgb[0], rgb[1], rgb[2]);
+#else
+			Image::Rgb total(0);
+			for (unsigned int k = 0; k < columns.count[x]; ++k, pixel += 3)
+				total += Image::Rgb(pixel[0] * weight[k], pixel[1] * weight[k], pixel[2] * weight[k]);
+			out[x] = total;
+#endif
+		}
+
+		//report each finished row and stop if cancelled
+		if (progress != nullptr && !progress->advance())
+			return;
+	}
+}
+
+//Take the next band of source rows and write every output row it completes
+//returns false without taking the band if it doesn't fit, or once progress is cancelled, after which the output is incomplete
+bool AreaDownscaler::addRows(const Image &band, ProgressToken *progress)
+{
+	if (band.getWidth() != sourceWidth || nextSourceRow + band.getHeight() > sourceHeight || (progress != nullptr && progress->isCancelled()))
+		return false;
+	PERF_STAGE("area downscale", band.getSize() * sizeof(Image::Rgb));
+
+	//rows kept from earlier bands followed by the new band
+	unsigned int keptRows = (unsigned int)(kept.size() / sourceWidth);
+	std::vector<const Image::Rgb*> sourceRows;
+	for (unsigned int y = 0; y < keptRows; ++y)
+		sourceRows.push_back(kept.data() + (size_t)y * sourceWidth);
+	for (unsigned int y = 0; y < band.getHeight(); ++y)
+		sourceRows.push_back(band.getPixels() + (size_t)y * sourceWidth);
+	nextSourceRow += band.getHeight();
+
+	//output rows whose source rows have all arrived
+	unsigned int ready = nextOutputRow;
+	while (ready < output.getHeight() && rows.first[ready] + rows.count[ready] <= nextSourceRow)
+		++ready;
+
+	//share the ready rows between threads, if there are enough of them
+	unsigned int count = ready - nextOutputRow;
+	unsigned int t = std::min(threads, std::max(1u, (unsigned int)((unsigned long long)count * output.getWidth() / kMinThreadPixels)));
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < t; ++i)
+		workers.push_back(std::thread(&AreaDownscaler::reduceRows, this, std::cref(sourceRows), keptFirst, nextOutputRow + count * i / t, nextOutputRow + count * (i + 1) / t, progress));
+	reduceRows(sourceRows, keptFirst, nextOutputRow, nextOutputRow + count / t, progress);
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	if (progress != nullptr && progress->isCancelled())
+		return false;
+	nextOutputRow = ready;
+
+	//keep the source rows the next output row still needs
+	unsigned int needed = nextOutputRow < output.getHeight() ? rows.first[nextOutputRow] : nextSourceRow;
+	std::vector<Image::Rgb> stillNeeded;
+	for (unsigned int y = needed; y < nextSourceRow; ++y)
+		stillNeeded.insert(stillNeeded.end(), sourceRows[y - keptFirst], sourceRows[y - keptFirst] + sourceWidth);
+	kept.swap(stillNeeded);
+	keptFirst = needed;
+
+	return true;
+}
+
+//true once every output row has been written
+bool AreaDownscaler::isComplete() const
+{
+	return nextOutputRow == output.getHeight();
+}
+
+const Image& AreaDownscaler::getOutput() const
+{
+	return output;
+}
+
+//area averaging downscale of a whole image
+//returns an empty image if the new size is bigger than the image or 0
+Image downscaleArea(const Image &img, unsigned int newWidth, unsigned int newHeight, unsigned int threads, ProgressToken *progress)
+{
+	if (newWidth == 0 || newHeight == 0 || newWidth > img.getWidth() || newHeight > img.getHeight())
+	{
+		fprintf(stderr, "Can't downscale a %ux%u image to %ux%u\n", img.getWidth(), img.getHeight(), newWidth, newHeight);
+		return Image();
+	}
+
+	//one step of progress per output row
+	if (progress != nullptr)
+		progress->addWork(newHeight);
+
+	//the whole image is one band so nothing is copied
+	AreaDownscaler downscaler(img.getWidth(), img.getHeight(), newWidth, newHeight, threads);
+	if (!downscaler.addRows(img, progress))
+		return Image();
+
+	Image output = downscaler.getOutput();
+	output.setBitDepth(img.getBitDepth());
+	return output;
+}
+
+//height that keeps the aspect ratio at a new width
+static unsigned int scaledHeight(unsigned int w, unsigned int h, unsigned int newWidth)
+{
+	return std::max(1u, (unsigned int)(((unsigned long long)h * newWidth + w / 2) / w));
+}
+
+//area averaging downscale written to a PPM file named "<width>x<height> Downscale" unless a filename is given
+bool areaDownscaling(Image* img, unsigned int newWidth, const char *output)
+{
+	unsigned int newHeight = scaledHeight(img->getWidth(), img->getHeight(), newWidth);
+
+	//alert user that downscaling is being used
+	std::cout << "\nUsing area averaging to downscale image to " << newWidth << "x" << newHeight << "..." << std::endl;
+
+	std::stringstream filename;
+	if (output != nullptr)
+		filename << output;
+	else
+		filename << newWidth << "x" << newHeight << " Downscale.ppm";
+
+	return writeImage(downscaleArea(*img, newWidth, newHeight), filename.str().c_str());
+}
+
+//Downscale a file to a new width keeping the aspect ratio
+//ppm and tiled inputs are read a band of rows at a time so the whole frame is never decoded at once
+bool downscaleFile(const char *input, const char *output, unsigned int newWidth, ProgressToken *progress)
+{
+	std::string name = input;
+	bool tiled = name.size() > 4 && name.compare(name.size() - 4, 4, ".tim") == 0;
+	bool pfm = name.size() > 4 && name.compare(name.size() - 4, 4, ".pfm") == 0;
+
+	//float maps are read whole
+	if (pfm)
+	{
+		Image img = readPFM(input);
+		if (img.getSize() == 0 || newWidth > img.getWidth())
+			return false;
+		Image downscaled = downscaleArea(img, newWidth, scaledHeight(img.getWidth(), img.getHeight(), newWidth), 0, progress);
+		return downscaled.getSize() != 0 && writeImage(downscaled, output);
+	}
+
+	unsigned int w, h, b;
+	if (!(tiled ? readTiledSize(input, w, h, b) : readPPMSize(input, w, h, b)) || newWidth == 0 || newWidth > w)
+	{
+		fprintf(stderr, "Can't downscale %s to %u pixels wide\n", input, newWidth);
+		return false;
+	}
+
+	unsigned int newHeight = scaledHeight(w, h, newWidth);
+	if (progress != nullptr)
+		progress->addWork(newHeight);
+
+	AreaDownscaler downscaler(w, h, newWidth, newHeight);
+	for (unsigned int first = 0; first < h; first += kDownscaleBandRows)
+	{
+		unsigned int count = std::min(kDownscaleBandRows, h - first);
+		Image band = tiled ? readTiledRows(input, first, count) : readPPMRows(input, first, count);
+		if (band.getSize() == 0 || !downscaler.addRows(band, progress))
+			return false;
+	}
+
+	return downscaler.isComplete() && writeImage(downscaler.getOutput(), output);
+}
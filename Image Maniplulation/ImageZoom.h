@@ -1,5 +1,6 @@
 #pragma once
 #include "Image.h"
+#include <vector> //hold weights and buffered rows
 
 class ImageZoom : public Image
 {
@@ -19,4 +20,58 @@ public:
 	virtual void log();
 };
 
-void nearestNeigbourZoom(Image*, int);
\ No newline at end of file
+//zoom returns the result in memory, nearestNeigbourZoom writes it to a file
+//an optional progress token is advanced after each band of output rows and stops the zoom when cancelled, in which case an empty image is returned
+Image zoomNearestNeighbour(Image*, int, ProgressToken* = nullptr, unsigned int = 0); //threads, 0 = one per hardware thread
+bool nearestNeigbourZoom(Image*, int, const char* = nullptr, ProgressToken* = nullptr);
+
+//Area averaging downscaler fed one band of rows at a time
+//Each output pixel is the average of the source area it covers, weighted by how much of each source pixel falls inside it,
+//so any reduction works, whole or fractional. Rows are reduced vertically then horizontally with SSE where available
+//and output rows are shared between threads. Only the source rows still needed by the next output row are kept between bands
+//An optional progress token is advanced after each output row and stops the band when cancelled - the caller adds the output height to its work
+class AreaDownscaler
+{
+public:
+	//AreaDownscaler constructors
+	AreaDownscaler(unsigned int, unsigned int, unsigned int, unsigned int, unsigned int = 0); //source size, output size, threads (0 = one per hardware thread)
+	AreaDownscaler(const AreaDownscaler &) = delete;
+
+	//AreaDownscaler operator overloads
+	AreaDownscaler& operator=(const AreaDownscaler &) = delete;
+
+	//AreaDownscaler member functions
+	bool addRows(const Image &, ProgressToken* = nullptr); //next band of source rows, returns false if it doesn't fit or is cancelled
+	bool isComplete() const;
+
+	//Getter functions
+	const Image& getOutput() const;
+
+private:
+	//Source pixels covered by each output pixel along one axis
+	struct Weights
+	{
+		std::vector<unsigned int> first; //first source pixel of each output pixel
+		std::vector<unsigned int> count; //number of source pixels
+		std::vector<unsigned int> offset; //where each output pixel's weights start
+		std::vector<float> weights; //share of the output pixel covered by each source pixel
+	};
+
+	static Weights areaWeights(unsigned int, unsigned int);
+	void reduceRows(const std::vector<const Image::Rgb*> &, unsigned int, unsigned int, unsigned int, ProgressToken*);
+
+	unsigned int sourceWidth, sourceHeight; //size of the image being reduced
+	unsigned int threads; //threads sharing output rows
+	Weights columns, rows; //horizontal and vertical weights
+	Image output; //reduced image
+	unsigned int nextSourceRow; //first source row not received yet
+	unsigned int nextOutputRow; //first output row not written yet
+	std::vector<Image::Rgb> kept; //source rows received but still needed
+	unsigned int keptFirst; //source row held at the start of kept
+};
+
+//area averaging returns the result in memory, areaDownscaling writes it to a file
+//an optional progress token is advanced after each output row and stops the downscale when cancelled, in which case an empty image is returned
+Image downscaleArea(const Image &, unsigned int, unsigned int, unsigned int = 0, ProgressToken* = nullptr); //new width and height, threads
+bool areaDownscaling(Image*, unsigned int, const char* = nullptr); //new width - height keeps the aspect ratio
+bool downscaleFile(const char*, const char*, unsigned int, ProgressToken* = nullptr); //streams a ppm or tiled file a band of rows at a time
@@ -0,0 +1,244 @@
+#include "Logging.h"
+#include <fstream> //append to log files
+#include <sstream> //build filenames
+#include <iomanip> //output times
+#include <iostream> //alert user to errors
+#include <chrono> //batch interval and record times
+#include <algorithm> //cut long filenames short
+#include <string> //log filenames
+#include <cstring> //copy filenames into records
+
+//the writer wakes at least this often, and straight away once a quarter of the buffer is full
+static const std::chrono::milliseconds kLogInterval(100);
+
+//***Log Queue***
+
+//constructor
+//allocates the slots and starts the writer thread
+LogQueue::LogQueue(unsigned int count) :
+	head(0),
+	tail(0),
+	written(0),
+	stopping(false)
+{
+	//a power of 2 so a position maps to its slot with a mask
+	unsigned long long size = 2;
+	while (size < count)
+		size *= 2;
+	slots = std::vector<Slot>((size_t)size);
+	mask = size - 1;
+	//slot i is free for the push at position i
+	for (size_t i = 0; i < slots.size(); ++i)
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+
+	writer = std::thread(&LogQueue::write, this);
+}
+
+//destructor
+//lets the writer empty the buffer and then joins it
+LogQueue::~LogQueue()
+{
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	writer.join();
+}
+
+//Copy a record into the next free slot
+//pushing threads only touch the head counter and their own slot, so they never wait for each other or for the disk
+//if the writer has fallen a whole buffer behind the pushing thread waits for a slot rather than lose the record
+void LogQueue::push(const LogRecord &record)
+{
+	unsigned long long position = head.load(std::memory_order_relaxed);
+	while (true)
+	{
+		Slot &slot = slots[(size_t)(position & mask)];
+		unsigned long long sequence = slot.sequence.load(std::memory_order_acquire);
+		if (sequence == position)
+		{
+			//free - claim it unless another thread got there first, which reloads position
+			if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				slot.record = record;
+				//publish to the writer
+				slot.sequence.store(position + 1, std::memory_order_release);
+				break;
+			}
+		}
+		else if (sequence < position)
+		{
+			//full - still holds the record from a lap ago
+			wake.notify_one();
+			std::this_thread::yield();
+			position = head.load(std::memory_order_relaxed);
+		}
+		else
+			//another thread claimed it
+			position = head.load(std::memory_order_relaxed);
+	}
+
+	//no lock taken, a missed wake up is caught by the interval
+	if (((position + 1) & (mask >> 2)) == 0)
+		wake.notify_one();
+}
+
+//Take the oldest published record
+//returns false if there isn't one
+bool LogQueue::pop(LogRecord &record)
+{
+	Slot &slot = slots[(size_t)(tail & mask)];
+	if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+		return false;
+	record = slot.record;
+	//free for the push a lap later
+	slot.sequence.store(tail + mask + 1, std::memory_order_release);
+	++tail;
+	return true;
+}
+
+//Wait until every record pushed before the call has been written
+void LogQueue::flush()
+{
+	unsigned long long target = head.load();
+	std::unique_lock<std::mutex> lock(wakeMutex);
+	wake.notify_one();
+	done.wait(lock, [&]() { return written.load() >= target; });
+}
+
+//the queue is created on first use and destroyed, writing what is left, when the program exits
+LogQueue& LogQueue::instance()
+{
+	static LogQueue queue;
+	return queue;
+}
+
+//Log file a record belongs in
+static std::string logFilename(const LogRecord &record)
+{
+	std::tm day = {};
+	localTime(record.logged, day);
+	//format: YYYY-MM-DD
+	std::stringstream filename;
+	filename << (record.kind == kZoomLog ? "Logs/zoom-" : "Logs/image-") << std::put_time(&day, "%F") << ".txt";
+	return filename.str();
+}
+
+//Format a record as it appears in the log
+static void formatRecord(const LogRecord &record, std::ostream &os)
+{
+	std::tm read = {};
+	localTime(record.readTime, read);
+	//time format eg. Mon 4 Dec 2017 HH:MM:SS Timezone
+	os << "Filename: " << record.name << "\nDate read: " << std::put_time(&read, "%a %d %b %Y %T %Z") << "\nDimensions: " << record.width << " x " << record.height
+		<< "\nBit depth: " << record.bitDepth << "\nRead time: " << record.timeToRead << "ms";
+	if (record.kind == kZoomLog)
+		os << "\nZoom level: " << record.zoom << "x";
+	os << "\n\n";
+}
+
+//Writer loop - sleep until there are records, then format and append everything queued as one batch
+//each kind of log stays open until its day's filename changes
+void LogQueue::write()
+{
+	std::string filenames[2];
+	std::ofstream files[2];
+	std::stringstream batches[2];
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wake.wait_for(lock, kLogInterval);
+		}
+		//read before popping so nothing pushed before stopping is left behind
+		bool last = stopping.load();
+
+		//append a kind's batch to its file, opening it if needed
+		auto append = [&](int k)
+		{
+			std::string batch = batches[k].str();
+			if (batch.empty())
+				return;
+			batches[k].str("");
+			if (!files[k].is_open())
+				files[k].open(filenames[k].c_str(), std::ios::app);
+			files[k] << batch << std::flush;
+			if (files[k].fail())
+			{
+				//display error message and try opening it again next batch
+				std::cerr << (k == kZoomLog ? "Error during log generation for image zoom operation." : "Error during log generation for image blend operation.") << std::endl;
+				files[k].close();
+				files[k].clear();
+			}
+		};
+
+		LogRecord record;
+		unsigned long long count = 0;
+		while (pop(record))
+		{
+			std::string filename = logFilename(record);
+			if (filename != filenames[record.kind])
+			{
+				//the day changed - finish the old file before switching
+				append(record.kind);
+				files[record.kind].close();
+				filenames[record.kind] = filename;
+			}
+			formatRecord(record, batches[record.kind]);
+			++count;
+		}
+		append(kImageLog);
+		append(kZoomLog);
+
+		if (count != 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(wakeMutex);
+				written += count;
+			}
+			done.notify_all();
+		}
+		if (last)
+			return;
+	}
+}
+
+//***Logging Functions***
+
+//Copy the details of an image into a record and queue it
+//only the clock is read on the calling thread, formatting and writing happen on the writer thread
+void logImage(const Image &img, LogKind kind)
+{
+	LogRecord record;
+	record.kind = kind;
+	record.logged = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	std::string name = img.getName();
+	size_t length = std::min<size_t>(name.size(), kLogNameLength - 1);
+	memcpy(record.name, name.data(), length);
+	record.name[length] = '\0';
+	record.readTime = img.getReadTime();
+	record.width = img.getWidth();
+	record.height = img.getHeight();
+	record.bitDepth = img.getBitDepth();
+	record.timeToRead = img.getTimeToRead();
+	record.zoom = img.getZoom();
+	LogQueue::instance().push(record);
+}
+
+void flushLogs()
+{
+	LogQueue::instance().flush();
+}
+
+//Convert a time to local time in tm
+//std::localtime shares one result between every thread
+bool localTime(time_t time, std::tm &tm)
+{
+#ifdef _WIN32
+	return localtime_s(&tm, &time) == 0;
+#else
+	return localtime_r(&time, &tm) != nullptr;
+#endif
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "Image.h"
+#include <ctime> //time_t
+#include <vector> //ring buffer slots
+#include <atomic> //claim and publish slots without a lock
+#include <thread> //background writer
+#include <mutex> //sleep the writer and wait for flushes
+#include <condition_variable> //wake the writer and flushing threads
+
+//Asynchronous log of Images read and zoomed
+//Image::log and ImageZoom::log copy their details into a fixed size record and push it into a lock-free ring buffer,
+//which any number of threads can do at once without waiting on each other or on the disk
+//A background thread takes records out in batches, formats them and appends each batch to the day's log files,
+//keeping the files open between batches
+
+//log file a record goes to
+enum LogKind
+{
+	kImageLog, //Logs/image-YYYY-MM-DD.txt
+	kZoomLog //Logs/zoom-YYYY-MM-DD.txt
+};
+
+//longest filename kept in a record, longer names are cut short
+static const unsigned int kLogNameLength = 260;
+
+//Details of one Image, copied so the Image can be deleted straight after logging it
+struct LogRecord
+{
+	LogKind kind;
+	time_t logged; //when the record was made, picks the day's file
+	char name[kLogNameLength]; //filename of the image
+	time_t readTime; //when the image was read
+	unsigned int width, height, bitDepth;
+	int timeToRead; //ms
+	int zoom; //only written for kZoomLog
+};
+
+class LogQueue
+{
+public:
+	//LogQueue constructors
+	explicit LogQueue(unsigned int = 256); //slots, rounded up to a power of 2
+	LogQueue(const LogQueue &) = delete;
+
+	//LogQueue destructor - writes every record still queued
+	~LogQueue();
+
+	//LogQueue operator overloads
+	LogQueue& operator=(const LogQueue &) = delete;
+
+	//LogQueue member functions
+	void push(const LogRecord &); //safe to call from any thread
+	void flush(); //returns once every record pushed so far is written
+
+	//the queue used by Image::log and ImageZoom::log, started by the first record
+	static LogQueue& instance();
+
+private:
+	//slot of the ring buffer, sequence says whose turn it is to use it
+	struct Slot
+	{
+		std::atomic<unsigned long long> sequence;
+		LogRecord record;
+	};
+
+	bool pop(LogRecord &); //writer thread only
+	void write(); //loop run by the writer thread
+
+	std::vector<Slot> slots;
+	unsigned long long mask; //slots - 1
+	std::atomic<unsigned long long> head; //next slot to push into
+	unsigned long long tail; //next slot to pop, writer thread only
+	std::atomic<unsigned long long> written; //records written so far
+	std::atomic<bool> stopping; //set when the queue is destroyed
+	std::mutex wakeMutex; //only held to sleep and wake
+	std::condition_variable wake; //new records, a flush or stopping
+	std::condition_variable done; //a batch was written
+	std::thread writer;
+};
+
+//Logging Functions
+
+void logImage(const Image &, LogKind); //queue a record of the image
+void flushLogs(); //returns once every queued record is written
+bool localTime(time_t, std::tm &); //thread safe std::localtime
@@ -0,0 +1,264 @@
+#include "PPMWriter.h"
+#include "PerfCounters.h"
+#include <cstdio> //report errors and remove the temporary file
+#include <cstring> //copy into the mapping
+#include <vector> //bytes of a band written without a mapping
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h> //replace the final file when committing
+#else
+#include <fcntl.h> //open and allocate the file
+#include <cerrno> //filesystems that can't allocate
+#include <unistd.h> //positioned writes, size and close the file
+#include <sys/mman.h> //map the file
+#endif
+
+//PPMWriter constructors
+
+//Create the temporary file at its full size with the header written, mapped unless map is false
+//check isOpen() before writing
+PPMWriter::PPMWriter(const std::string &file, unsigned int width, unsigned int height, bool map) :
+	filename(file),
+	temporary(file + ".partial"),
+	w(width),
+	h(height),
+	open(false),
+	committed(false),
+	failed(false),
+	mapping(nullptr)
+#ifndef _WIN32
+	, fd(-1)
+#endif
+{
+	std::string header = ppmHeader(w, h);
+	headerSize = header.size();
+	fileSize = headerSize + (unsigned long long)w * h * 3;
+
+	try
+	{
+		if (w == 0 || h == 0)
+			throw("Can't write an empty ppm file");
+#ifdef _WIN32
+		(void)map;
+		stream.open(temporary.c_str(), std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+		if (stream.fail())
+			throw("Can't open output file");
+		stream << header;
+
+		//writing the last byte makes the file its full size
+		stream.seekp((std::streamoff)fileSize - 1);
+		stream.put(0);
+		if (stream.fail())
+			throw("Can't allocate the output file");
+#else
+		fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			throw("Can't open output file");
+
+		//allocating the blocks up front fails now rather than part way through if the disk is full
+		//filesystems without fallocate still get a sparse file of the full size, any other failure is a real one
+		//a full disk under a sparse mapping is a SIGBUS rather than an error, so sparse files are written with positioned writes
+#ifdef __linux__
+		int error = posix_fallocate(fd, 0, (off_t)fileSize);
+		if (error == EOPNOTSUPP || error == EINVAL)
+		{
+			map = false;
+			error = ftruncate(fd, (off_t)fileSize);
+		}
+		if (error != 0)
+#else
+		map = false;
+		if (ftruncate(fd, (off_t)fileSize) != 0)
+#endif
+			throw("Can't allocate the output file");
+
+		if (map)
+		{
+			void *address = mmap(nullptr, (size_t)fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			//some filesystems can't be mapped, positioned writes work everywhere
+			if (address != MAP_FAILED)
+				mapping = static_cast<unsigned char *>(address);
+		}
+
+		if (mapping != nullptr)
+			memcpy(mapping, header.data(), header.size());
+		else if (pwrite(fd, header.data(), header.size(), 0) != (ssize_t)header.size())
+			throw("Can't write output file");
+#endif
+		open = true;
+	}
+	catch (const char *err)
+	{
+		fprintf(stderr, "%s\n", err);
+		close();
+		std::remove(temporary.c_str());
+	}
+}
+
+//PPMWriter destructor
+
+PPMWriter::~PPMWriter()
+{
+	if (!committed)
+	{
+		close();
+		std::remove(temporary.c_str());
+	}
+}
+
+//PPMWriter member functions
+
+//Write a band of rows at the position of first
+//bands may be written in any order and by several threads at once as long as they don't overlap
+//returns true if the band was written
+bool PPMWriter::writeRows(const Image &band, unsigned int first)
+{
+	if (!fits(band.getWidth(), first, band.getHeight()))
+		return false;
+
+	PERF_STAGE("ppm writer", band.getSize() * 3);
+	unsigned long long offset = headerSize + (unsigned long long)first * w * 3;
+
+	//converted straight into its place in the file
+	if (mapping != nullptr)
+	{
+		toBytes(band.getPixels(), band.getSize(), mapping + offset);
+		return true;
+	}
+
+	std::vector<unsigned char> bytes;
+	toBytes(band, bytes);
+	return writeBytes(bytes.data(), bytes.size(), offset);
+}
+
+//Write rows that are already 8 bit samples, eg. read from another ppm file with readPPMBytes
+//returns true if the rows were written
+bool PPMWriter::writeRows(const unsigned char *bytes, unsigned int first, unsigned int rows)
+{
+	if (!fits(w, first, rows))
+		return false;
+	return writeBytes(bytes, (size_t)w * rows * 3, headerSize + (unsigned long long)first * w * 3);
+}
+
+//Check rows of width can be written at first, remembering the failure if they can't
+bool PPMWriter::fits(unsigned int width, unsigned int first, unsigned int rows)
+{
+	if (!open || committed)
+		return false;
+	if (width != w || first >= h || rows > h - first)
+	{
+		fprintf(stderr, "Band doesn't fit in the output file\n");
+		failed = true;
+		return false;
+	}
+	return true;
+}
+
+//Copy count bytes to offset in the file
+bool PPMWriter::writeBytes(const unsigned char *bytes, size_t count, unsigned long long offset)
+{
+	if (mapping != nullptr)
+	{
+		memcpy(mapping + offset, bytes, count);
+		return true;
+	}
+
+#ifdef _WIN32
+	std::lock_guard<std::mutex> lock(streamMutex);
+	stream.seekp((std::streamoff)offset);
+	stream.write(reinterpret_cast<const char *>(bytes), count);
+	bool written = !stream.fail();
+#else
+	//pwrite doesn't move a shared file position, so threads don't need a lock
+	bool written = true;
+	for (size_t done = 0; written && done < count;)
+	{
+		ssize_t n = pwrite(fd, bytes + done, count - done, (off_t)(offset + done));
+		written = n > 0;
+		if (written)
+			done += (size_t)n;
+	}
+#endif
+	if (!written)
+	{
+		fprintf(stderr, "Can't write output file\n");
+		failed = true;
+	}
+	return written;
+}
+
+//Flush the file and rename it to its final name, replacing any file already there
+//call once every band has been written, after which no more bands can be written
+//returns false, and removes the temporary file, if any band failed
+bool PPMWriter::commit()
+{
+	if (!open || committed)
+		return false;
+
+	//the rows have to be on disk before the rename, otherwise a crash can leave the final name on a file of zeros
+	bool ok = !failed;
+#ifdef _WIN32
+	stream.flush();
+	ok = ok && !stream.fail();
+	close();
+	if (ok)
+	{
+		HANDLE file = CreateFileA(temporary.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		ok = file != INVALID_HANDLE_VALUE && FlushFileBuffers(file) != 0;
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+	}
+#else
+	if (mapping != nullptr)
+		ok = ok && msync(mapping, (size_t)fileSize, MS_SYNC) == 0;
+	ok = ok && fsync(fd) == 0;
+	close();
+#endif
+
+	if (ok)
+	{
+#ifdef _WIN32
+		ok = MoveFileExA(temporary.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		ok = std::rename(temporary.c_str(), filename.c_str()) == 0;
+#endif
+	}
+	if (!ok)
+	{
+		fprintf(stderr, "Can't write output file\n");
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	committed = true;
+	return true;
+}
+
+//Unmap and close the temporary file
+void PPMWriter::close()
+{
+	open = false;
+#ifdef _WIN32
+	if (stream.is_open())
+		stream.close();
+#else
+	if (mapping != nullptr)
+		munmap(mapping, (size_t)fileSize);
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+#endif
+	mapping = nullptr;
+}
+
+//Getter functions
+
+bool PPMWriter::isOpen() const
+{
+	return open;
+}
+
+bool PPMWriter::isMapped() const
+{
+	return mapping != nullptr;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "Image.h"
+#include <string> //hold filenames
+#include <mutex> //share the plain file stream between threads
+#include <atomic> //remember a failed write from any thread
+#include <fstream> //plain writes where files can't be mapped
+
+//Binary ppm file written a band of rows at a time, by any number of threads in any row order
+//The payload size is known from the dimensions, so the file is created at its full size under a temporary name
+//and memory mapped, and each band is converted straight into its place in the mapping
+//Where the file can't be mapped or its blocks can't be reserved, mapping isn't wanted or on Windows, bands are written at their offsets with positioned writes instead
+//Nothing appears under the final name until commit() renames the finished file into place,
+//and a writer destroyed without committing removes its temporary file
+class PPMWriter
+{
+public:
+	//PPMWriter constructors
+	PPMWriter(const std::string &, unsigned int, unsigned int, bool = true); //filename, width, height, map the file
+	PPMWriter(const PPMWriter &) = delete;
+
+	//PPMWriter destructor - abandons the file unless it was committed
+	~PPMWriter();
+
+	//PPMWriter operator overloads
+	PPMWriter& operator=(const PPMWriter &) = delete;
+
+	//PPMWriter member functions
+	bool writeRows(const Image &, unsigned int); //band, first row - safe to call from several threads at once
+	bool writeRows(const unsigned char*, unsigned int, unsigned int); //8 bit samples already in file order, first row, rows
+	bool commit();
+
+	//Getter functions
+	bool isOpen() const;
+	bool isMapped() const;
+
+private:
+	bool fits(unsigned int, unsigned int, unsigned int); //width, first row, rows
+	bool writeBytes(const unsigned char*, size_t, unsigned long long); //bytes, count, file offset
+	void close();
+
+	std::string filename; //final name
+	std::string temporary; //name while it is written
+	unsigned int w, h; //image size
+	unsigned long long headerSize; //bytes before the first row
+	unsigned long long fileSize; //header and every row
+	bool open; //created at its full size
+	bool committed; //renamed into place
+	std::atomic<bool> failed; //a band couldn't be written
+	unsigned char *mapping; //the whole file, nullptr when writing without a mapping
+#ifdef _WIN32
+	std::fstream stream; //plain writes, files aren't mapped on Windows
+	std::mutex streamMutex; //one band at a time through the stream
+#else
+	int fd; //file descriptor
+#endif
+};
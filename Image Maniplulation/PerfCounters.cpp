@@ -0,0 +1,140 @@
+#include "PerfCounters.h"
+
+#if defined(IMAGE_PERF_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h> //counter types
+#include <sys/syscall.h> //perf_event_open has no libc wrapper
+#include <sys/ioctl.h> //enable and disable counters
+#include <unistd.h> //read and close counters
+#include <cstring> //clear counter attributes
+#include <cstdio> //write the report
+#include <chrono> //wall clock time of each stage
+#include <mutex> //stages finish on many threads
+#include <map> //totals by stage name
+#include <string> //stage names
+
+//events counted by every stage, in the order of PerfStage::counters
+static const unsigned long long kEvents[4] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+//Everything counted for one stage across every run
+struct PerfTotals
+{
+	PerfTotals() : runs(0), bytes(0), nanoseconds(0), available(true)
+	{
+		for (int i = 0; i < 4; ++i)
+			counts[i] = 0;
+	}
+
+	unsigned long long runs, bytes, nanoseconds;
+	unsigned long long counts[4];
+	bool available; //false if a counter couldn't be opened for any run
+};
+
+//Totals of every stage, written out when the program exits
+class PerfReport
+{
+public:
+	~PerfReport()
+	{
+		if (stages.empty())
+			return;
+
+		//per stage averages are less useful than totals - the report is for comparing stages and builds
+		fprintf(stderr, "\n%-24s %6s %10s %12s %12s %6s %12s %12s %11s\n", "Stage", "Runs", "ms", "Cycles", "Instructions", "IPC", "LLC misses", "Br misses", "Bytes/cycle");
+		for (std::map<std::string, PerfTotals>::const_iterator it = stages.begin(); it != stages.end(); ++it)
+		{
+			const PerfTotals &t = it->second;
+			fprintf(stderr, "%-24s %6llu %10.1f ", it->first.c_str(), t.runs, t.nanoseconds / 1e6);
+			if (!t.available || t.counts[0] == 0)
+			{
+				//usually /proc/sys/kernel/perf_event_paranoid or a virtual machine without a PMU
+				fprintf(stderr, "%12s\n", "counters unavailable");
+				continue;
+			}
+			fprintf(stderr, "%12llu %12llu %6.2f %12llu %12llu %11.3f\n", t.counts[0], t.counts[1], (double)t.counts[1] / t.counts[0],
+				t.counts[2], t.counts[3], (double)t.bytes / t.counts[0]);
+		}
+	}
+
+	void add(const char *name, unsigned long long bytes, unsigned long long nanoseconds, const unsigned long long *counts, bool available)
+	{
+		std::lock_guard<std::mutex> lock(reportMutex);
+		PerfTotals &t = stages[name];
+		++t.runs;
+		t.bytes += bytes;
+		t.nanoseconds += nanoseconds;
+		t.available = t.available && available;
+		for (int i = 0; i < 4; ++i)
+			t.counts[i] += counts[i];
+	}
+
+private:
+	std::map<std::string, PerfTotals> stages;
+	std::mutex reportMutex;
+};
+
+static PerfReport report;
+
+//Open a counter for the calling thread and the threads it starts from now on
+//user space only, which is all perf_event_paranoid allows by default
+static int openCounter(unsigned long long event)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = event;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static unsigned long long nowNanoseconds()
+{
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//***Perf Stage Class***
+
+//constructor
+//counters are opened per run so that threads started by the stage are counted and stages can run on any thread
+PerfStage::PerfStage(const char *n, unsigned long long b) :
+	name(n),
+	bytes(b)
+{
+	for (int i = 0; i < 4; ++i)
+		counters[i] = openCounter(kEvents[i]);
+	for (int i = 0; i < 4; ++i)
+	{
+		if (counters[i] >= 0)
+			ioctl(counters[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = nowNanoseconds();
+}
+
+//destructor
+//threads started by the stage have been joined by now, so their counts have been added to these counters
+PerfStage::~PerfStage()
+{
+	unsigned long long elapsed = nowNanoseconds() - start;
+	unsigned long long counts[4] = { 0, 0, 0, 0 };
+	bool available = true;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		if (counters[i] < 0)
+		{
+			available = false;
+			continue;
+		}
+		ioctl(counters[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counters[i], &counts[i], sizeof(counts[i])) != sizeof(counts[i]))
+			available = false;
+		close(counters[i]);
+	}
+
+	report.add(name, bytes, elapsed, counts, available);
+}
+
+#endif
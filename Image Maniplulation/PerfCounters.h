@@ -0,0 +1,42 @@
+#pragma once
+
+//Hardware performance counters around the hot stages
+//Build with IMAGE_PERF_COUNTERS defined on Linux, eg. g++ -DIMAGE_PERF_COUNTERS ..., and every PERF_STAGE counts
+//cycles, instructions, last level cache misses and branch misses from where it is declared to the end of its scope
+//Totals for each stage are written to stderr when the program exits, with instructions per cycle and bytes per cycle
+//so it can be seen whether a stage is limited by memory bandwidth, cache misses or branches
+//Without IMAGE_PERF_COUNTERS, or on other systems, PERF_STAGE compiles to nothing and its arguments aren't evaluated
+//Counters follow the calling thread and any threads it starts inside the stage
+#if defined(IMAGE_PERF_COUNTERS) && defined(__linux__)
+
+//Counts one run of a stage
+class PerfStage
+{
+public:
+	//PerfStage constructors - start counting
+	PerfStage(const char*, unsigned long long);
+	PerfStage(const PerfStage &) = delete;
+
+	//PerfStage destructor - stop counting and add to the totals of the stage
+	~PerfStage();
+
+	//PerfStage operator overloads
+	PerfStage& operator=(const PerfStage &) = delete;
+
+private:
+	const char *name; //stage name in the report
+	unsigned long long bytes; //bytes of pixels read and written by the stage
+	int counters[4]; //cycles, instructions, cache misses, branch misses - -1 if the counter can't be opened
+	unsigned long long start; //wall clock start in nanoseconds
+};
+
+//line number makes the name unique so that stages can be nested
+#define PERF_STAGE_NAME(line) perfStage##line
+#define PERF_STAGE_AT(line, name, bytes) PerfStage PERF_STAGE_NAME(line)(name, bytes)
+#define PERF_STAGE(name, bytes) PERF_STAGE_AT(__LINE__, name, bytes)
+
+#else
+
+#define PERF_STAGE(name, bytes) ((void)0)
+
+#endif
@@ -0,0 +1,111 @@
+#include "Progress.h"
+
+//***Progress Token Class***
+
+//constructor
+ProgressToken::ProgressToken() :
+	done(0),
+	total(0),
+	cancelled(false)
+{}
+
+//Add rows to the expected total
+//called by a kernel before it starts, so a token can follow several kernels in turn
+void ProgressToken::addWork(unsigned long long rows)
+{
+	total.fetch_add(rows, std::memory_order_relaxed);
+}
+
+//Count finished rows
+//returns false if the kernel should stop
+bool ProgressToken::advance(unsigned long long rows)
+{
+	done.fetch_add(rows, std::memory_order_relaxed);
+	return !cancelled.load(std::memory_order_relaxed);
+}
+
+//Ask the kernel to stop at its next row
+void ProgressToken::cancel()
+{
+	cancelled.store(true, std::memory_order_relaxed);
+}
+
+bool ProgressToken::isCancelled() const
+{
+	return cancelled.load(std::memory_order_relaxed);
+}
+unsigned long long ProgressToken::getDone() const
+{
+	return done.load(std::memory_order_relaxed);
+}
+unsigned long long ProgressToken::getTotal() const
+{
+	return total.load(std::memory_order_relaxed);
+}
+//0 until the kernel has added its work
+int ProgressToken::getPercent() const
+{
+	unsigned long long t = getTotal();
+	if (t == 0)
+		return 0;
+	//done can briefly pass total when it is read between the two loads
+	unsigned long long d = getDone();
+	return d >= t ? 100 : (int)(d * 100 / t);
+}
+
+//***Progress Monitor Class***
+
+//constructor
+//starts polling straight away
+ProgressMonitor::ProgressMonitor(const ProgressToken &t, std::ostream &out, unsigned int ms) :
+	token(t),
+	os(out),
+	interval(ms),
+	lastPercent(0),
+	stopping(false),
+	monitor(&ProgressMonitor::watch, this)
+{}
+
+//destructor
+//wakes and joins the monitor thread
+ProgressMonitor::~ProgressMonitor()
+{
+	{
+		std::lock_guard<std::mutex> lock(stopMutex);
+		stopping = true;
+	}
+	stopCondition.notify_one();
+	monitor.join();
+
+	//final value and end the line
+	report();
+	if (token.isCancelled())
+		os << " cancelled" << std::endl;
+	else if (lastPercent != 100)
+		os << std::endl;
+}
+
+//report, then sleep until the next interval or until stopped
+void ProgressMonitor::watch()
+{
+	std::unique_lock<std::mutex> lock(stopMutex);
+	while (!stopping)
+	{
+		report();
+		stopCondition.wait_for(lock, interval, [this]() { return stopping; });
+	}
+}
+
+//rewrite the current line with the percentage
+void ProgressMonitor::report()
+{
+	int percent = token.getPercent();
+	//nothing is written until the first percent is done, so messages written as the kernel starts aren't interrupted
+	if (percent == lastPercent)
+		return;
+	lastPercent = percent;
+	os << "\rProgress: " << percent << "%" << std::flush;
+	//end the line once the kernel is done so messages written afterwards start on their own line
+	if (percent == 100)
+		os << std::endl;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic> //counters shared between a kernel and a monitor
+#include <thread> //run the monitor
+#include <mutex> //wake the monitor when it is stopped
+#include <condition_variable> //sleep between reports
+#include <chrono> //poll interval
+#include <ostream> //write progress
+
+//Progress and cancellation shared between a running kernel and whoever is watching it
+//Kernels add the rows they will process to the total and advance the count after each row,
+//stopping at the next row once the token is cancelled
+//Counters are relaxed atomics so a row costs one uncontended add and one load, and cancel() is safe to call from a signal handler
+class ProgressToken
+{
+public:
+	//ProgressToken constructors
+	ProgressToken();
+	ProgressToken(const ProgressToken &) = delete;
+
+	//ProgressToken operator overloads
+	ProgressToken& operator=(const ProgressToken &) = delete;
+
+	//ProgressToken member functions
+	void addWork(unsigned long long);
+	bool advance(unsigned long long = 1); //returns false once cancelled
+	void cancel();
+
+	//Getter functions
+	bool isCancelled() const;
+	unsigned long long getDone() const;
+	unsigned long long getTotal() const;
+	int getPercent() const;
+
+private:
+	std::atomic<unsigned long long> done; //rows finished
+	std::atomic<unsigned long long> total; //rows expected
+	std::atomic<bool> cancelled; //set to stop the kernel
+};
+
+//Thread that polls a token and writes its percentage until the monitor is destroyed
+class ProgressMonitor
+{
+public:
+	//ProgressMonitor constructors
+	ProgressMonitor(const ProgressToken &, std::ostream &, unsigned int = 250); //poll interval in ms
+	ProgressMonitor(const ProgressMonitor &) = delete;
+
+	//ProgressMonitor destructor - stops polling and writes the final percentage
+	~ProgressMonitor();
+
+	//ProgressMonitor operator overloads
+	ProgressMonitor& operator=(const ProgressMonitor &) = delete;
+
+private:
+	void watch(); //loop run by the monitor thread
+	void report(); //write the current percentage
+
+	const ProgressToken &token; //token being watched
+	std::ostream &os; //where progress is written
+	std::chrono::milliseconds interval; //time between reports
+	int lastPercent; //last percentage written, so unchanged values aren't repeated
+	bool stopping; //set when the monitor is destroyed
+	std::mutex stopMutex; //guards stopping
+	std::condition_variable stopCondition; //wakes the monitor early when it is stopped
+	std::thread monitor; //started last, once everything above is set up
+};
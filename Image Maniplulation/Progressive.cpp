@@ -0,0 +1,197 @@
+#include "Progressive.h"
+#include "Progress.h"
+#include <iostream> //notify user of each pass
+#include <algorithm> //copy filled rows
+
+//Walks the pixels blended by one pass, row by row
+//pixels on the grid of spacing step are blended unless they are also on the grid of the previous pass
+class GridCursor
+{
+public:
+	GridCursor(unsigned int width, unsigned int height, unsigned int s, bool firstPass) :
+		w(width),
+		h(height),
+		step(s),
+		first(firstPass),
+		x(0),
+		y(0)
+	{}
+
+	//number of pixels the pass blends
+	size_t count() const
+	{
+		size_t pixels = (size_t)across(step) * across(step, h);
+		if (!first)
+			pixels -= (size_t)across(step * 2) * across(step * 2, h);
+		return pixels;
+	}
+
+	//index of the next pixel, false once the pass has none left
+	bool next(size_t &index)
+	{
+		while (y < h)
+		{
+			//rows on the previous grid already have every other pixel
+			bool oldRow = !first && y % (step * 2) == 0;
+			while (x < w)
+			{
+				unsigned int px = x;
+				x += oldRow ? step * 2 : step;
+				if (oldRow)
+					px += step;
+				if (px < w)
+				{
+					index = (size_t)y * w + px;
+					return true;
+				}
+			}
+			x = 0;
+			y += step;
+		}
+		return false;
+	}
+
+private:
+	//grid points along a length, w by default
+	unsigned int across(unsigned int spacing, unsigned int length = 0) const
+	{
+		if (length == 0)
+			length = w;
+		return (length + spacing - 1) / spacing;
+	}
+
+	unsigned int w, h; //image size
+	unsigned int step; //grid spacing of the pass
+	bool first; //the first pass blends every pixel on its grid
+	unsigned int x, y; //position of the next pixel to look at
+};
+
+//Fill every pixel off the grid of spacing step with the grid pixel above and to the left of it
+static void fillGaps(Image &img, unsigned int step)
+{
+	unsigned int w = img.getWidth();
+	Image::Rgb *pixels = img.getPixels();
+
+	for (unsigned int y = 0; y < img.getHeight(); ++y)
+	{
+		Image::Rgb *row = pixels + (size_t)y * w;
+		if (y % step == 0)
+		{
+			//grid row - repeat each grid pixel across its gap
+			for (unsigned int x = 0; x < w; ++x)
+			{
+				if (x % step != 0)
+					row[x] = row[x - x % step];
+			}
+		}
+		else
+		{
+			//between grid rows - copy the filled grid row above
+			const Image::Rgb *above = pixels + (size_t)(y - y % step) * w;
+			std::copy(above, above + w, row);
+		}
+	}
+}
+
+//Blend the images coarse to fine, passing a preview to preview after every pass but the last
+//coarsest is the grid spacing of the first pass, rounded down to a power of 2
+//returns the full blend, or an empty image if the blend fails, is cancelled or preview returns false
+Image progressiveBlend(std::vector<Image*> &images, BlendFunction blend, PreviewFunction preview, ProgressToken *progress, unsigned int coarsest)
+{
+	unsigned int w = images.at(0)->getWidth();
+	unsigned int h = images.at(0)->getHeight();
+
+	//spacing halves each pass so it has to be a power of 2
+	unsigned int spacing = 1;
+	while (spacing * 2 <= coarsest)
+		spacing *= 2;
+
+	//pixels are blended a row's worth at a time, one step of progress each
+	size_t chunk = w;
+	if (progress != nullptr)
+	{
+		unsigned long long chunks = 0;
+		for (unsigned int step = spacing; step > 0; step /= 2)
+			chunks += (GridCursor(w, h, step, step == spacing).count() + chunk - 1) / chunk;
+		progress->addWork(chunks);
+	}
+
+	Image output(w, h);
+	output.setBitDepth(images.at(0)->getBitDepth());
+
+	//the pixels of each frame that a chunk blends, packed into one row
+	std::vector<Image> packed(images.size(), Image((unsigned int)chunk, 1));
+	std::vector<Image*> frames;
+	for (size_t f = 0; f < packed.size(); ++f)
+	{
+		packed[f].setBitDepth(images[f]->getBitDepth());
+		frames.push_back(&packed[f]);
+	}
+	std::vector<size_t> indexes(chunk);
+
+	for (unsigned int step = spacing; step > 0; step /= 2)
+	{
+		GridCursor cursor(w, h, step, step == spacing);
+		size_t count;
+		do
+		{
+			//gather the next chunk of pixels from every frame
+			for (count = 0; count < chunk && cursor.next(indexes[count]); ++count)
+				;
+			if (count == 0)
+				break;
+
+			for (size_t f = 0; f < frames.size(); ++f)
+			{
+				//a short last chunk uses the front of the row
+				packed[f].setWidth((unsigned int)count);
+				const Image::Rgb *source = images[f]->getPixels();
+				Image::Rgb *row = packed[f].getPixels();
+				for (size_t i = 0; i < count; ++i)
+					row[i] = source[indexes[i]];
+			}
+
+			//blend and scatter the results back to their pixels
+			Image blended = blend(frames);
+			if (blended.getSize() != count)
+				return Image();
+			const Image::Rgb *result = blended.getPixels();
+			Image::Rgb *pixels = output.getPixels();
+			for (size_t i = 0; i < count; ++i)
+				pixels[indexes[i]] = result[i];
+
+			if (progress != nullptr && !progress->advance())
+				return Image();
+		} while (count == chunk);
+
+		//every pass but the last leaves gaps to fill for the preview
+		//the gaps are overwritten by later passes, so the preview is built in place
+		if (step > 1)
+		{
+			fillGaps(output, step);
+			if (preview && !preview(output, step))
+				return Image();
+		}
+	}
+
+	//return blended image
+	return output;
+}
+
+//Progressive blend writing each preview to filename, then the full blend over the top of it
+bool progressiveBlending(std::vector<Image*> &images, BlendFunction blend, const char *filename, ProgressToken *progress, unsigned int coarsest)
+{
+	//notify user that blending has begun
+	std::cout << "Progressive blending started..." << std::endl;
+
+	Image output = progressiveBlend(images, blend, [filename](const Image &img, unsigned int step)
+	{
+		std::cout << "Preview at 1/" << step << " resolution written to " << filename << std::endl;
+		return writeImage(img, filename);
+	}, progress, coarsest);
+
+	//nothing to write if it was cancelled or failed
+	if (output.getSize() == 0)
+		return false;
+	return writeImage(output, filename);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "Image.h"
+#include "TilePlanner.h" //BlendFunction
+#include <functional> //preview callback
+
+//Coarse to fine blending, so a preview is ready long before the full result
+//The first pass blends every coarsest-th pixel of every coarsest-th row and fills each gap with the blended pixel above and to the left of it
+//Each later pass halves the grid spacing and blends only the pixels that earlier passes didn't, until the last pass completes the image
+//Every pixel is blended on its own, so a pass runs the blend on its pixels packed into rows and the final image is exactly that of a full blend
+//With a spacing of 8 the first preview costs 1/64 of the full blend and all of the passes together cost the same as the full blend
+
+//called with each preview and its grid spacing, returning false stops the blend
+typedef std::function<bool(const Image &, unsigned int)> PreviewFunction;
+
+//Progressive Functions
+
+Image progressiveBlend(std::vector<Image*> &, BlendFunction, PreviewFunction, ProgressToken* = nullptr, unsigned int = 8);
+bool progressiveBlending(std::vector<Image*> &, BlendFunction, const char*, ProgressToken* = nullptr, unsigned int = 8);
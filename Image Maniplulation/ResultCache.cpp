@@ -0,0 +1,433 @@
+#include "ResultCache.h"
+#include <fstream> //read and write entries and the index
+#include <sstream> //build keys
+#include <cstdio> //remove evicted files
+#include <cstring> //read words from a byte buffer
+#include <algorithm> //max use counter
+#include <atomic> //number temporary files
+#include <sys/stat.h> //size and modification time of input files
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h> //replace files and name temporary files
+#else
+#include <unistd.h> //name temporary files
+#endif
+
+//***Hash Functions***
+
+//multipliers from the xxHash64 mixing steps
+static const unsigned long long kPrime1 = 0x9E3779B185EBCA87ull;
+static const unsigned long long kPrime2 = 0xC2B2AE3D27D4EB4Full;
+static const unsigned long long kPrime3 = 0x165667B19E3779F9ull;
+static const unsigned long long kPrime4 = 0x85EBCA77C2B2AE63ull;
+
+static unsigned long long rotateLeft(unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+//mix one 8 byte word into a lane
+static unsigned long long mixWord(unsigned long long lane, unsigned long long word)
+{
+	return rotateLeft(lane + word * kPrime2, 31) * kPrime1;
+}
+
+//read 8 bytes in the byte order of this machine - the hash is only compared on the machine that made it
+static unsigned long long word(const unsigned char *p)
+{
+	unsigned long long w;
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+//Fast 64 bit hash of a block of bytes
+//four independent lanes consume 32 bytes per step so the loop isn't held up by a single dependency chain
+unsigned long long hashBytes(const void *data, size_t size, unsigned long long seed)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	const unsigned char *end = p + size;
+	unsigned long long h;
+
+	if (size >= 32)
+	{
+		unsigned long long v1 = seed + kPrime1 + kPrime2, v2 = seed + kPrime2, v3 = seed, v4 = seed - kPrime1;
+		for (; p + 32 <= end; p += 32)
+		{
+			v1 = mixWord(v1, word(p));
+			v2 = mixWord(v2, word(p + 8));
+			v3 = mixWord(v3, word(p + 16));
+			v4 = mixWord(v4, word(p + 24));
+		}
+		h = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+	}
+	else
+		h = seed + kPrime3;
+
+	h += size;
+
+	//remaining bytes
+	for (; p + 8 <= end; p += 8)
+		h = rotateLeft(h ^ mixWord(0, word(p)), 27) * kPrime1 + kPrime4;
+	for (; p < end; ++p)
+		h = rotateLeft(h ^ (*p * kPrime3), 11) * kPrime1;
+
+	//final avalanche so every input bit affects every output bit
+	h ^= h >> 33;
+	h *= kPrime2;
+	h ^= h >> 29;
+	h *= kPrime3;
+	h ^= h >> 32;
+	return h;
+}
+
+//Hash the contents of a file, a megabyte at a time
+//returns false if the file can't be read
+bool hashFile(const char *filename, unsigned long long &hash)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	if (ifs.fail())
+		return false;
+
+	std::vector<char> buffer(1 << 20);
+	hash = 0;
+	while (ifs)
+	{
+		ifs.read(buffer.data(), buffer.size());
+		//each chunk is seeded with the hash so far
+		if (ifs.gcount() > 0)
+			hash = hashBytes(buffer.data(), (size_t)ifs.gcount(), hash);
+	}
+	return ifs.eof();
+}
+
+//16 hex digits
+std::string toHex(unsigned long long value)
+{
+	std::stringstream hex;
+	hex.width(16);
+	hex.fill('0');
+	hex << std::hex << value;
+	return hex.str();
+}
+
+//copy a whole file, returning the number of bytes copied or 0 on failure
+static unsigned long long copyFile(const std::string &from, const std::string &to)
+{
+	std::ifstream ifs(from.c_str(), std::ios::binary);
+	std::ofstream ofs(to.c_str(), std::ios::binary);
+	if (ifs.fail() || ofs.fail())
+		return 0;
+
+	ofs << ifs.rdbuf();
+	unsigned long long size = (unsigned long long)ofs.tellp();
+	ofs.close();
+	return ofs.fail() ? 0 : size;
+}
+
+//name next to path for a file that is renamed to path once it is whole
+//unique to this process and call, so jobs writing the same entry don't share one
+static std::string temporaryName(const std::string &path)
+{
+	static std::atomic<unsigned long long> counter(0);
+	std::stringstream name;
+#ifdef _WIN32
+	name << path << ".partial" << GetCurrentProcessId() << "-" << counter++;
+#else
+	name << path << ".partial" << getpid() << "-" << counter++;
+#endif
+	return name.str();
+}
+
+//rename from to to, replacing any file already there, so readers see either the old file or the new one
+static bool replaceFile(const std::string &from, const std::string &to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+//file extension including the dot, or an empty string
+static std::string extension(const std::string &filename)
+{
+	size_t dot = filename.find_last_of('.');
+	size_t slash = filename.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return "";
+	return filename.substr(dot);
+}
+
+//***Result Cache Class***
+
+//constructor
+//loads the index of an existing cache directory, which must already exist
+ResultCache::ResultCache(const std::string &dir, unsigned long long size, bool frames) :
+	directory(dir),
+	maxSize(size),
+	cacheFrames(frames),
+	totalSize(0),
+	useCounter(0),
+	hits(0),
+	misses(0),
+	frameHits(0),
+	frameMisses(0),
+	evictions(0)
+{
+	std::ifstream index((directory + "/index.txt").c_str());
+	std::string key;
+	Entry entry;
+	while (index >> key >> entry.file >> entry.size >> entry.lastUsed)
+	{
+		entries[key] = entry;
+		totalSize += entry.size;
+		useCounter = std::max(useCounter, entry.lastUsed);
+	}
+}
+
+//destructor
+ResultCache::~ResultCache()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	saveIndex();
+}
+
+//Build the key of a job from its algorithm and parameters, output format and the contents of its inputs
+//returns an empty key if an input can't be read, in which case the job isn't cached
+std::string ResultCache::jobKey(const std::string &parameters, const std::string &output, const std::vector<std::string> &inputs)
+{
+	std::stringstream description;
+	description << parameters << " " << extension(output);
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		std::string hash = fileHash(inputs[i]);
+		if (hash.empty())
+			return "";
+		description << " " << hash;
+	}
+
+	std::string text = description.str();
+	return toHex(hashBytes(text.data(), text.size()));
+}
+
+//Copy the output stored under key to filename
+//returns true on a hit
+bool ResultCache::fetch(const std::string &key, const std::string &filename)
+{
+	std::string file;
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		std::map<std::string, Entry>::iterator it = entries.find(key);
+		if (it == entries.end())
+		{
+			++misses;
+			return false;
+		}
+		it->second.lastUsed = ++useCounter;
+		file = it->second.file;
+	}
+
+	//copy outside of the lock so other jobs can use the cache, then rename so the output is never seen half written
+	//an entry replaced while it is copied is renamed over, so the copy is of the old file or the new one
+	std::string partial = temporaryName(filename);
+	bool copied = copyFile(directory + "/" + file, partial) != 0;
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	if (!copied || !replaceFile(partial, filename))
+	{
+		std::remove(partial.c_str());
+		++misses;
+		return false;
+	}
+	//filename may be an input of a later job, and may have been rewritten within the same second as its last hash
+	fileHashes.erase(filename);
+	++hits;
+	return true;
+}
+
+//Store the output file of a job under key
+void ResultCache::store(const std::string &key, const std::string &filename)
+{
+	//the job has just written filename, so any hash of it from an earlier job is out of date
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		fileHashes.erase(filename);
+	}
+
+	std::string partial = temporaryName(directory + "/" + key + extension(filename));
+	if (copyFile(filename, partial) == 0)
+	{
+		std::remove(partial.c_str());
+		return;
+	}
+	add(key, key + extension(filename), partial);
+}
+
+//Read a frame, using the decoded copy in the cache if there is one
+//frames that aren't cached yet are decoded as usual and then stored as float maps
+Image ResultCache::readFrame(const std::string &filename)
+{
+	if (!cacheFrames)
+		return readImage(filename.c_str());
+
+	std::string hash = fileHash(filename);
+	if (hash.empty())
+		return readImage(filename.c_str());
+
+	std::string key = "frame-" + hash;
+	std::string file;
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		std::map<std::string, Entry>::iterator it = entries.find(key);
+		if (it != entries.end())
+		{
+			it->second.lastUsed = ++useCounter;
+			file = it->second.file;
+		}
+	}
+
+	if (!file.empty())
+	{
+		Image frame = readPFM((directory + "/" + file).c_str());
+		if (frame.getSize() != 0)
+		{
+			std::lock_guard<std::mutex> lock(cacheMutex);
+			++frameHits;
+			//keep the name of the original file for logs
+			frame.setName(filename);
+			return frame;
+		}
+	}
+
+	Image frame = readImage(filename.c_str());
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		++frameMisses;
+	}
+
+	if (frame.getSize() != 0)
+	{
+		std::string partial = temporaryName(directory + "/" + key + ".pfm");
+		if (writePFM(frame, partial.c_str()))
+			add(key, key + ".pfm", partial);
+		else
+			std::remove(partial.c_str());
+	}
+	return frame;
+}
+
+//Write hit, miss and eviction counts
+void ResultCache::writeStatistics(std::ostream &os)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	os << "Cache: " << hits << " hit(s), " << misses << " miss(es)";
+	if (cacheFrames)
+		os << ", " << frameHits << " frame hit(s), " << frameMisses << " frame miss(es)";
+	os << ", " << evictions << " eviction(s), " << totalSize / (1024 * 1024) << "MB of " << maxSize / (1024 * 1024) << "MB used" << std::endl;
+}
+
+unsigned long long ResultCache::getHits() const
+{
+	return hits;
+}
+unsigned long long ResultCache::getMisses() const
+{
+	return misses;
+}
+
+//Content hash of a file as hex, remembered since frames are shared between jobs
+//the file is hashed again if its size or modification time has changed, or if a job has written it since
+std::string ResultCache::fileHash(const std::string &filename)
+{
+	//the version is found before hashing, so a file changed while it is read is hashed again next time
+	FileHash version;
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return "";
+	version.size = (unsigned long long)info.st_size;
+	version.modified = info.st_mtime;
+
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		std::map<std::string, FileHash>::iterator it = fileHashes.find(filename);
+		if (it != fileHashes.end() && it->second.size == version.size && it->second.modified == version.modified)
+			return it->second.hash;
+	}
+
+	//hash outside of the lock, it reads the whole file
+	unsigned long long hash;
+	if (!hashFile(filename.c_str(), hash))
+		return "";
+	version.hash = toHex(hash);
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	fileHashes[filename] = version;
+	return version.hash;
+}
+
+//Add an entry by renaming partial, a whole file already written in the cache directory, to file, then evict down to the size limit
+//the rename is made under the lock so an entry is never seen half written, or its file replaced while the index is changed
+void ResultCache::add(const std::string &key, const std::string &file, const std::string &partial)
+{
+	unsigned long long size;
+	{
+		std::ifstream ifs(partial.c_str(), std::ios::binary | std::ios::ate);
+		size = ifs ? (unsigned long long)ifs.tellg() : 0;
+	}
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	if (size == 0 || !replaceFile(partial, directory + "/" + file))
+	{
+		std::remove(partial.c_str());
+		return;
+	}
+
+	std::map<std::string, Entry>::iterator it = entries.find(key);
+	if (it != entries.end())
+		totalSize -= it->second.size;
+
+	Entry entry;
+	entry.file = file;
+	entry.size = size;
+	entry.lastUsed = ++useCounter;
+	entries[key] = entry;
+	totalSize += size;
+
+	evict();
+	saveIndex();
+}
+
+//Remove least recently used entries until the cache fits its size limit
+//cacheMutex must be held
+void ResultCache::evict()
+{
+	while (totalSize > maxSize && !entries.empty())
+	{
+		std::map<std::string, Entry>::iterator oldest = entries.begin();
+		for (std::map<std::string, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+		{
+			if (it->second.lastUsed < oldest->second.lastUsed)
+				oldest = it;
+		}
+
+		std::remove((directory + "/" + oldest->second.file).c_str());
+		totalSize -= oldest->second.size;
+		entries.erase(oldest);
+		++evictions;
+	}
+}
+
+//Write the index so the cache can be used by later runs
+//cacheMutex must be held
+//it's written beside the old one and renamed over it, so a crash part way through leaves the old index rather than half of one
+void ResultCache::saveIndex()
+{
+	std::string partial = temporaryName(directory + "/index.txt");
+	std::ofstream index(partial.c_str());
+	for (std::map<std::string, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+		index << it->first << " " << it->second.file << " " << it->second.size << " " << it->second.lastUsed << "\n";
+	index.close();
+
+	if (index.fail() || !replaceFile(partial, directory + "/index.txt"))
+		std::remove(partial.c_str());
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "Image.h"
+#include <string> //hold keys and filenames
+#include <vector> //hold job inputs
+#include <map> //index cache entries by key
+#include <mutex> //share the cache between batch jobs
+#include <ostream> //write cache statistics
+#include <ctime> //modification times of input files
+
+//Persistent on-disk cache of job outputs and decoded frames
+//Outputs are keyed by a hash of the algorithm, its parameters and the contents of every input,
+//so a job whose inputs and parameters haven't changed is answered by copying the stored output
+//Decoded frames are optionally stored as float maps keyed by the hash of the encoded file
+//The cache directory holds one file per entry and an index.txt listing them; the least recently used entries are removed once the cache is over its size
+class ResultCache
+{
+public:
+	//ResultCache constructors
+	ResultCache(const std::string &, unsigned long long, bool = false);
+	ResultCache(const ResultCache &) = delete;
+
+	//ResultCache destructor - saves the index
+	~ResultCache();
+
+	//ResultCache operator overloads
+	ResultCache& operator=(const ResultCache &) = delete;
+
+	//ResultCache member functions
+	std::string jobKey(const std::string &, const std::string &, const std::vector<std::string> &);
+	bool fetch(const std::string &, const std::string &);
+	void store(const std::string &, const std::string &);
+	Image readFrame(const std::string &);
+	void writeStatistics(std::ostream &);
+
+	//Getter functions
+	unsigned long long getHits() const;
+	unsigned long long getMisses() const;
+
+private:
+	//One file held by the cache
+	struct Entry
+	{
+		std::string file; //filename within the cache directory
+		unsigned long long size; //bytes used
+		unsigned long long lastUsed; //value of useCounter when last read or written
+	};
+
+	//Content hash of an input file and the version of the file it was taken from
+	struct FileHash
+	{
+		unsigned long long size; //file size and modification time, the file is hashed again if either changes
+		time_t modified;
+		std::string hash;
+	};
+
+	std::string fileHash(const std::string &);
+	void add(const std::string &, const std::string &, const std::string &); //key, file in the cache, temporary file renamed to it
+	void evict();
+	void saveIndex();
+
+	std::string directory; //where entries are stored
+	unsigned long long maxSize; //bytes allowed before entries are evicted
+	bool cacheFrames; //also store decoded frames
+	std::map<std::string, Entry> entries; //entries by key
+	std::map<std::string, FileHash> fileHashes; //content hash of each input file seen by this run
+	unsigned long long totalSize; //bytes used by all entries
+	unsigned long long useCounter; //increases on every use, orders entries for eviction
+	unsigned long long hits, misses, frameHits, frameMisses, evictions; //statistics
+	std::mutex cacheMutex; //guards everything above
+};
+
+//Hash Functions
+
+unsigned long long hashBytes(const void*, size_t, unsigned long long = 0);
+bool hashFile(const char*, unsigned long long &);
+std::string toHex(unsigned long long);
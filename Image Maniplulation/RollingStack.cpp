@@ -0,0 +1,309 @@
+#include "RollingStack.h"
+#include "ClipWindow.h"
+#include "Progress.h"
+#include <iostream> //report to std::cerr
+#include <algorithm> //sorted runs and band sizes
+#include <future> //wait for bands
+#include <chrono> //frame rate and poll interval
+#include <thread> //sleep between polls
+#include <map> //files seen in the watched directory
+#include <set> //files already taken from it
+#include <utility> //move frames into the window
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h> //list the watched directory
+#else
+#include <dirent.h> //list the watched directory
+#include <sys/stat.h> //size of files in it
+#endif
+
+//time between looks at a watched directory
+static const std::chrono::milliseconds kWatchInterval(200);
+
+//***Rolling Stack***
+
+//constructor
+//a window of at least one frame
+RollingStack::RollingStack(unsigned int frameCount, RollingAlgorithm a, int i, float t, unsigned int threads) :
+	window(std::max(1u, frameCount)),
+	algorithm(a),
+	iterations(i),
+	tolerence(t),
+	pool(threads),
+	w(0),
+	h(0),
+	frames(window),
+	next(0),
+	count(0)
+{}
+
+//Add the next frame, dropping the oldest once the window is full, and blend the window
+Image RollingStack::addFrame(Image &&frame)
+{
+	if (frame.getSize() == 0)
+		return Image();
+
+	//the first frame sets the size of the stream
+	if (w == 0)
+	{
+		w = frame.getWidth();
+		h = frame.getHeight();
+		if (algorithm == kRollingMean)
+			sums.assign(frame.getSize() * 3, 0);
+		else
+			sorted.resize(frame.getSize() * 3 * window);
+	}
+	if (frame.getWidth() != w || frame.getHeight() != h)
+	{
+		fprintf(stderr, "Frame is %ux%u but the stream is %ux%u\n", frame.getWidth(), frame.getHeight(), w, h);
+		return Image();
+	}
+
+	//the slot the frame goes in holds the oldest frame once the window is full
+	Image oldest = std::move(frames[next]);
+	frames[next] = std::move(frame);
+	next = (next + 1) % window;
+	if (count < window)
+		++count;
+
+	Image output(w, h);
+	output.setBitDepth(255);
+	output.setName(frames[(next + window - 1) % window].getName());
+
+	//channels are separate floats so every frame is 3 x w x h samples in a row
+	const float *added = reinterpret_cast<const float *>(frames[(next + window - 1) % window].getPixels());
+	const float *removed = oldest.getSize() != 0 ? reinterpret_cast<const float *>(oldest.getPixels()) : nullptr;
+	float *out = reinterpret_cast<float *>(output.getPixels());
+
+	//a band of samples per thread
+	size_t samples = (size_t)w * h * 3;
+	size_t bands = pool.getThreadCount();
+	size_t bandSize = (samples + bands - 1) / bands;
+	std::vector<std::future<void>> results;
+	for (size_t first = 0; first < samples; first += bandSize)
+	{
+		size_t last = std::min(samples, first + bandSize);
+		results.push_back(pool.submit([=]() { update(first, last, added, removed, out); }));
+	}
+	for (size_t i = 0; i < results.size(); ++i)
+		results[i].get();
+
+	return output;
+}
+
+//Replace the oldest sample with the new one for samples [first, last) and blend them into out
+//count has already been moved on to include the new frame
+void RollingStack::update(size_t first, size_t last, const float *added, const float *removed, float *out)
+{
+	if (algorithm == kRollingMean)
+	{
+		//a running sum drifts by no more than a double rounding per frame, far below an 8 bit step
+		for (size_t s = first; s < last; ++s)
+		{
+			sums[s] += added[s];
+			if (removed != nullptr)
+				sums[s] -= removed[s];
+			out[s] = (float)(sums[s] / count);
+		}
+		return;
+	}
+
+	ClipWindow clipWindow;
+	for (size_t s = first; s < last; ++s)
+	{
+		float *run = &sorted[s * window];
+		float value = added[s];
+
+		//find the slot to fill - the oldest sample's when there is one, otherwise a new one at the end
+		size_t hole;
+		if (removed != nullptr)
+			hole = std::lower_bound(run, run + count, removed[s]) - run;
+		else
+			hole = count - 1;
+
+		//slide the hole to where the new sample belongs, one shift of the samples in between
+		while (hole > 0 && run[hole - 1] > value)
+		{
+			run[hole] = run[hole - 1];
+			--hole;
+		}
+		while (hole + 1 < count && run[hole + 1] < value)
+		{
+			run[hole] = run[hole + 1];
+			++hole;
+		}
+		run[hole] = value;
+
+		if (algorithm == kRollingMedian)
+		{
+			//same float arithmetic as median()
+			if (count % 2 == 0)
+				out[s] = (run[count / 2] + run[count / 2 - 1]) / 2;
+			else
+				out[s] = run[count / 2];
+		}
+		else
+		{
+			//already in order, so reset() only builds the prefix sums
+			clipWindow.samples.assign(run, run + count);
+			clipWindow.reset();
+			if (algorithm == kRollingSigmaIterations)
+				clipIterations(clipWindow, iterations);
+			else
+				clipTolerence(clipWindow, tolerence);
+			out[s] = clipWindow.mean();
+		}
+	}
+}
+
+//Getter functions
+
+unsigned int RollingStack::getFrameCount() const
+{
+	return count;
+}
+
+//***Rolling Stack Functions***
+
+//Write the frame rate so far
+static void reportRate(unsigned long long frames, std::chrono::steady_clock::time_point start)
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << frames << " frame(s) in " << seconds << "s, " << (seconds > 0 ? frames / seconds : 0) << " frames per second" << std::endl;
+}
+
+//Denoise a stream of binary pnm frames written one after another, writing a ppm frame for each one as soon as it is blended
+//runs until the end of the input or until cancelled, returns false if a frame couldn't be read, blended or written
+bool streamFrames(RollingStack &stack, std::istream &is, std::ostream &os, ProgressToken *progress)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	unsigned long long frames = 0;
+	std::vector<unsigned char> bytes;
+	bool ok = true;
+
+	while (progress == nullptr || !progress->isCancelled())
+	{
+		//an empty frame at the end of the stream isn't an error, anywhere else the reader has said why
+		Image frame = readPPMFrame(is);
+		if (frame.getSize() == 0)
+		{
+			ok = is.rdbuf()->sgetc() == EOF;
+			break;
+		}
+
+		Image output = stack.addFrame(std::move(frame));
+		if (output.getSize() == 0)
+		{
+			ok = false;
+			break;
+		}
+
+		//flushed so whoever reads the pipe gets each frame straight away
+		toBytes(output, bytes);
+		os << ppmHeader(output.getWidth(), output.getHeight());
+		os.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+		os.flush();
+		if (os.fail())
+		{
+			fprintf(stderr, "Can't write output frame\n");
+			ok = false;
+			break;
+		}
+		++frames;
+	}
+
+	reportRate(frames, start);
+	return ok;
+}
+
+//Names and sizes of the ppm files in a directory
+//returns false if the directory can't be read
+static bool listFrames(const std::string &directory, std::map<std::string, unsigned long long> &files)
+{
+	files.clear();
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA((directory + "\\*.ppm").c_str(), &found);
+	if (find == INVALID_HANDLE_VALUE)
+		//an empty directory is fine, a missing one isn't
+		return GetLastError() == ERROR_FILE_NOT_FOUND;
+	do
+	{
+		if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			files[found.cFileName] = ((unsigned long long)found.nFileSizeHigh << 32) | found.nFileSizeLow;
+	} while (FindNextFileA(find, &found));
+	FindClose(find);
+#else
+	DIR *dir = opendir(directory.c_str());
+	if (dir == nullptr)
+		return false;
+	while (dirent *entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		struct stat info;
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".ppm") == 0 && stat((directory + "/" + name).c_str(), &info) == 0 && S_ISREG(info.st_mode))
+			files[name] = (unsigned long long)info.st_size;
+	}
+	closedir(dir);
+#endif
+	return true;
+}
+
+//Watch a directory for new ppm frames and write the denoised frame for each one to the output directory under the same name
+//frames are taken in name order, each once its size has stopped changing between two looks so a frame still being written is left alone
+//frames already there when watching starts are skipped
+//runs until cancelled, returns false if the input directory can't be read
+bool watchDirectory(RollingStack &stack, const std::string &input, const std::string &output, ProgressToken *progress)
+{
+#ifdef _WIN32
+	const std::string separator = "\\";
+#else
+	const std::string separator = "/";
+#endif
+	std::map<std::string, unsigned long long> seen, now;
+	if (!listFrames(input, seen))
+	{
+		fprintf(stderr, "Can't read the directory %s\n", input.c_str());
+		return false;
+	}
+	//frames that have been denoised, or were there before watching started
+	std::set<std::string> taken;
+	for (std::map<std::string, unsigned long long>::const_iterator f = seen.begin(); f != seen.end(); ++f)
+		taken.insert(f->first);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	unsigned long long frames = 0;
+	std::cerr << "Watching " << input << " for new frames, Ctrl+C stops" << std::endl;
+
+	while (progress == nullptr || !progress->isCancelled())
+	{
+		std::this_thread::sleep_for(kWatchInterval);
+		//the directory going away for a moment isn't a reason to stop
+		if (!listFrames(input, now))
+			continue;
+
+		for (std::map<std::string, unsigned long long>::const_iterator f = now.begin(); f != now.end(); ++f)
+		{
+			if (taken.count(f->first) != 0)
+				continue;
+			//new or still growing - it and the frames after it wait for the next look
+			std::map<std::string, unsigned long long>::const_iterator before = seen.find(f->first);
+			if (before == seen.end() || before->second != f->second || f->second == 0)
+				break;
+
+			taken.insert(f->first);
+			Image denoised = stack.addFrame(readPPM((input + separator + f->first).c_str()));
+			if (denoised.getSize() == 0 || !writePPM(denoised, (output + separator + f->first).c_str()))
+			{
+				fprintf(stderr, "Skipped %s\n", f->first.c_str());
+				continue;
+			}
+			if (++frames % 100 == 0)
+				reportRate(frames, start);
+		}
+		seen.swap(now);
+	}
+
+	reportRate(frames, start);
+	return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "Image.h"
+#include "ThreadPool.h"
+#include <string> //watched directories
+#include <vector> //hold the window
+#include <istream> //read frames from a pipe
+#include <ostream> //write frames to a pipe
+
+class ProgressToken; //defined in Progress.h
+
+//Temporal denoising of a continuous stream of frames
+//Every frame added gives an output frame blended from the last window frames, or from every frame so far while the window fills
+//Mean keeps a running sum of each sample, so a new frame costs one add and one subtract per sample whatever the window
+//Median and sigma clipping keep the samples of each channel of each pixel sorted, so a new frame replaces the oldest sample
+//with one shift along the sorted run instead of sorting it again, and sigma clipping works on the sorted run as sigmaClip does
+//Samples are split between the threads of a pool a band at a time
+enum RollingAlgorithm
+{
+	kRollingMean,
+	kRollingMedian,
+	kRollingSigmaIterations,
+	kRollingSigmaTolerence
+};
+
+class RollingStack
+{
+public:
+	//RollingStack constructors
+	RollingStack(unsigned int, RollingAlgorithm, int = 0, float = 0, unsigned int = 0); //window frames, algorithm, iterations, tolerence, threads (0 = one per hardware thread)
+	RollingStack(const RollingStack &) = delete;
+
+	//RollingStack operator overloads
+	RollingStack& operator=(const RollingStack &) = delete;
+
+	//RollingStack member functions
+	Image addFrame(Image &&); //returns the denoised frame, or an empty image if the frame is a different size to the first
+
+	//Getter functions
+	unsigned int getFrameCount() const; //frames in the window
+
+private:
+	void update(size_t, size_t, const float*, const float*, float*); //samples [first, last), new samples, oldest samples or nullptr, output
+
+	unsigned int window; //frames blended
+	RollingAlgorithm algorithm;
+	int iterations; //kRollingSigmaIterations parameter
+	float tolerence; //kRollingSigmaTolerence parameter
+	ThreadPool pool;
+	unsigned int w, h; //size of every frame, set by the first
+	std::vector<Image> frames; //last window frames, oldest at next once full
+	unsigned int next; //slot the next frame goes in
+	unsigned int count; //frames held
+	std::vector<double> sums; //mean - sum of each sample over the window
+	std::vector<float> sorted; //median and sigma clipping - window slots per sample, the first count of them in order
+};
+
+//Rolling Stack Functions
+
+//both write a report to std::cerr, as standard output may be the stream of frames
+bool streamFrames(RollingStack &, std::istream &, std::ostream &, ProgressToken* = nullptr); //concatenated binary pnm frames in, ppm frames out
+bool watchDirectory(RollingStack &, const std::string &, const std::string &, ProgressToken* = nullptr); //input directory, output directory - runs until cancelled
@@ -0,0 +1,269 @@
+#include "Shard.h"
+#include "Image.h"
+#include "ImageZoom.h"
+#include "PPMWriter.h"
+#include <sstream> //build commands
+#include <iomanip> //write parameters without losing precision
+#include <thread> //one thread per running worker
+#include <mutex> //share the stripe queue
+#include <deque> //stripes waiting for a worker
+#include <algorithm> //stripe sizes
+#include <chrono> //time the job
+#include <cstdio> //rename and remove stripe files
+#include <cstdlib> //run worker processes
+
+//***Shard Options Structure***
+
+//default constructor - 2 retries, no commands so that the program is run directly
+ShardOptions::ShardOptions() :
+	stripes(0),
+	workers(0),
+	retries(2)
+{}
+
+//true for the algorithms whose output rows only depend on the same rows of the inputs
+static bool canShard(const BatchJob &job)
+{
+	return job.algorithm != "mean8" && job.algorithm != "median8" && job.algorithm != "shrink";
+}
+
+//Check every input is a ppm file of the same size
+static bool inputSize(const BatchJob &job, unsigned int &w, unsigned int &h)
+{
+	for (size_t i = 0; i < job.inputs.size(); ++i)
+	{
+		unsigned int iw, ih, b;
+		if (!readPPMSize(job.inputs[i].c_str(), iw, ih, b))
+		{
+			fprintf(stderr, "Can't read %s as a ppm file\n", job.inputs[i].c_str());
+			return false;
+		}
+		if (i == 0)
+			w = iw, h = ih;
+		else if (iw != w || ih != h)
+		{
+			fprintf(stderr, "%s has different dimensions to %s\n", job.inputs[i].c_str(), job.inputs[0].c_str());
+			return false;
+		}
+	}
+	return !job.inputs.empty();
+}
+
+//***Worker***
+
+//Run the rows [first, first + rows) of a job and write them to stripeFile
+//the stripe is written under a temporary name and renamed once complete
+//returns true if the stripe file was written
+bool runStripe(const BatchJob &job, unsigned int first, unsigned int rows, const std::string &stripeFile)
+{
+	unsigned int w, h;
+	if (!canShard(job) || job.status == kInvalidJob)
+	{
+		fprintf(stderr, "Only float blends and zoom jobs can be split into stripes\n");
+		return false;
+	}
+	if (!inputSize(job, w, h))
+		return false;
+	if (rows == 0 || first >= h || rows > h - first)
+	{
+		fprintf(stderr, "Can't read rows outside of the input image\n");
+		return false;
+	}
+
+	std::vector<Image*> frames;
+	Image stripe;
+	try
+	{
+		//only this stripe's rows of each input are read
+		for (size_t i = 0; i < job.inputs.size() && (frames.empty() || frames.back()->getSize() != 0); ++i)
+			frames.push_back(new Image(readPPMRows(job.inputs[i].c_str(), first, rows)));
+
+		if (frames.back()->getSize() != 0)
+		{
+			if (job.algorithm == "zoom")
+				stripe = zoomNearestNeighbour(frames.front(), job.zoom);
+			else
+				stripe = blendFunction(job)(frames);
+		}
+	}
+	catch (const std::bad_alloc &)
+	{
+		fprintf(stderr, "Out of memory\n");
+	}
+
+	//deallocate memory used by Images
+	for (size_t i = 0; i < frames.size(); ++i)
+		delete frames[i];
+
+	if (stripe.getSize() == 0)
+		return false;
+
+	//the coordinator only looks for the final name
+	std::string partial = stripeFile + ".part";
+	if (!writePPM(stripe, partial.c_str()))
+		return false;
+	//rename won't replace an existing file everywhere
+	std::remove(stripeFile.c_str());
+	return std::rename(partial.c_str(), stripeFile.c_str()) == 0;
+}
+
+//***Coordinator***
+
+//Quote an argument for the shell that std::system runs
+static std::string quote(const std::string &arg)
+{
+	std::string quoted = "\"";
+	for (size_t i = 0; i < arg.size(); ++i)
+	{
+#ifdef _WIN32
+		if (arg[i] == '"')
+			quoted += '\\';
+#else
+		//characters that are still special inside double quotes
+		if (arg[i] == '"' || arg[i] == '\\' || arg[i] == '$' || arg[i] == '`')
+			quoted += '\\';
+#endif
+		quoted += arg[i];
+	}
+	return quoted + "\"";
+}
+
+//Manifest line of a job, as quoted arguments
+static std::string manifestArguments(const BatchJob &job)
+{
+	std::stringstream line;
+	line << quote(job.algorithm);
+	if (job.algorithm == "sigma-iter" || job.algorithm == "sigma-iter-luma")
+		line << " " << job.iterations;
+	else if (job.algorithm == "sigma-tol" || job.algorithm == "sigma-tol-luma")
+		//enough digits that the worker reads back the same float
+		line << " " << std::setprecision(9) << job.tolerence;
+	else if (job.algorithm == "zoom")
+		line << " " << job.zoom;
+
+	line << " " << quote(job.output);
+	for (size_t i = 0; i < job.inputs.size(); ++i)
+		line << " " << quote(job.inputs[i]);
+	return line.str();
+}
+
+//Copy a finished stripe into the output at its first row
+//returns false if the stripe isn't the size it should be
+static bool stitchStripe(const std::string &stripeFile, PPMWriter &output, unsigned int outW, unsigned int firstRow, unsigned int rows)
+{
+	unsigned int w, h;
+	std::vector<unsigned char> bytes;
+	if (!readPPMBytes(stripeFile.c_str(), w, h, bytes) || w != outW || h != rows)
+		return false;
+	return output.writeRows(bytes.data(), firstRow, rows);
+}
+
+//Split a job into stripes, run each in a worker process and stitch the results into the job's output
+//returns true if every stripe was run and stitched
+bool runSharded(const BatchJob &job, const ShardOptions &options, std::ostream &log)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	unsigned int w, h;
+	if (!canShard(job) || job.status == kInvalidJob)
+	{
+		log << "line " << job.line << ": only float blends and zoom jobs can be split into stripes" << std::endl;
+		return false;
+	}
+	if (!inputSize(job, w, h))
+		return false;
+
+	//each input row becomes zoom output rows
+	unsigned int zoom = job.algorithm == "zoom" ? (unsigned int)job.zoom : 1;
+	if ((unsigned long long)w * zoom > 0xFFFFFFFFull || (unsigned long long)h * zoom > 0xFFFFFFFFull)
+	{
+		log << "line " << job.line << ": output is too large for a ppm file" << std::endl;
+		return false;
+	}
+	unsigned int outW = w * zoom, outH = h * zoom;
+
+	//stripes of whole rows, no more stripes than rows
+	unsigned int stripes = std::max(1u, std::min(options.stripes, h));
+	unsigned int stripeRows = (h + stripes - 1) / stripes;
+	stripes = (h + stripeRows - 1) / stripeRows;
+	unsigned int workers = std::max(1u, std::min(options.workers, stripes));
+	std::vector<std::string> commands = options.commands;
+	if (commands.empty())
+		commands.push_back(quote(options.program));
+
+	//the output is created at its full size so stripes can be written into it in any order
+	//and only appears under its name once every stripe is in
+	PPMWriter writer(job.output, outW, outH);
+	if (!writer.isOpen())
+	{
+		log << "line " << job.line << ": can't create " << job.output << std::endl;
+		return false;
+	}
+
+	std::string arguments = manifestArguments(job);
+	std::deque<unsigned int> waiting;
+	for (unsigned int s = 0; s < stripes; ++s)
+		waiting.push_back(s);
+	std::vector<unsigned int> attempts(stripes, 0);
+	unsigned int failed = 0, retried = 0;
+	std::mutex queueMutex;
+
+	//each thread runs one worker process at a time until there are no stripes left
+	auto work = [&]()
+	{
+		while (true)
+		{
+			unsigned int s, attempt;
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				if (waiting.empty())
+					return;
+				s = waiting.front();
+				waiting.pop_front();
+				attempt = attempts[s]++;
+			}
+
+			unsigned int first = s * stripeRows;
+			unsigned int rows = std::min(stripeRows, h - first);
+			std::stringstream stripeFile;
+			stripeFile << job.output << ".stripe" << s << ".ppm";
+
+			//a retry moves on to the next command, so a broken host doesn't fail the same stripe every time
+			std::stringstream command;
+			command << commands[(s + attempt) % commands.size()] << " --stripe " << first << " " << rows << " " << quote(stripeFile.str()) << " " << arguments;
+
+			bool ok = std::system(command.str().c_str()) == 0 && stitchStripe(stripeFile.str(), writer, outW, first * zoom, rows * zoom);
+			std::remove(stripeFile.str().c_str());
+
+			std::lock_guard<std::mutex> lock(queueMutex);
+			if (ok)
+				log << "Stripe " << s + 1 << " of " << stripes << " (rows " << first << "-" << first + rows - 1 << ") done" << std::endl;
+			else if (attempt < options.retries)
+			{
+				log << "Stripe " << s + 1 << " of " << stripes << " failed, retrying" << std::endl;
+				waiting.push_back(s);
+				++retried;
+			}
+			else
+			{
+				log << "Stripe " << s + 1 << " of " << stripes << " failed " << attempt + 1 << " time(s), giving up" << std::endl;
+				++failed;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < workers; ++i)
+		threads.push_back(std::thread(work));
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	//a partly stitched output is never renamed into place
+	if (failed == 0 && !writer.commit())
+		++failed;
+
+	int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	log << "line " << job.line << ": " << job.output << " " << (failed == 0 ? "succeeded" : "failed") << " in " << stripes << " stripe(s) on " << workers
+		<< " worker(s), " << retried << " retr" << (retried == 1 ? "y" : "ies") << ", " << elapsed << "ms" << std::endl;
+	return failed == 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "Batch.h"
+#include <string> //hold commands and stripe filenames
+#include <vector> //hold worker commands
+#include <ostream> //write coordinator log
+
+//Stripe sharding of one stacking or zoom job across worker processes
+//The coordinator splits the input rows into horizontal stripes and runs
+//	<command> --stripe <first row> <rows> <stripe file> <manifest line>
+//for each one, where the command is this program by default and can be anything that runs it elsewhere, eg. "ssh node2 /shared/bin/stacker",
+//as long as every worker sees the inputs and the output directory through a shared filesystem
+//Each worker reads only its rows of every input with readPPMRows and writes its stripe of the output as a ppm file,
+//renaming it into place once it is complete so that a half written stripe is never used
+//Failed stripes are run again, on the next command in turn when there are several, and finished stripes are copied
+//into the output at their rows so no input is read again. Outputs are always 8 bit binary ppm files
+struct ShardOptions
+{
+	ShardOptions();
+
+	unsigned int stripes; //stripes each job is split into
+	unsigned int workers; //worker processes running at once
+	unsigned int retries; //times a failed stripe is run again before the job fails
+	std::vector<std::string> commands; //worker commands, taken in turn
+	std::string program; //path of this program, run when there are no commands
+};
+
+//Shard Functions
+
+bool runStripe(const BatchJob &, unsigned int, unsigned int, const std::string &); //job, first row, rows, stripe file
+bool runSharded(const BatchJob &, const ShardOptions &, std::ostream &);
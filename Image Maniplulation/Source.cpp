@@ -1,17 +1,400 @@
 #include "Image.h"
 #include "ImageZoom.h"
+#include "Batch.h"
+#include "TiledImage.h"
+#include "Progress.h"
+#include "Daemon.h"
+#include "Shard.h"
+#include "Logging.h"
+#include "RollingStack.h"
+#include "SpatialFilter.h"
 #include <iostream> //output to screen and recieve inputs
 #include <sstream> //generate successive filenames
 #include <string> //use strings
 #include <chrono> //get current time and find difference between times
+#include <cstdlib> //pause console and convert arguments
+#include <csignal> //cancel with Ctrl+C
+#include <atomic> //share the running operation with the Ctrl+C handler
+#include <thread> //default number of stripe workers
+#include <algorithm> //at least one stripe worker
+#include <fstream> //stream frames from and to named pipes
+#ifdef _WIN32
+#include <io.h> //switch standard input and output to binary
+#include <fcntl.h>
+#endif
 
-int main()
+//token of the operation that is running, cancelled by Ctrl+C
+static std::atomic<ProgressToken*> activeProgress(nullptr);
+
+//Ctrl+C handler - cancels the running operation instead of closing the program
+extern "C" void cancelOnInterrupt(int)
+{
+	ProgressToken *progress = activeProgress.load();
+	if (progress != nullptr)
+		progress->cancel();
+	//some platforms reset the handler to the default once it has run
+	std::signal(SIGINT, cancelOnInterrupt);
+}
+
+//Non-interactive mode
+//usage: "Image Maniplulation" --batch <manifest> [max concurrent jobs] [memory budget in MB] [options]
+//options:	--cache <directory> <size in MB>	reuse outputs of jobs whose inputs and parameters haven't changed
+//			--cache-frames						also keep decoded frames in the cache
+//			--preview							blend coarse to fine, writing previews to each output before the full result
+//			--static-spread <counts>			give pixels whose samples are all within counts of each other the mean instead of sigma clipping them
+//			--checkpoint <seconds>				save finished rows of sigma clipping jobs this often, so a killed batch carries on where it stopped
+//runs every job in the manifest on a shared thread pool and returns 0 only if all of them succeeded
+//Ctrl+C cancels the jobs that are running and skips the rest
+int runBatchMode(int argc, char *argv[])
+{
+	//0 lets the pool use one worker per hardware thread
+	unsigned int threads = 0;
+	//0 means no limit
+	unsigned long long budget = 0;
+	std::string cacheDirectory;
+	unsigned long long cacheSize = 0;
+	bool cacheFrames = false;
+	bool preview = false;
+	//negative means every pixel is clipped
+	float staticSpread = -1;
+	//0 means sigma clipping isn't checkpointed
+	unsigned int checkpointInterval = 0;
+
+	//positional arguments come first, then options
+	int positional = 0;
+	for (int i = 3; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--cache" && i + 2 < argc)
+		{
+			cacheDirectory = argv[++i];
+			cacheSize = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		}
+		else if (arg == "--cache-frames")
+			cacheFrames = true;
+		else if (arg == "--preview")
+			preview = true;
+		else if (arg == "--static-spread" && i + 1 < argc)
+			staticSpread = (float)std::atof(argv[++i]);
+		else if (arg == "--checkpoint" && i + 1 < argc)
+			checkpointInterval = (unsigned int)std::atoi(argv[++i]);
+		else if (positional++ == 0)
+			threads = (unsigned int)std::atoi(argv[i]);
+		else
+			budget = std::strtoull(argv[i], nullptr, 10) * 1024 * 1024;
+	}
+
+	std::vector<BatchJob> jobs = readManifest(argv[2]);
+	if (jobs.empty())
+	{
+		std::cout << "No jobs found in " << argv[2] << std::endl;
+		return 1;
+	}
+
+	//cache is created before the pool so that it outlives every job
+	ResultCache *cache = cacheDirectory.empty() ? nullptr : new ResultCache(cacheDirectory, cacheSize, cacheFrames);
+
+	unsigned int failed;
+	ProgressToken progress;
+	activeProgress.store(&progress);
+	std::signal(SIGINT, cancelOnInterrupt);
+	{
+		//pool is destroyed before the report is written so every worker has finished
+		ThreadPool pool(threads);
+		std::cout << "Running " << jobs.size() << " job(s) on " << pool.getThreadCount() << " thread(s)..." << std::endl;
+
+		//the budget is shared between the jobs that run at the same time
+		for (size_t i = 0; i < jobs.size(); ++i)
+		{
+			jobs[i].memoryBudget = budget / pool.getThreadCount();
+			jobs[i].preview = preview;
+			jobs[i].checkpointInterval = checkpointInterval;
+			jobs[i].progress = &progress;
+			if (staticSpread >= 0)
+				jobs[i].staticPixels = std::make_shared<StaticPixels>(staticSpread);
+		}
+
+		failed = runBatch(jobs, pool, cache);
+	}
+	std::signal(SIGINT, SIG_DFL);
+	activeProgress.store(nullptr);
+
+	writeBatchReport(jobs, std::cout);
+	if (cache != nullptr)
+	{
+		cache->writeStatistics(std::cout);
+		//saves the cache index
+		delete cache;
+	}
+	return failed == 0 ? 0 : 1;
+}
+
+//Conversion mode
+//usage: "Image Maniplulation" --convert <input> <output>
+//ppm and tiled files are converted a band at a time, any other pair through readImage and writeImage
+int runConvertMode(char *argv[])
+{
+	std::string input = argv[2], output = argv[3];
+	bool ok;
+
+	//true if name ends with extension
+	auto endsWith = [](const std::string &name, const std::string &extension)
+	{
+		return name.size() >= extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0;
+	};
+
+	if (endsWith(input, ".ppm") && endsWith(output, ".tim"))
+		ok = ppmToTiled(argv[2], argv[3]);
+	else if (endsWith(input, ".tim") && endsWith(output, ".ppm"))
+		ok = tiledToPPM(argv[2], argv[3]);
+	else
+		ok = writeImage(readImage(argv[2]), argv[3]);
+
+	std::cout << (ok ? "Converted " : "Failed to convert ") << input << " to " << output << std::endl;
+	return ok ? 0 : 1;
+}
+
+//Filter mode
+//usage: "Image Maniplulation" --filter <filter> <input> <output> [threads]
+//filter is box <radius>, gaussian <sigma>, median <3|5> or bilateral <spatial sigma> <range sigma>, see SpatialFilter.h
+//denoises a single frame
+int runFilterMode(int argc, char *argv[])
+{
+	std::string filter = argv[2];
+	//bilateral has two parameters, the rest one
+	int next = filter == "bilateral" ? 5 : 4;
+	if (argc < next + 2 || (filter != "box" && filter != "gaussian" && filter != "median" && filter != "bilateral"))
+	{
+		std::cerr << "usage: " << argv[1] << " <box <radius>|gaussian <sigma>|median <3|5>|bilateral <spatial sigma> <range sigma>> <input> <output> [threads]" << std::endl;
+		return 1;
+	}
+	const char *input = argv[next], *output = argv[next + 1];
+	unsigned int threads = argc > next + 2 ? (unsigned int)std::atoi(argv[next + 2]) : 0;
+
+	Image img = readImage(input);
+	if (img.getSize() == 0)
+		return 1;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Image filtered;
+	if (filter == "box")
+		filtered = boxFilter(img, (unsigned int)std::atoi(argv[3]), threads);
+	else if (filter == "gaussian")
+		filtered = gaussianFilter(img, (float)std::atof(argv[3]), threads);
+	else if (filter == "median")
+		filtered = medianFilter(img, (unsigned int)std::atoi(argv[3]), threads);
+	else
+		filtered = bilateralFilter(img, (float)std::atof(argv[3]), (float)std::atof(argv[4]), threads);
+	int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+	if (filtered.getSize() == 0 || !writeImage(filtered, output))
+		return 1;
+	std::cout << "Filtered " << input << " in " << elapsed << "ms" << std::endl;
+	return 0;
+}
+
+//Daemon mode
+//usage: "Image Maniplulation" --daemon <socket> [cache size in MB] [threads]
+//keeps decoded frames and results in memory between requests, see Daemon.h
+int runDaemonMode(int argc, char *argv[])
+{
+	//1GB unless told otherwise
+	unsigned long long cacheSize = (argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1024) * 1024 * 1024;
+	unsigned int threads = argc > 4 ? (unsigned int)std::atoi(argv[4]) : 0;
+	return runDaemon(argv[2], cacheSize, threads);
+}
+
+//Request mode
+//usage: "Image Maniplulation" --request <socket> <request words>...
+//sends the words as one request line to a running daemon and prints its reply
+int runRequestMode(int argc, char *argv[])
+{
+	std::string request;
+	for (int i = 3; i < argc; ++i)
+		request += (i > 3 ? " " : "") + std::string(argv[i]);
+	return sendRequest(argv[2], request, std::cout);
+}
+
+//Stripe worker mode
+//usage: "Image Maniplulation" --stripe <first row> <rows> <stripe file> <manifest line words>...
+//run by --shard for one stripe of a job, see Shard.h
+int runStripeMode(int argc, char *argv[])
+{
+	std::string line;
+	for (int i = 5; i < argc; ++i)
+		line += (i > 5 ? " " : "") + std::string(argv[i]);
+
+	BatchJob job = parseJob(line, 1);
+	bool ok = runStripe(job, (unsigned int)std::strtoul(argv[2], nullptr, 10), (unsigned int)std::strtoul(argv[3], nullptr, 10), argv[4]);
+	return ok ? 0 : 1;
+}
+
+//Streaming mode
+//usage: "Image Maniplulation" --stream <window> <algorithm> [parameter] <input> <output> [threads]
+//       "Image Maniplulation" --watch <window> <algorithm> [parameter] <input directory> <output directory> [threads]
+//algorithm is mean, median, sigma-iter <iterations> or sigma-tol <tolerence>, see RollingStack.h
+//--stream reads binary pnm frames written one after another from a file or named pipe, - for standard input,
+//and writes a ppm frame for each one to a file or pipe, - for standard output, until its input ends
+//--watch denoises each new ppm file in a directory into the output directory until Ctrl+C
+int runStreamMode(int argc, char *argv[])
+{
+	bool watch = std::string(argv[1]) == "--watch";
+	unsigned int window = (unsigned int)std::atoi(argv[2]);
+	std::string algorithm = argv[3];
+
+	//the algorithm parameter, when there is one, comes before the input
+	int next = 4;
+	RollingAlgorithm rolling = kRollingMean;
+	int iterations = 0;
+	float tolerence = 0;
+	if (algorithm == "median")
+		rolling = kRollingMedian;
+	else if (algorithm == "sigma-iter" && argc > next)
+	{
+		rolling = kRollingSigmaIterations;
+		iterations = std::atoi(argv[next++]);
+	}
+	else if (algorithm == "sigma-tol" && argc > next)
+	{
+		rolling = kRollingSigmaTolerence;
+		tolerence = (float)std::atof(argv[next++]);
+	}
+	else if (algorithm != "mean")
+		next = argc;
+
+	if (window == 0 || argc < next + 2 || (rolling == kRollingSigmaIterations && iterations <= 0) || (rolling == kRollingSigmaTolerence && tolerence <= 0))
+	{
+		std::cerr << "usage: " << argv[1] << " <window> <mean|median|sigma-iter <iterations>|sigma-tol <tolerence>> <input> <output> [threads]" << std::endl;
+		return 1;
+	}
+	std::string input = argv[next], output = argv[next + 1];
+	unsigned int threads = argc > next + 2 ? (unsigned int)std::atoi(argv[next + 2]) : 0;
+	RollingStack stack(window, rolling, iterations, tolerence, threads);
+
+	if (watch)
+	{
+		ProgressToken progress;
+		activeProgress.store(&progress);
+		std::signal(SIGINT, cancelOnInterrupt);
+		bool ok = watchDirectory(stack, input, output, &progress);
+		std::signal(SIGINT, SIG_DFL);
+		activeProgress.store(nullptr);
+		return ok ? 0 : 1;
+	}
+
+	//frames are binary, which standard input and output aren't by default on Windows
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	std::ifstream ifs;
+	std::ofstream ofs;
+	if (input != "-")
+		ifs.open(input.c_str(), std::ios::binary);
+	if (output != "-")
+		ofs.open(output.c_str(), std::ios::binary);
+	if ((input != "-" && ifs.fail()) || (output != "-" && ofs.fail()))
+	{
+		std::cerr << "Can't open " << (input != "-" && ifs.fail() ? input : output) << std::endl;
+		return 1;
+	}
+
+	//a pipe ends when its writer closes it, so Ctrl+C is left to stop the program
+	bool ok = streamFrames(stack, input == "-" ? std::cin : ifs, output == "-" ? std::cout : ofs);
+	return ok ? 0 : 1;
+}
+
+//Sharded mode
+//usage: "Image Maniplulation" --shard <manifest> <stripes> [worker processes] [options]
+//options:	--worker-command <command>	run workers with this command instead of this program, can be given once per host
+//			--retries <count>			times a failed stripe is run again, 2 by default
+//splits every job in the manifest into stripes run by separate processes and returns 0 only if all of them succeeded
+int runShardMode(int argc, char *argv[])
+{
+	ShardOptions options;
+	options.program = argv[0];
+	options.stripes = (unsigned int)std::atoi(argv[3]);
+
+	//positional arguments come first, then options
+	for (int i = 4; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--worker-command" && i + 1 < argc)
+			options.commands.push_back(argv[++i]);
+		else if (arg == "--retries" && i + 1 < argc)
+			options.retries = (unsigned int)std::atoi(argv[++i]);
+		else
+			options.workers = (unsigned int)std::atoi(argv[i]);
+	}
+	//one worker per hardware thread unless told otherwise
+	if (options.workers == 0)
+		options.workers = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<BatchJob> jobs = readManifest(argv[2]);
+	if (jobs.empty())
+	{
+		std::cout << "No jobs found in " << argv[2] << std::endl;
+		return 1;
+	}
+
+	//jobs run one after another, each spread over every worker
+	unsigned int failed = 0;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (!runSharded(jobs[i], options, std::cout))
+			++failed;
+	}
+
+	std::cout << jobs.size() - failed << " of " << jobs.size() << " job(s) succeeded" << std::endl;
+	return failed == 0 ? 0 : 1;
+}
+
+//run an operation taking a progress token while showing its progress on screen
+//Ctrl+C stops the operation at its next row and the program carries on
+template <typename F>
+bool runWithProgress(F operation)
+{
+	ProgressToken progress;
+	activeProgress.store(&progress);
+	std::signal(SIGINT, cancelOnInterrupt);
+
+	bool result;
+	{
+		//monitor is stopped before the handler is removed so the last percentage is written
+		ProgressMonitor monitor(progress, std::cout);
+		result = operation(&progress);
+	}
+
+	std::signal(SIGINT, SIG_DFL);
+	activeProgress.store(nullptr);
+	return result;
+}
+
+int main(int argc, char *argv[])
 {
 	/************************************************************/
 	/*Run in Release x64 for best results using images provided.*/
 	/*			  Target 8.1 SDK using v140 toolkit			    */
 	/************************************************************/
 
+	//batch mode skips every prompt
+	if (argc > 2 && std::string(argv[1]) == "--batch")
+		return runBatchMode(argc, argv);
+	if (argc > 3 && std::string(argv[1]) == "--convert")
+		return runConvertMode(argv);
+	if (argc > 4 && std::string(argv[1]) == "--filter")
+		return runFilterMode(argc, argv);
+	if (argc > 2 && std::string(argv[1]) == "--daemon")
+		return runDaemonMode(argc, argv);
+	if (argc > 3 && std::string(argv[1]) == "--request")
+		return runRequestMode(argc, argv);
+	if (argc > 3 && std::string(argv[1]) == "--shard")
+		return runShardMode(argc, argv);
+	if (argc > 5 && std::string(argv[1]) == "--stripe")
+		return runStripeMode(argc, argv);
+	if (argc > 5 && (std::string(argv[1]) == "--stream" || std::string(argv[1]) == "--watch"))
+		return runStreamMode(argc, argv);
+
 	std::cout << "**********************************" << std::endl;
 	std::cout << "Image Stacker & Image Scaler" << std::endl;
 	std::cout << "**********************************" << std::endl;
@@ -62,11 +445,13 @@ int main()
 	//notify users of image read success
 	std::cout << "\nImages successfully read!\n" << std::endl;
 
+	std::cout << "Press Ctrl+C to cancel an operation.\n" << std::endl;
+
 	//perform mean blending on vector of image pointers
-	meanBlending(images);
+	runWithProgress([&](ProgressToken *progress) { return meanBlending(images, "Mean Blending.ppm", progress); });
 
 	//perform median blending on vector of image pointers
-	medianBlending(images);
+	runWithProgress([&](ProgressToken *progress) { return medianBlending(images, "Median Blending.ppm", progress); });
 
 	//variable for holding user selections
 	int selection;
@@ -95,7 +480,7 @@ int main()
 			{
 				if (iterations > 10)
 					//notify user of consequence if they select a large number
-					std::cout << "This may take a while..." << std::endl;
+					std::cout << "This may take a while - progress is shown below and Ctrl+C cancels." << std::endl;
 				//exit loop
 				break;
 			}
@@ -109,7 +494,7 @@ int main()
 		}
 
 		//perform sigma clipping on vector of image pointers until iteration number is met
-		sigmaClipping(images, iterations);
+		runWithProgress([&](ProgressToken *progress) { return sigmaClipping(images, iterations, "Sigma Clipping Iterations.ppm", progress); });
 		//exit switch
 		break;
 	//enters '2'
@@ -139,7 +524,7 @@ int main()
 		}
 
 		//perform sigma clipping on vector of image pointers until tolerence number is met
-		sigmaClipping(images, tolerence);
+		runWithProgress([&](ProgressToken *progress) { return sigmaClipping(images, tolerence, "Sigma Clipping Tolerence.ppm", progress); });
 		//exit switch
 		break;
 	//else
@@ -209,14 +594,14 @@ int main()
 		//set zoom variable for object to selected value
 		zoom->setZoom(2);
 		//perform NN algorithm on zoom to scale x2
-		nearestNeigbourZoom(zoom, 2);
+		runWithProgress([&](ProgressToken *progress) { return nearestNeigbourZoom(zoom, 2, nullptr, progress); });
 		break;
 	//enter '2'
 	case 2:
 		//set zoom variable for object to selected value
 		zoom->setZoom(4);
 		//perform NN algorithm on zoom to scale x4
-		nearestNeigbourZoom(zoom, 4);
+		runWithProgress([&](ProgressToken *progress) { return nearestNeigbourZoom(zoom, 4, nullptr, progress); });
 		break;
 	//else
 	default:
@@ -235,6 +620,8 @@ int main()
 	//deallocate memory used by zoom
 	delete zoom;
 
+	//logs are written in the background - wait for them before saying they are there
+	flushLogs();
 	//alert user of log generation for image and imageZoom class
 	std::cout << "Logs have been generated and are available within the 'Logs' directory." << std::endl;
 
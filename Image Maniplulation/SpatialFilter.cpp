@@ -0,0 +1,622 @@
+#include "SpatialFilter.h"
+#include "PerfCounters.h"
+#include <algorithm> //clamp rows and columns to the image
+#include <vector> //tables, grids and buffered rows
+#include <thread> //share bands between threads
+#include <atomic> //hand out bands to threads
+#include <functional> //pass bands to threads
+#include <cmath> //gaussian weights
+#include <cstdio> //report invalid parameters
+
+//SSE2 is always there on x64 and is switched on by most x86 compilers
+#if defined(_M_X64) || defined(__SSE2__)
+#define FILTER_SSE
+#include <emmintrin.h>
+#endif
+
+//output rows a thread takes at a time
+static const unsigned int kFilterBandRows = 32;
+//pixels below which threads cost more than they save
+static const unsigned long long kMinThreadPixels = 16384;
+
+//***Bands***
+
+//Run filterBand on bands of rows [first, last) until every row is done, bands are handed out in order as threads finish their last
+//pixels is the work in the whole job, so small jobs run on the calling thread alone
+static void forEachBand(unsigned int rows, unsigned int bandRows, unsigned long long pixels, unsigned int threads, const std::function<void(unsigned int, unsigned int)> &filterBand)
+{
+	unsigned int bands = (rows + bandRows - 1) / bandRows;
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = (unsigned int)std::min<unsigned long long>(threads, std::max(1ull, std::min<unsigned long long>(bands, pixels / kMinThreadPixels)));
+
+	std::atomic<unsigned int> nextBand(0);
+	auto work = [&]()
+	{
+		unsigned int band;
+		while ((band = nextBand++) < bands)
+			filterBand(band * bandRows, std::min(rows, (band + 1) * bandRows));
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads; ++i)
+		workers.push_back(std::thread(work));
+	work();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+//Copy row y of img into padded with border copies of the edge pixels either side, (width + 2 x border) pixels in all
+//a channel's neighbour d pixels along is then always 3 x d floats along, whichever channel and whichever pixel
+static void padRow(const Image &img, unsigned int y, unsigned int border, float *padded)
+{
+	unsigned int w = img.getWidth();
+	const Image::Rgb *row = img.getPixels() + (size_t)y * w;
+	Image::Rgb *out = reinterpret_cast<Image::Rgb *>(padded);
+	for (unsigned int x = 0; x < border; ++x)
+	{
+		out[x] = row[0];
+		out[border + w + x] = row[w - 1];
+	}
+	std::copy(row, row + w, out + border);
+}
+
+//row y moved along by offset, kept inside the image
+static unsigned int clampRow(unsigned int y, int offset, unsigned int h)
+{
+	long long row = (long long)y + offset;
+	return (unsigned int)std::max(0ll, std::min((long long)h - 1, row));
+}
+
+//Check an image can be filtered and make the output for it
+static bool startFilter(const Image &img, Image &output)
+{
+	if (img.getSize() == 0)
+	{
+		fprintf(stderr, "Can't filter an empty image\n");
+		return false;
+	}
+	output = Image(img.getWidth(), img.getHeight());
+	output.setBitDepth(img.getBitDepth());
+	output.setName(img.getName());
+	return true;
+}
+
+//***Box Filter***
+
+//add the row above into a row of the summed-area table
+static void addAbove(double *row, const double *above, size_t n)
+{
+	size_t i = 0;
+#ifdef FILTER_SSE
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_pd(row + i, _mm_add_pd(_mm_loadu_pd(row + i), _mm_loadu_pd(above + i)));
+#endif
+	for (; i < n; ++i)
+		row[i] += above[i];
+}
+
+//set difference to the lower row of the summed-area table minus the upper row
+static void subtractRows(double *difference, const double *lower, const double *upper, size_t n)
+{
+	size_t i = 0;
+#ifdef FILTER_SSE
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_pd(difference + i, _mm_sub_pd(_mm_loadu_pd(lower + i), _mm_loadu_pd(upper + i)));
+#endif
+	for (; i < n; ++i)
+		difference[i] = lower[i] - upper[i];
+}
+
+//Box filter output rows [first, last)
+//the table only covers the rows the band reads, which keeps it small and its sums close to the size of the values summed
+//entry x of a table row is the sum of every pixel above it and to its left, so any rectangle is 4 lookups whatever its size
+static void boxBand(const Image &img, Image &output, unsigned int radius, unsigned int first, unsigned int last, std::vector<double> &table, std::vector<double> &columns)
+{
+	unsigned int w = img.getWidth(), h = img.getHeight();
+	unsigned int top = first > radius ? first - radius : 0;
+	unsigned int bottom = (unsigned int)std::min<unsigned long long>(h, (unsigned long long)last + radius);
+
+	//a row and a column of zeros come first
+	size_t stride = ((size_t)w + 1) * 3;
+	table.assign((size_t)(bottom - top + 1) * stride, 0);
+	for (unsigned int y = top; y < bottom; ++y)
+	{
+		const Image::Rgb *src = img.getPixels() + (size_t)y * w;
+		double *row = table.data() + (size_t)(y - top + 1) * stride;
+		double r = 0, g = 0, b = 0;
+		for (unsigned int x = 0; x < w; ++x)
+		{
+			row[(x + 1) * 3] = r += src[x].r;
+			row[(x + 1) * 3 + 1] = g += src[x].g;
+			row[(x + 1) * 3 + 2] = b += src[x].b;
+		}
+		addAbove(row, row - stride, stride);
+	}
+
+	columns.resize(stride);
+	for (unsigned int y = first; y < last; ++y)
+	{
+		//rows [y - radius, y + radius] that are inside the image, as table rows
+		unsigned int y1 = (y > radius ? y - radius : 0) - top;
+		unsigned int y2 = (unsigned int)std::min<unsigned long long>(h, (unsigned long long)y + radius + 1) - top;
+
+		//sums of the pixels in those rows left of each column
+		subtractRows(columns.data(), table.data() + (size_t)y2 * stride, table.data() + (size_t)y1 * stride, stride);
+		const double *sums = columns.data();
+		float *out = reinterpret_cast<float *>(output.getPixels() + (size_t)y * w);
+		double rows = y2 - y1;
+
+		//pixels near the left and right edges average fewer columns
+		auto edgePixel = [&](unsigned int x)
+		{
+			unsigned int x1 = x > radius ? x - radius : 0;
+			unsigned int x2 = (unsigned int)std::min<unsigned long long>(w, (unsigned long long)x + radius + 1);
+			double scale = 1 / (rows * (x2 - x1));
+			for (unsigned int c = 0; c < 3; ++c)
+				out[x * 3 + c] = (float)((sums[x2 * 3 + c] - sums[x1 * 3 + c]) * scale);
+		};
+
+		//every pixel in between averages the full width, so a channel is the difference of two sums 2 x radius + 1 pixels apart
+		unsigned int inner = std::min(w, radius);
+		unsigned int innerEnd = w > 2 * (unsigned long long)radius ? w - radius : inner;
+		for (unsigned int x = 0; x < inner; ++x)
+			edgePixel(x);
+		size_t i = (size_t)inner * 3, end = (size_t)innerEnd * 3;
+		size_t ahead = ((size_t)radius + 1) * 3, behind = (size_t)radius * 3;
+		double scale = 1 / (rows * (2 * (double)radius + 1));
+#ifdef FILTER_SSE
+		__m128d s = _mm_set1_pd(scale);
+		for (; i + 2 <= end; i += 2)
+		{
+			__m128d box = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(sums + i + ahead), _mm_loadu_pd(sums + i - behind)), s);
+			_mm_storel_pi(reinterpret_cast<__m64 *>(out + i), _mm_cvtpd_ps(box));
+		}
+#endif
+		for (; i < end; ++i)
+			out[i] = (float)((sums[i + ahead] - sums[i - behind]) * scale);
+		for (unsigned int x = innerEnd; x < w; ++x)
+			edgePixel(x);
+	}
+}
+
+//box filter of a whole image
+Image boxFilter(const Image &img, unsigned int radius, unsigned int threads)
+{
+	Image output;
+	if (!startFilter(img, output))
+		return Image();
+	PERF_STAGE("box filter", img.getSize() * 2 * sizeof(Image::Rgb));
+
+	//a bigger radius than the image averages the same pixels
+	radius = std::min(radius, std::max(img.getWidth(), img.getHeight()));
+	//bands at least as tall as the rows read around them, so each image row is summed at most twice
+	unsigned int bandRows = std::max(kFilterBandRows, 2 * radius);
+
+	forEachBand(img.getHeight(), bandRows, img.getSize(), threads, [&](unsigned int first, unsigned int last)
+	{
+		std::vector<double> table, columns;
+		boxBand(img, output, radius, first, last, table, columns);
+	});
+	return output;
+}
+
+//***Gaussian Filter***
+
+//set sum to weight * row
+static void setRow(float *sum, const float *row, float weight, size_t n)
+{
+	size_t i = 0;
+#ifdef FILTER_SSE
+	__m128 w = _mm_set1_ps(weight);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(sum + i, _mm_mul_ps(_mm_loadu_ps(row + i), w));
+#endif
+	for (; i < n; ++i)
+		sum[i] = row[i] * weight;
+}
+
+//accumulate weight * row into sum
+static void addRow(float *sum, const float *row, float weight, size_t n)
+{
+	size_t i = 0;
+#ifdef FILTER_SSE
+	__m128 w = _mm_set1_ps(weight);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+#endif
+	for (; i < n; ++i)
+		sum[i] += row[i] * weight;
+}
+
+//Gaussian filter output rows [first, last)
+//the rows the band reads are blurred horizontally first, then each output row is the weighted sum of the blurred rows around it
+static void gaussianBand(const Image &img, Image &output, const std::vector<float> &weights, unsigned int first, unsigned int last, std::vector<float> &padded, std::vector<float> &blurred)
+{
+	unsigned int w = img.getWidth(), h = img.getHeight();
+	unsigned int radius = (unsigned int)weights.size() / 2;
+	unsigned int top = first > radius ? first - radius : 0;
+	unsigned int bottom = (unsigned int)std::min<unsigned long long>(h, (unsigned long long)last + radius);
+	size_t floats = (size_t)w * 3;
+
+	padded.resize(((size_t)w + 2 * radius) * 3);
+	blurred.resize((size_t)(bottom - top) * floats);
+	for (unsigned int y = top; y < bottom; ++y)
+	{
+		padRow(img, y, radius, padded.data());
+		const float *src = padded.data();
+		float *row = blurred.data() + (size_t)(y - top) * floats;
+
+		//weighted sum of the same channel of the pixels either side, 4 floats at a time
+		size_t i = 0;
+#ifdef FILTER_SSE
+		for (; i + 4 <= floats; i += 4)
+		{
+			__m128 total = _mm_setzero_ps();
+			for (size_t k = 0; k < weights.size(); ++k)
+				total = _mm_add_ps(total, _mm_mul_ps(_mm_loadu_ps(src + i + k * 3), _mm_set1_ps(weights[k])));
+			_mm_storeu_ps(row + i, total);
+		}
+#endif
+		for (; i < floats; ++i)
+		{
+			float total = 0;
+			for (size_t k = 0; k < weights.size(); ++k)
+				total += src[i + k * 3] * weights[k];
+			row[i] = total;
+		}
+	}
+
+	for (unsigned int y = first; y < last; ++y)
+	{
+		float *out = reinterpret_cast<float *>(output.getPixels() + (size_t)y * w);
+		for (size_t k = 0; k < weights.size(); ++k)
+		{
+			const float *row = blurred.data() + (size_t)(clampRow(y, (int)k - (int)radius, h) - top) * floats;
+			if (k == 0)
+				setRow(out, row, weights[k], floats);
+			else
+				addRow(out, row, weights[k], floats);
+		}
+	}
+}
+
+//gaussian filter of a whole image
+//returns an empty image if sigma isn't positive
+Image gaussianFilter(const Image &img, float sigma, unsigned int threads)
+{
+	Image output;
+	if (!(sigma > 0))
+	{
+		fprintf(stderr, "Gaussian sigma must be above 0\n");
+		return Image();
+	}
+	if (!startFilter(img, output))
+		return Image();
+	PERF_STAGE("gaussian filter", img.getSize() * 2 * sizeof(Image::Rgb));
+
+	//weights out to 3 sigma, beyond which they are too small to change an 8 bit result, adding up to 1
+	unsigned int radius = (unsigned int)std::ceil(3 * sigma);
+	std::vector<float> weights(2 * radius + 1);
+	double total = 0;
+	for (unsigned int k = 0; k < weights.size(); ++k)
+	{
+		double d = (double)k - radius;
+		weights[k] = (float)std::exp(-d * d / (2.0 * sigma * sigma));
+		total += weights[k];
+	}
+	for (unsigned int k = 0; k < weights.size(); ++k)
+		weights[k] = (float)(weights[k] / total);
+
+	unsigned int bandRows = std::max(kFilterBandRows, 2 * radius);
+	forEachBand(img.getHeight(), bandRows, img.getSize(), threads, [&](unsigned int first, unsigned int last)
+	{
+		std::vector<float> padded, blurred;
+		gaussianBand(img, output, weights, first, last, padded, blurred);
+	});
+	return output;
+}
+
+//***Median Filter***
+
+//compare and exchange, leaving the smaller value in a and the larger in b
+static inline void sortPair(float &a, float &b)
+{
+	float smaller = std::min(a, b);
+	b = std::max(a, b);
+	a = smaller;
+}
+
+#ifdef FILTER_SSE
+//4 compare and exchanges at once
+static inline void sortPair(__m128 &a, __m128 &b)
+{
+	__m128 smaller = _mm_min_ps(a, b);
+	b = _mm_max_ps(a, b);
+	a = smaller;
+}
+#endif
+
+//Median of 9 values, reordering them, by a network of 19 compare and exchanges (Paeth)
+//the same operations whatever the values, so 4 medians are found at once with SSE
+template <typename T>
+static T median9(T *p)
+{
+	sortPair(p[1], p[2]); sortPair(p[4], p[5]); sortPair(p[7], p[8]);
+	sortPair(p[0], p[1]); sortPair(p[3], p[4]); sortPair(p[6], p[7]);
+	sortPair(p[1], p[2]); sortPair(p[4], p[5]); sortPair(p[7], p[8]);
+	sortPair(p[0], p[3]); sortPair(p[5], p[8]); sortPair(p[4], p[7]);
+	sortPair(p[3], p[6]); sortPair(p[1], p[4]); sortPair(p[2], p[5]);
+	sortPair(p[4], p[7]); sortPair(p[4], p[2]); sortPair(p[6], p[4]);
+	sortPair(p[4], p[2]);
+	return p[4];
+}
+
+//Median of 25 values, reordering them, by a network of 99 compare and exchanges (Devillard)
+template <typename T>
+static T median25(T *p)
+{
+	sortPair(p[0], p[1]); sortPair(p[3], p[4]); sortPair(p[2], p[4]); sortPair(p[2], p[3]); sortPair(p[6], p[7]);
+	sortPair(p[5], p[7]); sortPair(p[5], p[6]); sortPair(p[9], p[10]); sortPair(p[8], p[10]); sortPair(p[8], p[9]);
+	sortPair(p[12], p[13]); sortPair(p[11], p[13]); sortPair(p[11], p[12]); sortPair(p[15], p[16]); sortPair(p[14], p[16]);
+	sortPair(p[14], p[15]); sortPair(p[18], p[19]); sortPair(p[17], p[19]); sortPair(p[17], p[18]); sortPair(p[21], p[22]);
+	sortPair(p[20], p[22]); sortPair(p[20], p[21]); sortPair(p[23], p[24]); sortPair(p[2], p[5]); sortPair(p[3], p[6]);
+	sortPair(p[0], p[6]); sortPair(p[0], p[3]); sortPair(p[4], p[7]); sortPair(p[1], p[7]); sortPair(p[1], p[4]);
+	sortPair(p[11], p[14]); sortPair(p[8], p[14]); sortPair(p[8], p[11]); sortPair(p[12], p[15]); sortPair(p[9], p[15]);
+	sortPair(p[9], p[12]); sortPair(p[13], p[16]); sortPair(p[10], p[16]); sortPair(p[10], p[13]); sortPair(p[20], p[23]);
+	sortPair(p[17], p[23]); sortPair(p[17], p[20]); sortPair(p[21], p[24]); sortPair(p[18], p[24]); sortPair(p[18], p[21]);
+	sortPair(p[19], p[22]); sortPair(p[8], p[17]); sortPair(p[9], p[18]); sortPair(p[0], p[18]); sortPair(p[0], p[9]);
+	sortPair(p[10], p[19]); sortPair(p[1], p[19]); sortPair(p[1], p[10]); sortPair(p[11], p[20]); sortPair(p[2], p[20]);
+	sortPair(p[2], p[11]); sortPair(p[12], p[21]); sortPair(p[3], p[21]); sortPair(p[3], p[12]); sortPair(p[13], p[22]);
+	sortPair(p[4], p[22]); sortPair(p[4], p[13]); sortPair(p[14], p[23]); sortPair(p[5], p[23]); sortPair(p[5], p[14]);
+	sortPair(p[15], p[24]); sortPair(p[6], p[24]); sortPair(p[6], p[15]); sortPair(p[7], p[16]); sortPair(p[7], p[19]);
+	sortPair(p[13], p[21]); sortPair(p[15], p[23]); sortPair(p[7], p[13]); sortPair(p[7], p[15]); sortPair(p[1], p[9]);
+	sortPair(p[3], p[11]); sortPair(p[5], p[17]); sortPair(p[11], p[17]); sortPair(p[9], p[17]); sortPair(p[4], p[10]);
+	sortPair(p[6], p[12]); sortPair(p[7], p[14]); sortPair(p[4], p[6]); sortPair(p[4], p[7]); sortPair(p[12], p[14]);
+	sortPair(p[10], p[14]); sortPair(p[6], p[7]); sortPair(p[10], p[12]); sortPair(p[6], p[10]); sortPair(p[6], p[17]);
+	sortPair(p[12], p[17]); sortPair(p[7], p[17]); sortPair(p[7], p[10]); sortPair(p[12], p[18]); sortPair(p[7], p[12]);
+	sortPair(p[10], p[18]); sortPair(p[12], p[20]); sortPair(p[10], p[20]); sortPair(p[10], p[12]);
+	return p[12];
+}
+
+//Median filter output rows [first, last) over a Size x Size square
+//the rows the band reads are padded once, then every float's neighbours are at fixed offsets from it
+template <unsigned int Size>
+static void medianBand(const Image &img, Image &output, unsigned int first, unsigned int last, std::vector<float> &padded)
+{
+	const unsigned int radius = Size / 2;
+	unsigned int w = img.getWidth(), h = img.getHeight();
+	unsigned int top = first > radius ? first - radius : 0;
+	unsigned int bottom = std::min(h, last + radius);
+	size_t floats = (size_t)w * 3, paddedFloats = ((size_t)w + 2 * radius) * 3;
+
+	padded.resize((size_t)(bottom - top) * paddedFloats);
+	for (unsigned int y = top; y < bottom; ++y)
+		padRow(img, y, radius, padded.data() + (size_t)(y - top) * paddedFloats);
+
+	const float *rows[Size];
+	for (unsigned int y = first; y < last; ++y)
+	{
+		for (unsigned int k = 0; k < Size; ++k)
+			rows[k] = padded.data() + (size_t)(clampRow(y, (int)k - (int)radius, h) - top) * paddedFloats;
+		float *out = reinterpret_cast<float *>(output.getPixels() + (size_t)y * w);
+
+		size_t i = 0;
+#ifdef FILTER_SSE
+		__m128 window[Size * Size];
+		for (; i + 4 <= floats; i += 4)
+		{
+			for (unsigned int dy = 0; dy < Size; ++dy)
+				for (unsigned int dx = 0; dx < Size; ++dx)
+					window[dy * Size + dx] = _mm_loadu_ps(rows[dy] + i + dx * 3);
+			_mm_storeu_ps(out + i, Size == 3 ? median9(window) : median25(window));
+		}
+#endif
+		float samples[Size * Size];
+		for (; i < floats; ++i)
+		{
+			for (unsigned int dy = 0; dy < Size; ++dy)
+				for (unsigned int dx = 0; dx < Size; ++dx)
+					samples[dy * Size + dx] = rows[dy][i + dx * 3];
+			out[i] = Size == 3 ? median9(samples) : median25(samples);
+		}
+	}
+}
+
+//median filter of a whole image
+//returns an empty image unless size is 3 or 5
+Image medianFilter(const Image &img, unsigned int size, unsigned int threads)
+{
+	Image output;
+	if (size != 3 && size != 5)
+	{
+		fprintf(stderr, "Median filter size must be 3 or 5\n");
+		return Image();
+	}
+	if (!startFilter(img, output))
+		return Image();
+	PERF_STAGE("median filter", img.getSize() * 2 * sizeof(Image::Rgb));
+
+	forEachBand(img.getHeight(), kFilterBandRows, img.getSize(), threads, [&](unsigned int first, unsigned int last)
+	{
+		std::vector<float> padded;
+		if (size == 3)
+			medianBand<3>(img, output, first, last, padded);
+		else
+			medianBand<5>(img, output, first, last, padded);
+	});
+	return output;
+}
+
+//***Bilateral Filter***
+
+//cells around the grid that the blur and the interpolation can read beyond the cells pixels are added to
+static const int kGridPadding = 2;
+//largest grid allowed, as a multiple of the size of the image
+static const unsigned long long kMaxGridScale = 4;
+
+//Rec. 601 luma, the same weights as the luma guided blends
+static float pixelLuma(const Image::Rgb &p)
+{
+	return std::max(0.f, std::min(1.f, 0.299f * p.r + 0.587f * p.g + 0.114f * p.b));
+}
+
+//Bilateral grid over x, y and luma, with a cell per sigma along each
+//every cell holds the sums of r, g and b and the number of pixels added, 4 floats that SSE handles as one
+struct BilateralGrid
+{
+	int width, height, depth; //cells along x, y and luma
+	std::vector<float> cells; //4 floats per cell, luma varies fastest so a cell and the next along luma are neighbours
+
+	size_t index(int x, int y, int z) const
+	{
+		return (((size_t)y * width + x) * depth + z) * 4;
+	}
+};
+
+//Blur the grid along one axis (0 = x, 1 = y, 2 = luma) with the binomial kernel 1 4 6 4 1, close to a gaussian of one cell
+//cells beyond the grid count as empty
+static void blurGrid(const BilateralGrid &in, BilateralGrid &out, int axis, unsigned int threads)
+{
+	static const float kBlur[5] = { 1 / 16.f, 4 / 16.f, 6 / 16.f, 4 / 16.f, 1 / 16.f };
+	std::ptrdiff_t stride = axis == 0 ? (std::ptrdiff_t)in.depth * 4 : axis == 1 ? (std::ptrdiff_t)in.width * in.depth * 4 : 4;
+	int length = axis == 0 ? in.width : axis == 1 ? in.height : in.depth;
+
+	forEachBand(in.height, 1, (unsigned long long)in.cells.size() / 4, threads, [&](unsigned int first, unsigned int last)
+	{
+		for (int y = (int)first; y < (int)last; ++y)
+			for (int x = 0; x < in.width; ++x)
+				for (int z = 0; z < in.depth; ++z)
+				{
+					int position = axis == 0 ? x : axis == 1 ? y : z;
+					size_t cell = in.index(x, y, z);
+					const float *src = in.cells.data() + cell;
+#ifdef FILTER_SSE
+					__m128 total = _mm_setzero_ps();
+					for (int k = 0; k < 5; ++k)
+						if (position + k - 2 >= 0 && position + k - 2 < length)
+							total = _mm_add_ps(total, _mm_mul_ps(_mm_loadu_ps(src + (k - 2) * stride), _mm_set1_ps(kBlur[k])));
+					_mm_storeu_ps(out.cells.data() + cell, total);
+#else
+					float total[4] = { 0, 0, 0, 0 };
+					for (int k = 0; k < 5; ++k)
+						if (position + k - 2 >= 0 && position + k - 2 < length)
+							for (int c = 0; c < 4; ++c)
+								total[c] += src[(k - 2) * stride + c] * kBlur[k];
+					std::copy(total, total + 4, out.cells.data() + cell);
+#endif
+				}
+	});
+}
+
+//bilateral grid filter of a whole image
+//returns an empty image if the spatial sigma is below 1, the range sigma isn't in (0, 1] or the grid would be too big
+Image bilateralFilter(const Image &img, float spatial, float range, unsigned int threads)
+{
+	Image output;
+	if (!(spatial >= 1) || !(range > 0 && range <= 1))
+	{
+		fprintf(stderr, "Bilateral spatial sigma must be at least 1 and range sigma between 0 and 1\n");
+		return Image();
+	}
+	if (!startFilter(img, output))
+		return Image();
+	PERF_STAGE("bilateral filter", img.getSize() * 3 * sizeof(Image::Rgb));
+	unsigned int w = img.getWidth(), h = img.getHeight();
+
+	BilateralGrid grid;
+	grid.width = (int)((w - 1) / spatial) + 1 + 2 * kGridPadding;
+	grid.height = (int)((h - 1) / spatial) + 1 + 2 * kGridPadding;
+	grid.depth = (int)(1 / range) + 1 + 2 * kGridPadding;
+	unsigned long long cells = (unsigned long long)grid.width * grid.height * grid.depth;
+	if (cells * 4 * sizeof(float) > kMaxGridScale * img.getSize() * sizeof(Image::Rgb) + (1 << 20))
+	{
+		fprintf(stderr, "Bilateral grid would be too big, use a larger spatial or range sigma\n");
+		return Image();
+	}
+	grid.cells.assign((size_t)cells * 4, 0);
+
+	//first image row added to each grid row, so threads can take grid rows without adding to the same cell
+	std::vector<unsigned int> rowStart(grid.height + 1, h);
+	for (unsigned int y = h; y-- > 0;)
+		rowStart[(int)(y / spatial + 0.5f) + kGridPadding] = y;
+	for (int g = grid.height - 1; g >= 0; --g)
+		rowStart[g] = std::min(rowStart[g], rowStart[g + 1]);
+
+	//add every pixel to its nearest cell
+	forEachBand(grid.height, 1, img.getSize(), threads, [&](unsigned int first, unsigned int last)
+	{
+		for (unsigned int y = rowStart[first]; y < rowStart[last]; ++y)
+		{
+			int gy = (int)(y / spatial + 0.5f) + kGridPadding;
+			const Image::Rgb *row = img.getPixels() + (size_t)y * w;
+			for (unsigned int x = 0; x < w; ++x)
+			{
+				int gx = (int)(x / spatial + 0.5f) + kGridPadding;
+				int gz = (int)(pixelLuma(row[x]) / range + 0.5f) + kGridPadding;
+				float *cell = grid.cells.data() + grid.index(gx, gy, gz);
+#ifdef FILTER_SSE
+				_mm_storeu_ps(cell, _mm_add_ps(_mm_loadu_ps(cell), _mm_set_ps(1, row[x].b, row[x].g, row[x].r)));
+#else
+				cell[0] += row[x].r;
+				cell[1] += row[x].g;
+				cell[2] += row[x].b;
+				cell[3] += 1;
+#endif
+			}
+		}
+	});
+
+	//blur along each axis in turn, ending back in grid
+	BilateralGrid blurred = grid;
+	blurGrid(grid, blurred, 0, threads);
+	blurGrid(blurred, grid, 1, threads);
+	blurGrid(grid, blurred, 2, threads);
+	grid.cells.swap(blurred.cells);
+
+	//read every pixel back from the 8 cells around its position, weighted by how close it is to each
+	forEachBand(h, kFilterBandRows, img.getSize(), threads, [&](unsigned int first, unsigned int last)
+	{
+		for (unsigned int y = first; y < last; ++y)
+		{
+			float fy = y / spatial + kGridPadding;
+			int gy = (int)fy;
+			float ty = fy - gy;
+			const Image::Rgb *row = img.getPixels() + (size_t)y * w;
+			Image::Rgb *out = output.getPixels() + (size_t)y * w;
+			for (unsigned int x = 0; x < w; ++x)
+			{
+				float fx = x / spatial + kGridPadding, fz = pixelLuma(row[x]) / range + kGridPadding;
+				int gx = (int)fx, gz = (int)fz;
+				float tx = fx - gx, tz = fz - gz;
+				float sum[4];
+#ifdef FILTER_SSE
+				__m128 total = _mm_setzero_ps();
+				for (int corner = 0; corner < 8; ++corner)
+				{
+					int dx = corner & 1, dy = (corner >> 1) & 1, dz = corner >> 2;
+					float weight = (dx ? tx : 1 - tx) * (dy ? ty : 1 - ty) * (dz ? tz : 1 - tz);
+					total = _mm_add_ps(total, _mm_mul_ps(_mm_loadu_ps(grid.cells.data() + grid.index(gx + dx, gy + dy, gz + dz)), _mm_set1_ps(weight)));
+				}
+				_mm_storeu_ps(sum, total);
+#else
+				std::fill(sum, sum + 4, 0.f);
+				for (int corner = 0; corner < 8; ++corner)
+				{
+					int dx = corner & 1, dy = (corner >> 1) & 1, dz = corner >> 2;
+					float weight = (dx ? tx : 1 - tx) * (dy ? ty : 1 - ty) * (dz ? tz : 1 - tz);
+					const float *cell = grid.cells.data() + grid.index(gx + dx, gy + dy, gz + dz);
+					for (int c = 0; c < 4; ++c)
+						sum[c] += cell[c] * weight;
+				}
+#endif
+				//a pixel unlike anything around it keeps its own value
+				if (sum[3] > 0)
+					out[x] = Image::Rgb(sum[0] / sum[3], sum[1] / sum[3], sum[2] / sum[3]);
+				else
+					out[x] = row[x];
+			}
+		}
+	});
+	return output;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "Image.h"
+
+//Spatial noise reduction of a single frame
+//Every filter returns a new image the same size as the one it is given, or an empty image if its parameters are invalid
+//Output rows are split into bands shared between threads (0 = one per hardware thread), each band reading the rows around
+//it that its pixels need, and the inner loops work on 4 floats at a time with SSE where available
+//Pixels beyond the edges repeat the edge pixels, except for the box filter which only averages pixels inside the image
+
+//mean of the (2 x radius + 1) square around each pixel, read from a summed-area table so the cost per pixel doesn't depend on the radius
+Image boxFilter(const Image &, unsigned int, unsigned int = 0); //radius, threads
+
+//gaussian weighted mean out to 3 sigma, as a horizontal pass and then a vertical pass
+Image gaussianFilter(const Image &, float, unsigned int = 0); //sigma in pixels, threads
+
+//median of each channel over the 3x3 or 5x5 square by a fixed network of min and max operations, so there are no branches to mispredict
+//removes hot pixels and salt and pepper noise while keeping edges
+Image medianFilter(const Image &, unsigned int, unsigned int = 0); //size 3 or 5, threads
+
+//edge preserving smoothing - only pixels of similar luma are averaged together
+//approximated with a bilateral grid: pixels are added into a coarse grid over position and luma, which is blurred and then read back
+//by interpolating between cells, so the cost per pixel doesn't depend on the spatial sigma
+Image bilateralFilter(const Image &, float, float, unsigned int = 0); //spatial sigma in pixels, range sigma in luma (0 - 1), threads
@@ -0,0 +1,57 @@
+#include "ThreadPool.h"
+#include <algorithm> //max thread count
+
+//constructor
+//starts the requested number of workers, or one per hardware thread
+ThreadPool::ThreadPool(unsigned int threads) :
+	stopping(false)
+{
+	//hardware_concurrency can return 0 if it is unknown
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned int i = 0; i < threads; ++i)
+		workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+//destructor
+//lets the workers empty the queue and then joins them
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+//worker loop - take the next task from the queue and run it
+void ThreadPool::work()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			//sleep until there is work or the pool is shutting down
+			condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			//only exit once every queued task has been run
+			if (stopping && tasks.empty())
+				return;
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		//run task outside of the lock so other workers can continue
+		task();
+	}
+}
+
+unsigned int ThreadPool::getThreadCount() const
+{
+	return (unsigned int)workers.size();
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector> //hold worker threads
+#include <queue> //hold waiting tasks
+#include <thread> //run worker threads
+#include <mutex> //guard task queue
+#include <condition_variable> //wake sleeping workers
+#include <functional> //store tasks of any type
+#include <future> //return task results
+#include <memory> //share packaged tasks with the queue
+
+//Fixed size pool of worker threads
+//the number of workers is the limit on how many tasks can run at the same time
+class ThreadPool
+{
+public:
+	//ThreadPool constructors
+	explicit ThreadPool(unsigned int = 0); //0 = one worker per hardware thread
+	ThreadPool(const ThreadPool &) = delete; //threads can't be copied
+
+	//ThreadPool destructor - waits for queued tasks to finish
+	~ThreadPool();
+
+	//ThreadPool operator overloads
+	ThreadPool& operator=(const ThreadPool &) = delete;
+
+	//ThreadPool member functions
+	template <typename F>
+	std::future<typename std::result_of<F()>::type> submit(F);
+
+	//Getter functions
+	unsigned int getThreadCount() const;
+
+private:
+	void work(); //loop run by each worker
+
+	std::vector<std::thread> workers; //worker threads
+	std::queue<std::function<void()>> tasks; //tasks waiting for a worker
+	std::mutex queueMutex; //guards tasks and stopping
+	std::condition_variable condition; //signals new tasks or shutdown
+	bool stopping; //set when the pool is destroyed
+};
+
+//queue a task and return a future holding its result
+//template defined in header so that it can be used with any callable
+template <typename F>
+std::future<typename std::result_of<F()>::type> ThreadPool::submit(F f)
+{
+	typedef typename std::result_of<F()>::type Result;
+
+	//packaged task is move only so it is shared to fit inside std::function
+	std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::move(f));
+	std::future<Result> result = task->get_future();
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		tasks.push([task]() { (*task)(); });
+	}
+	//wake one sleeping worker
+	condition.notify_one();
+
+	return result;
+}
@@ -0,0 +1,414 @@
+#include "TilePlanner.h"
+#include "ImageZoom.h"
+#include "PPMWriter.h"
+#include <thread> //process bands concurrently
+#include <atomic> //share band counter and memory meter between threads
+#include <algorithm> //min and max
+#include <new> //catch bad_alloc
+#include <fstream> //read and reset the memory use of the process
+#include <string> //lines of the process status
+#include <cstring> //match status fields
+#include <cstdlib> //parse status fields
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h> //physical memory size
+#include <psapi.h> //memory use of the process
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h> //physical memory size
+#include <sys/resource.h> //peak memory use of the process
+#endif
+
+//bytes set aside for each thread's stack and per-pixel scratch vectors
+static const unsigned long long kThreadOverhead = 256 * 1024;
+//smallest band worth giving its own thread - smaller bands spend their time seeking
+static const unsigned int kMinBandRows = 8;
+#ifdef __linux__
+//container memory limits this high are cgroup v1's way of saying there isn't one
+static const unsigned long long kMaxCgroupLimit = 1ull << 50;
+#endif
+
+//***Tile Plan Structure***
+
+//default constructor - empty plan that can't be run
+TilePlan::TilePlan() :
+	bandRows(0),
+	concurrency(0),
+	buffers(0),
+	bands(0),
+	splits(0),
+	budget(0),
+	predictedPeak(0),
+	actualPeak(0)
+{}
+
+//***Process Memory***
+
+#ifdef __linux__
+//Read a size in kB from /proc/self/status, eg. "VmHWM:    123456 kB", 0 if it isn't there
+static unsigned long long statusBytes(const char *field)
+{
+	std::ifstream ifs("/proc/self/status");
+	std::string line;
+	size_t length = strlen(field);
+	while (std::getline(ifs, line))
+	{
+		if (line.compare(0, length, field) == 0)
+			return strtoull(line.c_str() + length, nullptr, 10) * 1024;
+	}
+	return 0;
+}
+#endif
+
+//Bytes of memory the process has resident now
+static unsigned long long residentMemory()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#elif defined(__linux__)
+	return statusBytes("VmRSS:");
+#else
+	return 0;
+#endif
+}
+
+//Most bytes of memory the process has had resident, since it started or since the peak was last reset
+static unsigned long long peakMemory()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+#ifdef __linux__
+	unsigned long long peak = statusBytes("VmHWM:");
+	if (peak > 0)
+		return peak;
+#endif
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (unsigned long long)usage.ru_maxrss; //bytes
+#else
+	return (unsigned long long)usage.ru_maxrss * 1024; //kB
+#endif
+#endif
+}
+
+//Start the peak again from the current resident size, where the system allows it
+static void resetPeakMemory()
+{
+#ifdef __linux__
+	//writing 5 to clear_refs resets VmHWM
+	std::ofstream ofs("/proc/self/clear_refs");
+	ofs << "5";
+#endif
+}
+
+//***Memory Meter***
+
+//Measures the memory the process really uses while the bands of a job run, rather than what the memory model expects
+//the peak resident size of the process at the end of the run less its resident size at the start
+//on linux the peak is reset when the run starts, unless another job is already being measured, so an earlier and larger job
+//doesn't hide this one - elsewhere the peak can be one from before the run, so the figure is an upper bound
+//jobs running at the same time share the process, so each one's figure includes the others
+class MemoryMeter
+{
+public:
+	MemoryMeter() :
+		start(residentMemory())
+	{
+		if (meters++ == 0)
+			resetPeakMemory();
+	}
+	MemoryMeter(const MemoryMeter &) = delete;
+	~MemoryMeter()
+	{
+		--meters;
+	}
+
+	MemoryMeter& operator=(const MemoryMeter &) = delete;
+
+	unsigned long long getPeak() const
+	{
+		unsigned long long peak = peakMemory();
+		return peak > start ? peak - start : 0;
+	}
+
+private:
+	static std::atomic<unsigned int> meters; //meters measuring a job now
+	unsigned long long start; //resident bytes when the run started
+};
+
+std::atomic<unsigned int> MemoryMeter::meters(0);
+
+//***Memory Models***
+
+//bytes used by one band of a blend
+//every frame band, a temporary copy made while it is stored, the output band with its copy, and the byte staging for reading and writing
+static unsigned long long blendBandBytes(unsigned int w, unsigned int rows, unsigned int frames)
+{
+	unsigned long long pixels = (unsigned long long)w * rows;
+	return (frames + 3) * pixels * sizeof(Image::Rgb) + 2 * pixels * 3;
+}
+
+//bytes used by one band of a zoom
+//the input band with its copy, the zoomed band with its copy, and the byte staging for reading and writing
+static unsigned long long zoomBandBytes(unsigned int w, unsigned int rows, int zoom)
+{
+	unsigned long long pixels = (unsigned long long)w * rows;
+	unsigned long long zoomed = pixels * zoom * zoom;
+	return 2 * pixels * sizeof(Image::Rgb) + 2 * zoomed * sizeof(Image::Rgb) + pixels * 3 + zoomed * 3;
+}
+
+//Pick the largest band that fits the budget, using as many threads as possible
+//bytesPerRow is the cost of one row of a band, so a band of n rows costs n * bytesPerRow
+static TilePlan plan(unsigned long long budget, unsigned int height, unsigned long long bytesPerRow, unsigned int threads)
+{
+	TilePlan p;
+	p.budget = budget;
+
+	//no point in more threads than rows
+	threads = std::max(1u, std::min(threads, height));
+
+	//drop threads until each one gets a worthwhile band
+	for (unsigned int c = threads; c > 0; --c)
+	{
+		if (budget / c <= kThreadOverhead)
+			continue;
+
+		//rows each thread can afford
+		unsigned long long rows = (budget / c - kThreadOverhead) / bytesPerRow;
+		//rows needed so that every thread has a band
+		unsigned int share = (height + c - 1) / c;
+		unsigned int wanted = std::min(share, kMinBandRows);
+
+		//a single thread takes any band that fits
+		if (rows >= wanted || (c == 1 && rows >= 1))
+		{
+			p.bandRows = (unsigned int)std::min<unsigned long long>(rows, share);
+			p.concurrency = c;
+			p.buffers = c;
+			p.bands = (height + p.bandRows - 1) / p.bandRows;
+			p.predictedPeak = c * (p.bandRows * bytesPerRow + kThreadOverhead);
+			return p;
+		}
+	}
+
+	//budget can't hold a single row
+	return p;
+}
+
+TilePlan planBlending(unsigned long long budget, unsigned int width, unsigned int height, unsigned int frames, unsigned int threads)
+{
+	return plan(budget, height, blendBandBytes(width, 1, frames), threads);
+}
+
+TilePlan planZoom(unsigned long long budget, unsigned int width, unsigned int height, int zoom, unsigned int threads)
+{
+	return plan(budget, height, zoomBandBytes(width, 1, zoom), threads);
+}
+
+//***Band Execution***
+
+//Process rows [first, first + count) and split the band in half whenever it runs out of memory
+//returns false if even a single row can't be processed
+static bool processBand(const std::function<bool(unsigned int, unsigned int)> &process, unsigned int first, unsigned int count, std::atomic<unsigned int> &splits)
+{
+	try
+	{
+		return process(first, count);
+	}
+	catch (const std::bad_alloc &)
+	{
+		if (count == 1)
+			return false;
+	}
+
+	//degrade to smaller bands instead of failing
+	++splits;
+	unsigned int half = count / 2;
+	return processBand(process, first, half, splits) && processBand(process, first + half, count - half, splits);
+}
+
+//Run every band of the plan on plan.concurrency threads
+//each thread takes the next band that hasn't been started
+static bool runBands(TilePlan &p, unsigned int height, const std::function<bool(unsigned int, unsigned int)> &process)
+{
+	std::atomic<unsigned int> next(0);
+	std::atomic<unsigned int> splits(0);
+	std::atomic<bool> ok(true);
+
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < p.concurrency; ++t)
+	{
+		workers.push_back(std::thread([&]()
+		{
+			unsigned int band;
+			//stop taking bands once one has failed
+			while (ok && (band = next++) < p.bands)
+			{
+				unsigned int first = band * p.bandRows;
+				unsigned int count = std::min(p.bandRows, height - first);
+				if (!processBand(process, first, count, splits))
+					ok = false;
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); ++t)
+		workers[t].join();
+
+	p.splits = splits;
+	return ok;
+}
+
+//***Tile Planner Functions***
+
+//Blend the inputs one band at a time without going over the budget in plan
+//plan.budget and plan.concurrency must be set, the rest of the plan is filled in
+bool blendWithinBudget(const std::vector<std::string> &inputs, BlendFunction blend, const char *output, TilePlan &p)
+{
+	if (inputs.empty())
+		return false;
+
+	//every input must have the same size as the first
+	unsigned int w, h, b;
+	if (!readPPMSize(inputs.front().c_str(), w, h, b))
+		return false;
+	for (size_t i = 1; i < inputs.size(); ++i)
+	{
+		unsigned int iw, ih, ib;
+		if (!readPPMSize(inputs[i].c_str(), iw, ih, ib) || iw != w || ih != h)
+			return false;
+	}
+
+	p = planBlending(p.budget, w, h, (unsigned int)inputs.size(), p.concurrency);
+	if (p.bandRows == 0)
+		return false;
+	//bands finish in any order, each is written straight into its place
+	PPMWriter writer(output, w, h);
+	if (!writer.isOpen())
+		return false;
+
+	MemoryMeter meter;
+	bool ok = runBands(p, h, [&](unsigned int first, unsigned int count)
+	{
+		std::vector<Image*> frames;
+		bool done = false;
+
+		try
+		{
+			//read the band of each input
+			for (size_t i = 0; i < inputs.size(); ++i)
+			{
+				frames.push_back(new Image());
+				*frames.back() = readPPMRows(inputs[i].c_str(), first, count);
+				if (frames.back()->getSize() == 0)
+					throw("Can't read band");
+			}
+
+			//blend and write the band
+			Image blended = blend(frames);
+			done = blended.getSize() != 0 && writer.writeRows(blended, first);
+		}
+		catch (const char *err)
+		{
+			fprintf(stderr, "%s\n", err);
+		}
+		catch (...)
+		{
+			//free the band before letting processBand split it
+			for (size_t i = 0; i < frames.size(); ++i)
+				delete frames[i];
+			throw;
+		}
+
+		for (size_t i = 0; i < frames.size(); ++i)
+			delete frames[i];
+		return done;
+	});
+
+	p.actualPeak = meter.getPeak();
+	return ok && writer.commit();
+}
+
+//Zoom the input one band at a time without going over the budget in plan
+//plan.budget and plan.concurrency must be set, the rest of the plan is filled in
+bool zoomWithinBudget(const std::string &input, int zoom, const char *output, TilePlan &p, ProgressToken *progress)
+{
+	unsigned int w, h, b;
+	if (zoom <= 0 || !readPPMSize(input.c_str(), w, h, b))
+		return false;
+
+	//the zoomed dimensions are written to the header as unsigned ints
+	if ((unsigned long long)w * zoom > 0xFFFFFFFFull || (unsigned long long)h * zoom > 0xFFFFFFFFull)
+	{
+		fprintf(stderr, "Can't zoom a %ux%u image by %d\n", w, h, zoom);
+		return false;
+	}
+
+	p = planZoom(p.budget, w, h, zoom, p.concurrency);
+	if (p.bandRows == 0)
+		return false;
+	PPMWriter writer(output, w * zoom, h * zoom);
+	if (!writer.isOpen())
+		return false;
+
+	MemoryMeter meter;
+	bool ok = runBands(p, h, [&](unsigned int first, unsigned int count)
+	{
+		Image band = readPPMRows(input.c_str(), first, count);
+		if (band.getSize() == 0)
+			return false;
+
+		//each band zooms to zoom times as many rows of the output
+		//bands already run side by side so each zoom keeps to one thread
+		Image zoomed = zoomNearestNeighbour(&band, zoom, progress, 1);
+		return zoomed.getSize() != 0 && writer.writeRows(zoomed, first * zoom);
+	});
+
+	p.actualPeak = meter.getPeak();
+	return ok && writer.commit();
+}
+
+#ifdef __linux__
+//Memory limit of the container the process runs in, 0 if there isn't one
+//cgroup v2 writes "max" for no limit and v1 a number near 2^63, so anything that isn't a plain number below kMaxCgroupLimit is no limit
+static unsigned long long cgroupLimit()
+{
+	const char *files[] = { "/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes" };
+	for (const char *file : files)
+	{
+		std::ifstream ifs(file);
+		std::string line;
+		if (!std::getline(ifs, line))
+			continue;
+		char *end;
+		unsigned long long limit = strtoull(line.c_str(), &end, 10);
+		return end != line.c_str() && *end == '\0' && limit < kMaxCgroupLimit ? limit : 0;
+	}
+	return 0;
+}
+#endif
+
+//Bytes of memory this process can use - the physical memory of the machine, or the container's limit if that's lower
+//0 if it can't be found
+unsigned long long physicalMemory()
+{
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	return GlobalMemoryStatusEx(&status) ? status.ullTotalPhys : 0;
+#else
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pageSize = sysconf(_SC_PAGE_SIZE);
+	unsigned long long physical = pages > 0 && pageSize > 0 ? (unsigned long long)pages * pageSize : 0;
+#ifdef __linux__
+	unsigned long long limit = cgroupLimit();
+	if (limit != 0 && (physical == 0 || limit < physical))
+		physical = limit;
+#endif
+	return physical;
+#endif
+}
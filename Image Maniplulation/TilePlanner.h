@@ -0,0 +1,32 @@
+#pragma once
+#include "Image.h"
+#include <functional> //pass any blending algorithm
+
+//Band size and concurrency chosen so that a job stays within a memory budget
+//a band is a group of whole rows, read from each input with readPPMRows
+struct TilePlan
+{
+	TilePlan();
+
+	unsigned int bandRows; //input rows processed together, 0 if the budget is too small
+	unsigned int concurrency; //bands processed at the same time
+	unsigned int buffers; //band buffer sets alive at once
+	unsigned int bands; //number of bands in the image
+	unsigned int splits; //bands that were split after running out of memory
+	unsigned long long budget; //bytes allowed
+	unsigned long long predictedPeak; //bytes the plan is expected to use
+	unsigned long long actualPeak; //most bytes the process grew by during the run, measured rather than modelled
+};
+
+//any of meanBlend, medianBlend or sigmaClip with its parameter bound
+typedef std::function<Image(std::vector<Image*> &)> BlendFunction;
+
+//Tile Planner Functions
+
+TilePlan planBlending(unsigned long long, unsigned int, unsigned int, unsigned int, unsigned int);
+TilePlan planZoom(unsigned long long, unsigned int, unsigned int, int, unsigned int);
+
+bool blendWithinBudget(const std::vector<std::string> &, BlendFunction, const char*, TilePlan &);
+bool zoomWithinBudget(const std::string &, int, const char*, TilePlan &, ProgressToken* = nullptr); //progress stops the zoom when cancelled
+
+unsigned long long physicalMemory();
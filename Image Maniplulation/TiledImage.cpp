@@ -0,0 +1,606 @@
+#include "TiledImage.h"
+#include "PPMWriter.h"
+#include <fstream> //read and write tiled files
+#include <cstring> //copy float samples
+#include <thread> //encode and read tiles concurrently
+#include <atomic> //share tile counter between threads
+#include <functional> //supply bands of rows to the writer
+#include <algorithm> //min and max
+#include <chrono> //set image read time
+#include <new> //catch bad_alloc
+#include <stdexcept> //catch length_error
+
+//format marker at the start of every file
+static const char kMagic[4] = { 'T', 'I', 'M', '1' };
+//compression modes
+static const unsigned int kRaw = 0;
+static const unsigned int kDeltaRunLength = 1;
+//bytes before the tile index - magic and 6 uint32 fields
+static const unsigned int kHeaderSize = 4 + 6 * 4;
+//bytes used by each tile index entry
+static const unsigned int kIndexEntrySize = 8 + 4 + 4;
+
+//Location of one tile within the file
+struct TileEntry
+{
+	unsigned long long offset; //file position of the tile data
+	unsigned int stored; //bytes stored in the file
+	unsigned int raw; //bytes once decoded
+};
+
+//Everything in the header of a tiled file
+struct TiledHeader
+{
+	unsigned int width, height, tileSize, sampleSize, compression, bitDepth;
+	unsigned int across, down; //tiles across and down the image
+	std::vector<TileEntry> index; //tile locations
+};
+
+//***Byte Helpers***
+
+static bool isLittleEndian()
+{
+	const unsigned int one = 1;
+	return *reinterpret_cast<const unsigned char *>(&one) == 1;
+}
+
+//write a number as little endian bytes
+static void putNumber(std::ostream &os, unsigned long long value, unsigned int bytes)
+{
+	for (unsigned int i = 0; i < bytes; ++i)
+		os.put((char)((value >> (8 * i)) & 0xFF));
+}
+
+//read a number stored as little endian bytes
+static unsigned long long getNumber(std::istream &is, unsigned int bytes)
+{
+	unsigned long long value = 0;
+	for (unsigned int i = 0; i < bytes; ++i)
+		value |= (unsigned long long)(unsigned char)is.get() << (8 * i);
+	return value;
+}
+
+//***Tile Encoding***
+
+//Compress bytes with PackBits run length encoding
+//a control byte n < 128 is followed by n + 1 literal bytes, n >= 129 repeats the next byte 257 - n times
+static void packBits(const std::vector<unsigned char> &in, std::vector<unsigned char> &out)
+{
+	out.clear();
+	size_t i = 0;
+	while (i < in.size())
+	{
+		//length of the run starting here
+		size_t run = 1;
+		while (i + run < in.size() && run < 128 && in[i + run] == in[i])
+			++run;
+
+		if (run >= 2)
+		{
+			out.push_back((unsigned char)(257 - run));
+			out.push_back(in[i]);
+			i += run;
+		}
+		else
+		{
+			//collect literals until the next run of 2 or more
+			size_t start = i;
+			while (i < in.size() && i - start < 128 && !(i + 1 < in.size() && in[i + 1] == in[i]))
+				++i;
+			//a lone byte before a run still has to be written
+			if (i == start)
+				++i;
+			out.push_back((unsigned char)(i - start - 1));
+			out.insert(out.end(), in.begin() + start, in.begin() + i);
+		}
+	}
+}
+
+//Expand PackBits data into exactly size bytes
+//returns false if the data is corrupt
+static bool unpackBits(const unsigned char *in, size_t inSize, std::vector<unsigned char> &out, size_t size)
+{
+	out.resize(size);
+	size_t i = 0, o = 0;
+	while (i < inSize && o < size)
+	{
+		unsigned int n = in[i++];
+		if (n < 128)
+		{
+			if (i + n + 1 > inSize || o + n + 1 > size)
+				return false;
+			memcpy(&out[o], in + i, n + 1);
+			i += n + 1;
+			o += n + 1;
+		}
+		else if (n > 128)
+		{
+			size_t run = 257 - n;
+			if (i >= inSize || o + run > size)
+				return false;
+			memset(&out[o], in[i++], run);
+			o += run;
+		}
+	}
+	return o == size;
+}
+
+//Turn the samples of a tile into bytes, one tile row after another
+static void tileSamples(const Image::Rgb *pixels, unsigned int stride, unsigned int tw, unsigned int th, unsigned int sampleSize, std::vector<unsigned char> &raw)
+{
+	raw.resize((size_t)tw * th * 3 * sampleSize);
+	unsigned char *out = raw.data();
+	bool swap = !isLittleEndian();
+
+	for (unsigned int y = 0; y < th; ++y)
+	{
+		const Image::Rgb *row = pixels + (size_t)y * stride;
+		for (unsigned int x = 0; x < tw; ++x)
+		{
+			const float rgb[3] = { row[x].r, row[x].g, row[x].b };
+			for (int c = 0; c < 3; ++c)
+			{
+				if (sampleSize == 1)
+					//same conversion as writePPM
+					*out++ = static_cast<unsigned char>(std::min(1.f, rgb[c]) * 255);
+				else
+				{
+					memcpy(out, &rgb[c], 4);
+					if (swap)
+						std::reverse(out, out + 4);
+					out += 4;
+				}
+			}
+		}
+	}
+}
+
+//Encode one tile, compressing it when that makes it smaller
+//compression splits the samples into byte planes, stores the difference to the same channel of the previous pixel, and run length encodes the result
+static void encodeTile(const Image::Rgb *pixels, unsigned int stride, unsigned int tw, unsigned int th, unsigned int sampleSize, bool compress, std::vector<unsigned char> &stored, unsigned int &rawSize)
+{
+	std::vector<unsigned char> raw;
+	tileSamples(pixels, stride, tw, th, sampleSize, raw);
+	rawSize = (unsigned int)raw.size();
+
+	if (compress)
+	{
+		size_t samples = raw.size() / sampleSize;
+		std::vector<unsigned char> planes(raw.size());
+		for (unsigned int p = 0; p < sampleSize; ++p)
+		{
+			unsigned char *plane = &planes[p * samples];
+			for (size_t s = 0; s < samples; ++s)
+				plane[s] = raw[s * sampleSize + p];
+			//delta from the back so that each difference uses the original value
+			for (size_t s = samples; s-- > 3;)
+				plane[s] = (unsigned char)(plane[s] - plane[s - 3]);
+		}
+
+		packBits(planes, stored);
+		if (stored.size() < raw.size())
+			return;
+	}
+
+	//compression didn't help
+	stored.swap(raw);
+}
+
+//Decode one tile back into its raw samples
+static bool decodeTile(const std::vector<unsigned char> &stored, unsigned int rawSize, unsigned int sampleSize, std::vector<unsigned char> &raw)
+{
+	//tiles that didn't compress are stored raw
+	if (stored.size() == rawSize)
+	{
+		raw = stored;
+		return true;
+	}
+
+	std::vector<unsigned char> planes;
+	if (!unpackBits(stored.data(), stored.size(), planes, rawSize))
+		return false;
+
+	size_t samples = rawSize / sampleSize;
+	raw.resize(rawSize);
+	for (unsigned int p = 0; p < sampleSize; ++p)
+	{
+		unsigned char *plane = &planes[p * samples];
+		//undo the delta from the front
+		for (size_t s = 3; s < samples; ++s)
+			plane[s] = (unsigned char)(plane[s] + plane[s - 3]);
+		for (size_t s = 0; s < samples; ++s)
+			raw[s * sampleSize + p] = plane[s];
+	}
+	return true;
+}
+
+//***File Layout***
+
+//tiles needed to cover length pixels, without the overflow of rounding up by adding tileSize - 1
+static unsigned int tileCount(unsigned int length, unsigned int tileSize)
+{
+	return length / tileSize + (length % tileSize != 0 ? 1 : 0);
+}
+
+//tile sizes are limited so that the bytes of one tile fit the 32 bit sizes in the index
+static bool validTileSize(unsigned int tileSize, unsigned int sampleSize)
+{
+	return tileSize != 0 && (unsigned long long)tileSize * tileSize * 3 * sampleSize <= 0xFFFFFFFFull;
+}
+
+//Write a tiled file a row of tiles at a time
+//band returns the pixels of rows [first, first + count), using storage if it has to read them from somewhere
+static bool writeTiles(const char *filename, unsigned int w, unsigned int h, unsigned int bitDepth, unsigned int tileSize, unsigned int sampleSize, bool compress,
+	const std::function<const Image::Rgb*(unsigned int, unsigned int, Image &)> &band)
+{
+	if (w == 0 || h == 0 || !validTileSize(tileSize, sampleSize))
+		return false;
+
+	std::ofstream ofs(filename, std::ios::binary);
+	if (ofs.fail())
+	{
+		fprintf(stderr, "Can't open output file\n");
+		return false;
+	}
+
+	unsigned int across = tileCount(w, tileSize);
+	unsigned int down = tileCount(h, tileSize);
+	std::vector<TileEntry> index((size_t)across * down);
+
+	//header
+	ofs.write(kMagic, 4);
+	putNumber(ofs, w, 4);
+	putNumber(ofs, h, 4);
+	putNumber(ofs, tileSize, 4);
+	putNumber(ofs, sampleSize, 4);
+	putNumber(ofs, compress ? kDeltaRunLength : kRaw, 4);
+	putNumber(ofs, bitDepth, 4);
+
+	//leave room for the index, it is filled in once the tile sizes are known
+	unsigned long long offset = kHeaderSize + (unsigned long long)index.size() * kIndexEntrySize;
+	ofs.seekp((std::streamoff)offset);
+
+	Image storage;
+	std::vector<std::vector<unsigned char>> stored(across);
+	std::vector<unsigned int> rawSizes(across);
+	unsigned int threads = std::max(1u, std::min(across, std::thread::hardware_concurrency()));
+
+	for (unsigned int ty = 0; ty < down; ++ty)
+	{
+		unsigned int first = (unsigned int)((unsigned long long)ty * tileSize);
+		unsigned int th = std::min(tileSize, h - first);
+		const Image::Rgb *pixels = band(first, th, storage);
+		if (pixels == nullptr)
+			return false;
+
+		//encode the tiles of this row concurrently
+		std::atomic<unsigned int> next(0);
+		std::vector<std::thread> workers;
+		for (unsigned int t = 0; t < threads; ++t)
+		{
+			workers.push_back(std::thread([&]()
+			{
+				unsigned int tx;
+				while ((tx = next++) < across)
+				{
+					unsigned int tw = (unsigned int)std::min<unsigned long long>(tileSize, w - (unsigned long long)tx * tileSize);
+					encodeTile(pixels + (size_t)tx * tileSize, w, tw, th, sampleSize, compress, stored[tx], rawSizes[tx]);
+				}
+			}));
+		}
+		for (size_t t = 0; t < workers.size(); ++t)
+			workers[t].join();
+
+		//tiles are written in index order
+		for (unsigned int tx = 0; tx < across; ++tx)
+		{
+			TileEntry &entry = index[(size_t)ty * across + tx];
+			entry.offset = offset;
+			entry.stored = (unsigned int)stored[tx].size();
+			entry.raw = rawSizes[tx];
+			ofs.write(reinterpret_cast<const char *>(stored[tx].data()), stored[tx].size());
+			offset += stored[tx].size();
+		}
+	}
+
+	//go back and fill in the index
+	ofs.seekp(kHeaderSize);
+	for (size_t i = 0; i < index.size(); ++i)
+	{
+		putNumber(ofs, index[i].offset, 8);
+		putNumber(ofs, index[i].stored, 4);
+		putNumber(ofs, index[i].raw, 4);
+	}
+
+	ofs.close();
+	return !ofs.fail();
+}
+
+//Read the header and tile index of a tiled file
+static bool readHeader(std::istream &is, TiledHeader &header)
+{
+	char magic[4];
+	is.read(magic, 4);
+	if (is.fail() || memcmp(magic, kMagic, 4) != 0)
+		return false;
+
+	header.width = (unsigned int)getNumber(is, 4);
+	header.height = (unsigned int)getNumber(is, 4);
+	header.tileSize = (unsigned int)getNumber(is, 4);
+	header.sampleSize = (unsigned int)getNumber(is, 4);
+	header.compression = (unsigned int)getNumber(is, 4);
+	header.bitDepth = (unsigned int)getNumber(is, 4);
+	if (is.fail() || header.width == 0 || header.height == 0 || (header.sampleSize != 1 && header.sampleSize != 4) || !validTileSize(header.tileSize, header.sampleSize) || header.compression > kDeltaRunLength)
+		return false;
+
+	header.across = tileCount(header.width, header.tileSize);
+	header.down = tileCount(header.height, header.tileSize);
+
+	//sizes come from the file, so nothing is allocated until they are known to fit in it
+	std::streamoff position = is.tellg();
+	is.seekg(0, std::ios::end);
+	unsigned long long fileSize = (unsigned long long)is.tellg();
+	is.seekg(position);
+	unsigned long long tiles = (unsigned long long)header.across * header.down;
+	if (is.fail() || tiles > (fileSize - kHeaderSize) / kIndexEntrySize)
+		return false;
+	unsigned long long dataStart = kHeaderSize + tiles * kIndexEntrySize;
+
+	header.index.resize((size_t)tiles);
+	for (size_t i = 0; i < header.index.size(); ++i)
+	{
+		TileEntry &entry = header.index[i];
+		entry.offset = getNumber(is, 8);
+		entry.stored = (unsigned int)getNumber(is, 4);
+		entry.raw = (unsigned int)getNumber(is, 4);
+
+		//every tile has to be inside the file and decode to exactly the samples of its size
+		unsigned long long tw = std::min<unsigned long long>(header.tileSize, header.width - i % header.across * (unsigned long long)header.tileSize);
+		unsigned long long th = std::min<unsigned long long>(header.tileSize, header.height - i / header.across * (unsigned long long)header.tileSize);
+		if (entry.offset < dataStart || entry.offset > fileSize || entry.stored > fileSize - entry.offset
+			|| entry.raw != tw * th * 3 * header.sampleSize || entry.stored > entry.raw)
+			return false;
+	}
+	return !is.fail();
+}
+
+//***Tiled Image Functions***
+
+//Write an image as a tiled file
+//float samples keep every value, 8 bit samples round the same way as writePPM
+bool writeTiled(const Image &img, const char *filename, unsigned int tileSize, bool floatSamples, bool compress)
+{
+	//rows are read straight out of the image
+	return writeTiles(filename, img.getWidth(), img.getHeight(), img.getBitDepth(), tileSize, floatSamples ? 4 : 1, compress,
+		[&](unsigned int first, unsigned int, Image &) { return img.getPixels() + (size_t)first * img.getWidth(); });
+}
+
+//Read the dimensions and bit depth of a tiled file
+bool readTiledSize(const char *filename, unsigned int &w, unsigned int &h, unsigned int &b)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	TiledHeader header;
+	if (!readHeader(ifs, header))
+		return false;
+
+	w = header.width;
+	h = header.height;
+	b = header.bitDepth;
+	return true;
+}
+
+//Read the region with its top left corner at (x, y) from a tiled file whose header has already been read
+//only the tiles that overlap the region are read, spread across as many threads as there are tiles
+//returns an empty image if the file can't be read or the region is outside of the image
+static Image readRegion(const char *filename, const TiledHeader &header, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+	Image src;
+
+	try
+	{
+		if (w == 0 || h == 0 || x >= header.width || y >= header.height || w > header.width - x || h > header.height - y)
+			throw("Can't read a region outside of the input image");
+
+		size_t pixels;
+		if (!pixelCount(w, h, pixels))
+			throw("Region is too large to read into memory - read it in smaller regions instead");
+
+		src.setPixels(new Image::Rgb[pixels]);
+		src.setWidth(w);
+		src.setHeight(h);
+		src.setBitDepth(header.bitDepth);
+		src.setName(filename);
+		src.setReadTime(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+
+		//tiles that overlap the region
+		std::vector<size_t> tiles;
+		for (unsigned int ty = y / header.tileSize; ty <= (y + h - 1) / header.tileSize; ++ty)
+			for (unsigned int tx = x / header.tileSize; tx <= (x + w - 1) / header.tileSize; ++tx)
+				tiles.push_back((size_t)ty * header.across + tx);
+
+		//each thread has its own file stream so that tiles are read concurrently
+		std::atomic<size_t> next(0);
+		std::atomic<bool> ok(true);
+		std::vector<std::thread> workers;
+		unsigned int threads = std::max(1u, std::min((unsigned int)tiles.size(), std::thread::hardware_concurrency()));
+		for (unsigned int t = 0; t < threads; ++t)
+		{
+			workers.push_back(std::thread([&]()
+			{
+				//an exception escaping a thread ends the program, so a tile that can't be read just fails the region
+				try
+				{
+					std::ifstream tileStream(filename, std::ios::binary);
+					std::vector<unsigned char> stored, raw;
+					size_t i;
+					while (ok && (i = next++) < tiles.size())
+					{
+						const TileEntry &entry = header.index[tiles[i]];
+						stored.resize(entry.stored);
+						tileStream.seekg((std::streamoff)entry.offset);
+						tileStream.read(reinterpret_cast<char *>(stored.data()), stored.size());
+						if (tileStream.fail() || !decodeTile(stored, entry.raw, header.sampleSize, raw))
+						{
+							ok = false;
+							break;
+						}
+
+						//tile position and size within the image
+						unsigned int tx = (unsigned int)(tiles[i] % header.across * header.tileSize);
+						unsigned int ty = (unsigned int)(tiles[i] / header.across * header.tileSize);
+						unsigned int tw = std::min(header.tileSize, header.width - tx);
+						unsigned int th = std::min(header.tileSize, header.height - ty);
+						if ((size_t)tw * th * 3 * header.sampleSize != raw.size())
+						{
+							ok = false;
+							break;
+						}
+
+						//copy the part of the tile that is inside the region
+						for (unsigned int py = std::max(y, ty); py < std::min(y + h, ty + th); ++py)
+						{
+							for (unsigned int px = std::max(x, tx); px < std::min(x + w, tx + tw); ++px)
+							{
+								const unsigned char *sample = &raw[(((size_t)(py - ty) * tw) + (px - tx)) * 3 * header.sampleSize];
+								Image::Rgb &pixel = src[(size_t)(py - y) * w + (px - x)];
+								if (header.sampleSize == 1)
+								{
+									//values divided by 255 as in readPPM
+									pixel.r = sample[0] / 255.f;
+									pixel.g = sample[1] / 255.f;
+									pixel.b = sample[2] / 255.f;
+								}
+								else
+								{
+									float rgb[3];
+									memcpy(rgb, sample, sizeof(rgb));
+									if (!isLittleEndian())
+									{
+										for (int c = 0; c < 3; ++c)
+											std::reverse(reinterpret_cast<unsigned char *>(&rgb[c]), reinterpret_cast<unsigned char *>(&rgb[c]) + 4);
+									}
+									pixel = Image::Rgb(rgb[0], rgb[1], rgb[2]);
+								}
+							}
+						}
+					}
+				}
+				catch (const std::exception &)
+				{
+					ok = false;
+				}
+			}));
+		}
+		for (size_t t = 0; t < workers.size(); ++t)
+			workers[t].join();
+
+		if (!ok)
+			throw("Tiled image is corrupt");
+	}
+	catch (const char *err)
+	{
+		fprintf(stderr, "%s\n", err);
+		//return an empty image rather than a partially read one
+		src = Image();
+	}
+	catch (const std::bad_alloc &)
+	{
+		fprintf(stderr, "Not enough memory to read the tiled image\n");
+		src = Image();
+	}
+	catch (const std::length_error &)
+	{
+		fprintf(stderr, "Tiled image is too large to read\n");
+		src = Image();
+	}
+
+	return src;
+}
+
+//Read the header and tile index of a tiled file, saying why if it can't be read
+static bool readFileHeader(const char *filename, TiledHeader &header)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	if (ifs.fail())
+	{
+		fprintf(stderr, "Can't open the input file - is it named correctly/is it in the right directory?\n");
+		return false;
+	}
+	if (!readHeader(ifs, header))
+	{
+		fprintf(stderr, "Can't read the input file - is it a tiled image (Has TIM1 in the header)?\n");
+		return false;
+	}
+	return true;
+}
+
+//Read the region with its top left corner at (x, y) from a tiled file
+//returns an empty image if the file can't be read or the region is outside of the image
+Image readTiledRegion(const char *filename, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+	TiledHeader header;
+	if (!readFileHeader(filename, header))
+		return Image();
+	return readRegion(filename, header, x, y, w, h);
+}
+
+//Read a band of whole rows from a tiled file
+Image readTiledRows(const char *filename, unsigned int firstRow, unsigned int rowCount)
+{
+	TiledHeader header;
+	if (!readFileHeader(filename, header))
+		return Image();
+	return readRegion(filename, header, 0, firstRow, header.width, rowCount);
+}
+
+//Read a whole tiled file
+Image readTiled(const char *filename)
+{
+	TiledHeader header;
+	if (!readFileHeader(filename, header))
+		return Image();
+	return readRegion(filename, header, 0, 0, header.width, header.height);
+}
+
+//Convert a binary ppm file to a tiled file with 8 bit samples
+//the ppm is read one row of tiles at a time with readPPMRows
+bool ppmToTiled(const char *input, const char *output, unsigned int tileSize, bool compress)
+{
+	unsigned int w, h, b;
+	if (!readPPMSize(input, w, h, b))
+	{
+		fprintf(stderr, "Can't read the input file - is it in binary format (Has P6 in the header)?\n");
+		return false;
+	}
+
+	//8 bit samples, whatever the maxval of the input was
+	return writeTiles(output, w, h, 255, tileSize, 1, compress, [&](unsigned int first, unsigned int count, Image &storage) -> const Image::Rgb*
+	{
+		storage = readPPMRows(input, first, count);
+		return storage.getSize() == 0 ? nullptr : storage.getPixels();
+	});
+}
+
+//Convert a tiled file to a binary ppm file
+//one row of tiles is read at a time and written into its place in the output
+bool tiledToPPM(const char *input, const char *output)
+{
+	//the header and tile index are read once rather than for every row of tiles
+	TiledHeader header;
+	if (!readFileHeader(input, header))
+		return false;
+	unsigned int w = header.width;
+	unsigned int h = header.height;
+
+	PPMWriter writer(output, w, h);
+	if (!writer.isOpen())
+		return false;
+
+	for (unsigned int first = 0; first < h; first += header.tileSize)
+	{
+		Image band = readRegion(input, header, 0, first, w, std::min(header.tileSize, h - first));
+		if (band.getSize() == 0 || !writer.writeRows(band, first))
+			return false;
+	}
+	return writer.commit();
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "Image.h"
+
+//Tiled image container (.tim)
+//Pixels are split into square tiles that are stored independently, with an index of tile offsets in the header,
+//so a region or band of rows can be read without touching the rest of the file and tiles can be read concurrently
+//Layout (all numbers little endian):
+//	"TIM1"
+//	uint32 width, height, tile size, bytes per sample (1 = 8 bit, 4 = float), compression (0 = none, 1 = delta + run length), bit depth
+//	per tile, left to right then top to bottom: uint64 offset, uint32 stored size, uint32 raw size
+//	tile data - tile rows of r, g, b samples, stored raw when compression doesn't make the tile smaller
+
+//Tiled Image Functions
+
+bool writeTiled(const Image &, const char*, unsigned int = 256, bool = true, bool = true);
+Image readTiled(const char*);
+Image readTiledRegion(const char*, unsigned int, unsigned int, unsigned int, unsigned int);
+Image readTiledRows(const char*, unsigned int, unsigned int);
+bool readTiledSize(const char*, unsigned int &, unsigned int &, unsigned int &);
+
+//converters work a row of tiles at a time so whole frames are never held in memory
+bool ppmToTiled(const char*, const char*, unsigned int = 256, bool = true);
+bool tiledToPPM(const char*, const char*);